@@ -0,0 +1,615 @@
+#include <QString>
+#include <QtTest>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QPainter>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "../src/LSystem.h"
+#include "../src/VirtualTurtle.h"
+#include "../src/TurtleInterpreter.h"
+#include "../src/TurtleArena.h"
+#include "../src/ParallelTurtleInterpreter.h"
+#include "../src/GeometryMemo.h"
+#include "../src/GeometryPainter.h"
+#include "../src/TileRasterizer.h"
+#include "../src/RenderJob.h"
+
+namespace
+{
+    /**
+     * @brief Environment variable naming the file the results are written
+     * to, as JSON.
+     */
+    const char *const results_variable = "LSYSTEM_BENCHMARK_RESULTS";
+    const char *const default_results_path = "lsystem-benchmark.json";
+
+    const QSize raster_size(1024, 1024);
+}
+
+/**
+ * @brief Benchmarks of the pipeline of the renderer, over a corpus of
+ * standard grammars : the iteration, the bounds and geometry passes of
+ * RenderJob, the offscreen rasterization, and the whole of it ; and of the
+ * rewriting of a state alone, by the production table and its kernels.
+ *
+ * Every benchmark runs under QBENCHMARK, so the usual QtTest options apply
+ * (-csv or -xml for a machine-readable output, -iterations, -tickcounter...).
+ * The throughput of every case is also recorded, and written as JSON to the
+ * file named by LSYSTEM_BENCHMARK_RESULTS (lsystem-benchmark.json by
+ * default) :
+ * @code
+ * [ { "benchmark": "geometryBenchmark", "case": "Koch, N=6, serial",
+ *     "symbols": 28672, "segments": 12288, "bytes": ...,
+ *     "iterations": ..., "ns_per_iteration": ..., "symbols_per_second": ... },
+ *   ... ]
+ * @endcode
+ * where bytes is the memory allocated for the result of the benchmarked
+ * stage : the new state, the segments or the image.
+ */
+class LSystemBenchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    LSystemBenchmark();
+
+private Q_SLOTS:
+    void cleanupTestCase();
+    void iterationBenchmark_data();
+    void iterationBenchmark();
+    void rewriteBenchmark_data();
+    void rewriteBenchmark();
+    void rewriteKernelBenchmark_data();
+    void rewriteKernelBenchmark();
+    void boundsBenchmark_data();
+    void boundsBenchmark();
+    void geometryBenchmark_data();
+    void geometryBenchmark();
+    void rasterizationBenchmark_data();
+    void rasterizationBenchmark();
+    void latencyBenchmark_data();
+    void latencyBenchmark();
+
+private:
+    /**
+     * @brief Add the corpus of grammars as the rows of the current test
+     * data, once per variant of the benchmark.
+     */
+    static void add_corpus(const QStringList &variants);
+
+    /**
+     * @brief Record the throughput of the current case, measured over
+     * iterations runs taking elapsed nanoseconds. Replaces the previous
+     * record of the case, QtTest running a benchmark several times.
+     */
+    void record(quint64 symbols, quint64 segments, quint64 bytes,
+                quint64 iterations, qint64 elapsed);
+
+    QStringList m_order; //!< keys of m_results, in order
+    QHash<QString, QJsonObject> m_results; //!< by benchmark and case
+};
+
+LSystemBenchmark::LSystemBenchmark()
+{
+}
+
+/**
+ * @brief Reference rewriting, as done by the first version of LSystem::iterate().
+ */
+static State reference_iterate(const State &state, const RulesDict &rules)
+{
+    State newState;
+    State::const_iterator iter;
+    for (iter = state.begin(); iter != state.end(); ++iter)
+    {
+        const char c = *iter;
+        newState += rules.value(c, QChar(c)).toStdString();
+    }
+    return newState;
+}
+
+void LSystemBenchmark::add_corpus(const QStringList &variants)
+{
+    QTest::addColumn<QString>("axiom");
+    QTest::addColumn<RulesDict>("rules");
+    QTest::addColumn<float>("angle");
+    QTest::addColumn<int>("generation");
+    QTest::addColumn<QString>("variant");
+
+    struct Grammar
+    {
+        const char *name;
+        const char *axiom;
+        RulesDict rules;
+        float angle;
+        int generations[2];
+    };
+    QList<Grammar> corpus;
+    Grammar grammar;
+
+    grammar.name = "Koch", grammar.axiom = "F--F--F", grammar.angle = 60.f;
+    grammar.rules.clear();
+    grammar.rules['F'] = "F+F--F+F";
+    grammar.generations[0] = 6, grammar.generations[1] = 9;
+    corpus << grammar;
+
+    grammar.name = "Sierpinski", grammar.axiom = "FXF--FF--FF", grammar.angle = 60.f;
+    grammar.rules.clear();
+    grammar.rules['F'] = "FF", grammar.rules['X'] = "--FXF++FXF++FXF--";
+    grammar.generations[0] = 7, grammar.generations[1] = 11;
+    corpus << grammar;
+
+    grammar.name = "Dragon", grammar.axiom = "FX", grammar.angle = 90.f;
+    grammar.rules.clear();
+    grammar.rules['X'] = "X+YF+", grammar.rules['Y'] = "-FX-Y";
+    grammar.generations[0] = 14, grammar.generations[1] = 20;
+    corpus << grammar;
+
+    grammar.name = "Hilbert", grammar.axiom = "X", grammar.angle = 90.f;
+    grammar.rules.clear();
+    grammar.rules['X'] = "-YF+XFX+FY-", grammar.rules['Y'] = "+XF-YFY-XF+";
+    grammar.generations[0] = 7, grammar.generations[1] = 10;
+    corpus << grammar;
+
+    grammar.name = "Plant", grammar.axiom = "X", grammar.angle = 25.f;
+    grammar.rules.clear();
+    grammar.rules['X'] = "F+[[X]-X]-F[-FX]+X", grammar.rules['F'] = "FF";
+    grammar.generations[0] = 6, grammar.generations[1] = 9;
+    corpus << grammar;
+
+    for (int i = 0; i < corpus.size(); ++i)
+    {
+        for (int g = 0; g < 2; ++g)
+        {
+            for (int v = 0; v < variants.size(); ++v)
+            {
+                const QString tag = QString("%1, N=%2, %3").arg(corpus[i].name)
+                        .arg(corpus[i].generations[g]).arg(variants[v]);
+                QTest::newRow(qPrintable(tag)) << QString(corpus[i].axiom)
+                        << corpus[i].rules << corpus[i].angle
+                        << corpus[i].generations[g] << variants[v];
+            }
+        }
+    }
+}
+
+void LSystemBenchmark::record(quint64 symbols, quint64 segments, quint64 bytes,
+                              quint64 iterations, qint64 elapsed)
+{
+    const QString benchmark = QTest::currentTestFunction();
+    const QString key = benchmark + '/' + QTest::currentDataTag();
+    const double ns_per_iteration = (iterations > 0) ?
+                static_cast<double>(elapsed) / iterations : 0.;
+
+    QJsonObject result;
+    result["benchmark"] = benchmark;
+    result["case"] = QString(QTest::currentDataTag());
+    result["symbols"] = static_cast<double>(symbols);
+    result["segments"] = static_cast<double>(segments);
+    result["bytes"] = static_cast<double>(bytes);
+    result["iterations"] = static_cast<double>(iterations);
+    result["ns_per_iteration"] = ns_per_iteration;
+    result["symbols_per_second"] = (ns_per_iteration > 0) ?
+                symbols * 1e9 / ns_per_iteration : 0.;
+
+    if (!m_results.contains(key))
+        m_order.append(key);
+    m_results[key] = result;
+}
+
+void LSystemBenchmark::cleanupTestCase()
+{
+    QJsonArray results;
+    for (int i = 0; i < m_order.size(); ++i)
+        results.append(m_results.value(m_order[i]));
+
+    QString path = qgetenv(results_variable);
+    if (path.isEmpty())
+        path = default_results_path;
+    QFile file(path);
+    QVERIFY2(file.open(QIODevice::WriteOnly | QIODevice::Truncate),
+             qPrintable("cannot write " + path));
+    file.write(QJsonDocument(results).toJson());
+}
+
+void LSystemBenchmark::iterationBenchmark_data()
+{
+    add_corpus(QStringList() << "serial" << "parallel" << "packed");
+}
+
+void LSystemBenchmark::iterationBenchmark()
+{
+    QFETCH(QString, axiom);
+    QFETCH(RulesDict, rules);
+    QFETCH(int, generation);
+    QFETCH(QString, variant);
+
+    // benchmark the iteration of the generation N-1 into the generation N :
+    // the generation N-1 stays cached, so going back to it is immediate
+    LSystem lsystem(LSystem::string_to_state(axiom), rules);
+    lsystem.set_thread_count(variant == "parallel" ? 0 : 1);
+    lsystem.set_packed(variant == "packed");
+    lsystem.jump_to(generation - 1);
+    QVERIFY(lsystem.is_cached(generation - 1));
+
+    quint64 iterations = 0;
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK {
+        lsystem.jump_to(generation - 1);
+        lsystem.iterate();
+        ++iterations;
+    }
+    const qint64 elapsed = timer.nsecsElapsed();
+
+    QCOMPARE(lsystem.generation(), static_cast<uint>(generation));
+    QCOMPARE(lsystem.length(), lsystem.predicted_length(generation));
+    record(lsystem.length(), 0, lsystem.snapshot()->memory_usage(),
+           iterations, elapsed);
+}
+
+void LSystemBenchmark::rewriteBenchmark_data()
+{
+    QTest::addColumn<bool>("reference");
+    QTest::addColumn<int>("generation");
+
+    for (int n = 5; n <= 7; ++n)
+    {
+        QTest::newRow(qPrintable(QString("reference, N=%1").arg(n))) << true << n;
+        QTest::newRow(qPrintable(QString("table, N=%1").arg(n))) << false << n;
+    }
+}
+
+void LSystemBenchmark::rewriteBenchmark()
+{
+    QFETCH(bool, reference);
+    QFETCH(int, generation);
+
+    // default grammar of the application
+    RulesDict rules;
+    rules['F'] = "F[+F]F[-F][F]";
+    const ProductionTable table(rules);
+
+    // benchmark the rewriting of the generation N-1 into the generation N
+    State state = "F";
+    for (int i = 1; i < generation; ++i)
+        state = table.apply(state);
+
+    State result;
+    quint64 iterations = 0;
+    QElapsedTimer timer;
+    timer.start();
+    if (reference)
+    {
+        QBENCHMARK {
+            result = reference_iterate(state, rules);
+            ++iterations;
+        }
+    }
+    else
+    {
+        QBENCHMARK {
+            result = table.apply(state);
+            ++iterations;
+        }
+    }
+    const qint64 elapsed = timer.nsecsElapsed();
+
+    QCOMPARE(result, reference_iterate(state, rules));
+    record(result.length(), 0, result.capacity(), iterations, elapsed);
+}
+
+void LSystemBenchmark::rewriteKernelBenchmark_data()
+{
+    QTest::addColumn<RulesDict>("rules");
+    QTest::addColumn<bool>("vectorized");
+
+    QList<QPair<QString, RulesDict> > grammars;
+    RulesDict rules;
+    rules['A'] = "AB", rules['B'] = "A";
+    grammars << qMakePair(QString("Algea"), rules);
+    rules.clear();
+    rules['F'] = "G-F-G", rules['G'] = "F+G+F";
+    grammars << qMakePair(QString("Sierpinski"), rules);
+    rules.clear();
+    rules['F'] = "F[+F]F[-F][F]";
+    grammars << qMakePair(QString("Plant"), rules);
+
+    for (int i = 0; i < grammars.size(); ++i)
+    {
+        QTest::newRow(qPrintable(grammars[i].first + ", scalar"))
+                << grammars[i].second << false;
+        QTest::newRow(qPrintable(grammars[i].first + ", SIMD"))
+                << grammars[i].second << true;
+    }
+}
+
+void LSystemBenchmark::rewriteKernelBenchmark()
+{
+    QFETCH(RulesDict, rules);
+    QFETCH(bool, vectorized);
+
+    // a state of a few million symbols
+    ProductionTable table(rules);
+    State state(1, rules.firstKey());
+    while (state.length() < (1 << 22))
+        state = table.apply(state);
+
+    table.set_instruction_set(RewriteKernel::Scalar);
+    const State expected = table.apply(state);
+    if (vectorized)
+    {
+        table.set_instruction_set(RewriteKernel::supported_instruction_set());
+        if (table.instruction_set() == RewriteKernel::Scalar)
+            QSKIP("no SIMD instruction set supported");
+    }
+
+    State result;
+    quint64 iterations = 0;
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK {
+        result = table.apply(state);
+        ++iterations;
+    }
+    const qint64 elapsed = timer.nsecsElapsed();
+
+    QCOMPARE(result, expected);
+    record(result.length(), 0, result.capacity(), iterations, elapsed);
+}
+
+void LSystemBenchmark::boundsBenchmark_data()
+{
+    add_corpus(QStringList() << "memo" << "walk");
+}
+
+void LSystemBenchmark::boundsBenchmark()
+{
+    QFETCH(QString, axiom);
+    QFETCH(RulesDict, rules);
+    QFETCH(float, angle);
+    QFETCH(int, generation);
+    QFETCH(QString, variant);
+
+    LSystem lsystem(LSystem::string_to_state(axiom), rules);
+    lsystem.jump_to(generation);
+    const DerivationTree derivation = lsystem.derivation();
+
+    // the two ways the renderer could compute the boundaries : from the
+    // memoized drawings of the symbols, or by walking the whole state
+    QRectF bounds;
+    quint64 iterations = 0;
+    QElapsedTimer timer;
+    timer.start();
+    if (variant == "memo")
+    {
+        QBENCHMARK {
+            const GeometryMemo memo(derivation.productions(), angle,
+                                    derivation.depth());
+            QVERIFY(memo.state_bounds(derivation, bounds));
+            ++iterations;
+        }
+    }
+    else
+    {
+        QBENCHMARK {
+            VirtualTurtle turtle(QPointF(0, 0));
+            turtle.heading = 90.f;
+            QStack<TurtleState> stack;
+            float minX = 0, minY = 0, maxX = 0, maxY = 0;
+            auto interpret = [&](char symbol) -> bool
+            {
+                switch (symbol)
+                {
+                    case '+':
+                        turtle.left(angle);
+                        break;
+                    case '-':
+                        turtle.right(angle);
+                        break;
+                    case '[':
+                        stack.push(TurtleState(turtle.pos, turtle.heading));
+                        break;
+                    case ']':
+                    {
+                        if (stack.isEmpty())
+                            return false;
+                        const TurtleState state = stack.pop();
+                        turtle.pos = state.first, turtle.heading = state.second;
+                        break;
+                    }
+                    case 'F':
+                        turtle.forward(1.f);
+                        break;
+                }
+                const float x = turtle.pos.x(), y = turtle.pos.y();
+                minX = qMin(minX, x), maxX = qMax(maxX, x);
+                minY = qMin(minY, y), maxY = qMax(maxY, y);
+                return true;
+            };
+            QVERIFY(derivation.walk(interpret));
+            bounds = QRectF(QPointF(minX, minY), QPointF(maxX, maxY));
+            ++iterations;
+        }
+    }
+    const qint64 elapsed = timer.nsecsElapsed();
+
+    QVERIFY(bounds.isValid());
+    record(derivation.length(), 0, 0, iterations, elapsed);
+}
+
+void LSystemBenchmark::geometryBenchmark_data()
+{
+    add_corpus(QStringList() << "serial" << "arena" << "parallel");
+}
+
+void LSystemBenchmark::geometryBenchmark()
+{
+    QFETCH(QString, axiom);
+    QFETCH(RulesDict, rules);
+    QFETCH(float, angle);
+    QFETCH(int, generation);
+    QFETCH(QString, variant);
+
+    LSystem lsystem(LSystem::string_to_state(axiom), rules);
+    lsystem.jump_to(generation);
+    const DerivationTree derivation = lsystem.derivation();
+
+    // the interpretation pass of RenderJob : geometry and bounds at once
+    TurtleGeometry geometry;
+    quint64 iterations = 0;
+    QElapsedTimer timer;
+    timer.start();
+    if (variant == "parallel")
+    {
+        QBENCHMARK {
+            geometry.clear();
+            ParallelTurtleInterpreter interpreter(angle, TaskScheduler::global_instance());
+            QVERIFY(interpreter.interpret(derivation, geometry));
+            ++iterations;
+        }
+    }
+    else if (variant == "arena")
+    {
+        // the arena is kept between the renders, like by the widgets
+        TurtleArena arena;
+        const DerivationTree profiled = lsystem.axiom_derivation(generation);
+        QBENCHMARK {
+            arena.prepare(profiled);
+            TurtleInterpreter interpreter(angle, arena);
+            auto interpret = [&](char symbol) { return interpreter.interpret(symbol); };
+            QVERIFY(derivation.walk(interpret));
+            interpreter.finish();
+            ++iterations;
+        }
+        geometry = arena.geometry;
+    }
+    else
+    {
+        QBENCHMARK {
+            geometry = TurtleGeometry(); // every render allocates its storage
+            TurtleInterpreter interpreter(angle, geometry);
+            auto interpret = [&](char symbol) { return interpreter.interpret(symbol); };
+            QVERIFY(derivation.walk(interpret));
+            interpreter.finish();
+            ++iterations;
+        }
+    }
+    const qint64 elapsed = timer.nsecsElapsed();
+
+    QVERIFY(geometry.segments.segment_count() > 0);
+    record(derivation.length(), geometry.segments.segment_count(),
+           geometry.segments.memory_usage(), iterations, elapsed);
+}
+
+void LSystemBenchmark::rasterizationBenchmark_data()
+{
+    add_corpus(QStringList() << "painter" << "tiles");
+}
+
+void LSystemBenchmark::rasterizationBenchmark()
+{
+    QFETCH(QString, axiom);
+    QFETCH(RulesDict, rules);
+    QFETCH(float, angle);
+    QFETCH(int, generation);
+    QFETCH(QString, variant);
+
+    LSystem lsystem(LSystem::string_to_state(axiom), rules);
+    lsystem.jump_to(generation);
+    const DerivationTree derivation = lsystem.derivation();
+    TurtleGeometry geometry;
+    TurtleInterpreter interpreter(angle, geometry);
+    auto interpret = [&](char symbol) { return interpreter.interpret(symbol); };
+    QVERIFY(derivation.walk(interpret));
+    interpreter.finish();
+    const QTransform transform = geometry.fit(raster_size);
+
+    // offscreen : a single QPainter, or the tiles of a TileRasterizer
+    QImage image;
+    quint64 iterations = 0;
+    QElapsedTimer timer;
+    timer.start();
+    if (variant == "tiles")
+    {
+        TileRasterizer rasterizer(TaskScheduler::global_instance());
+        QBENCHMARK {
+            image = rasterizer.render(geometry.segments, transform, raster_size);
+            ++iterations;
+        }
+    }
+    else
+    {
+        QBENCHMARK {
+            image = QImage(raster_size, QImage::Format_ARGB32_Premultiplied);
+            image.fill(Qt::white);
+            QPainter painter(&image);
+            painter.setRenderHint(QPainter::Antialiasing);
+            draw_segments(painter, geometry.segments, transform);
+            ++iterations;
+        }
+    }
+    const qint64 elapsed = timer.nsecsElapsed();
+
+    QVERIFY(!image.isNull());
+    record(derivation.length(), geometry.segments.segment_count(),
+           image.byteCount(), iterations, elapsed);
+}
+
+void LSystemBenchmark::latencyBenchmark_data()
+{
+    add_corpus(QStringList() << "sequential" << "pipelined");
+}
+
+void LSystemBenchmark::latencyBenchmark()
+{
+    QFETCH(QString, axiom);
+    QFETCH(RulesDict, rules);
+    QFETCH(float, angle);
+    QFETCH(int, generation);
+    QFETCH(QString, variant);
+
+    // from "next iteration" to the pixels of the generation N : rendered
+    // once it is materialized, or from its derivation while it is
+    LSystem lsystem(LSystem::string_to_state(axiom), rules);
+    lsystem.jump_to(generation - 1);
+    QVERIFY(lsystem.is_cached(generation - 1));
+    QScopedPointer<RenderJob> job;
+    auto start_job = [&]()
+    {
+        RenderInput input(lsystem);
+        input.angle = angle;
+        input.size = raster_size;
+        job.reset(new RenderJob(input));
+        job->start(TaskScheduler::global_instance());
+    };
+    const bool pipelined = (variant == "pipelined");
+    if (pipelined)
+        QObject::connect(&lsystem, &LSystem::iteration_derived, start_job);
+
+    quint64 iterations = 0;
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK {
+        lsystem.jump_to(generation - 1);
+        lsystem.iterate();
+        if (!pipelined)
+            start_job();
+        job->wait();
+        ++iterations;
+    }
+    const qint64 elapsed = timer.nsecsElapsed();
+
+    const RenderOutput &output = job->output();
+    QVERIFY(output.valid);
+    QCOMPARE(job->input().snapshot->generation, static_cast<uint>(generation));
+    record(lsystem.length(), output.geometry->segments.segment_count(),
+           output.image.byteCount(), iterations, elapsed);
+}
+
+QTEST_APPLESS_MAIN(LSystemBenchmark)
+
+#include "tst_lsystembenchmark.moc"
@@ -0,0 +1,394 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QPainter>
+#include <QScopedPointer>
+#include <QSvgGenerator>
+#include <QTextStream>
+
+#include "../src/LSystem.h"
+#include "../src/TurtleInterpreter.h"
+#include "../src/ParallelTurtleInterpreter.h"
+#include "../src/LodTurtleInterpreter.h"
+#include "../src/GeometryMemo.h"
+#include "../src/GeometryPainter.h"
+#include "../src/TileRasterizer.h"
+#include "../src/TaskScheduler.h"
+#include "../src/GenerationStore.h"
+
+/**
+ * @brief What to render, read from a grammar file and from the arguments.
+ */
+struct RenderSettings
+{
+    QString axiom;
+    RulesDict rules;
+    float angle;
+    uint generations;
+    QSize size;
+};
+
+static QTextStream out(stdout);
+static QTextStream err(stderr);
+
+/**
+ * @brief Parse a rule written as "F=F[+F]F".
+ */
+static bool parse_rule(const QString &rule, RulesDict &rules)
+{
+    const int equal = rule.indexOf('=');
+    if (equal != 1)
+        return false;
+    rules[rule[0].toLatin1()] = rule.mid(2);
+    return true;
+}
+
+/**
+ * @brief Parse a size written as "800x600".
+ */
+static bool parse_size(const QString &string, QSize &size)
+{
+    const QStringList values = string.split('x');
+    bool okWidth = false, okHeight = false;
+    if (values.size() == 2)
+        size = QSize(values[0].toInt(&okWidth), values[1].toInt(&okHeight));
+    return okWidth && okHeight && !size.isEmpty();
+}
+
+/**
+ * @brief Read a grammar file into settings.
+ *
+ * One setting per line, as "key value" ; '#' starts a comment :
+ * @code
+ * # fractal plant
+ * axiom X
+ * rule X=F+[[X]-X]-F[-FX]+X
+ * rule F=FF
+ * angle 25
+ * generations 6
+ * size 1024x1024
+ * @endcode
+ */
+static bool read_grammar_file(const QString &path, RenderSettings &settings)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        err << "cannot open " << path << endl;
+        return false;
+    }
+
+    QTextStream stream(&file);
+    for (int n = 1; !stream.atEnd(); ++n)
+    {
+        const QString line = stream.readLine().section('#', 0, 0).trimmed();
+        if (line.isEmpty())
+            continue;
+        const QString key = line.section(' ', 0, 0),
+                value = line.section(' ', 1).trimmed();
+        bool ok = true;
+        if (key == "axiom")
+            settings.axiom = value;
+        else if (key == "rule")
+            ok = parse_rule(value, settings.rules);
+        else if (key == "angle")
+            settings.angle = value.toFloat(&ok);
+        else if (key == "generations")
+            settings.generations = value.toUInt(&ok);
+        else if (key == "size")
+            ok = parse_size(value, settings.size);
+        else
+            ok = false;
+        if (!ok)
+        {
+            err << path << ":" << n << ": invalid line \"" << line << "\"" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Print the duration of a stage, and restart the timer.
+ */
+static void print_timing(const QString &stage, QElapsedTimer &timer,
+                         const QString &details)
+{
+    out << stage.leftJustified(12) << timer.restart() << " ms\t" << details << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("lsystem-render");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Render an L-System to an image, without any window.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("output", "Output file : .svg, .ppm (streamed, for huge sizes), or any image format (.png...).");
+    const QCommandLineOption fileOption(QStringList() << "f" << "file",
+                                        "Read the grammar from <file>.", "file");
+    const QCommandLineOption axiomOption(QStringList() << "a" << "axiom",
+                                         "Axiom (default : F).", "axiom");
+    const QCommandLineOption ruleOption(QStringList() << "r" << "rule",
+                                        "Production rule, e.g. F=F[+F]F (repeatable).", "rule");
+    const QCommandLineOption angleOption("angle", "Rotation angle in degrees (default : 20).",
+                                         "degrees");
+    const QCommandLineOption generationsOption(QStringList() << "n" << "generations",
+                                               "Number of iterations (default : 5).", "n");
+    const QCommandLineOption sizeOption(QStringList() << "s" << "size",
+                                        "Output size (default : 1024x1024).", "WxH");
+    const QCommandLineOption threadsOption("threads", "Number of threads (default : one per core).",
+                                           "count");
+    const QCommandLineOption lodOption("lod", "Level of detail : drop the details smaller than "
+                                       "a pixel, for a cost about proportional to the size.");
+    const QCommandLineOption instancedOption("instanced", "Draw copies of memoized subtrees "
+                                             "rather than interpreting the whole state (only for "
+                                             "angles dividing a whole turn).");
+    const QCommandLineOption packedOption("packed", "Store the generations packed, in about half "
+                                          "the memory (rewritten on a single thread).");
+    const QCommandLineOption cacheOption("cache", "Keep the generations and their geometry in "
+                                         "<directory>, and reload them from it.", "directory");
+    parser.addOption(fileOption);
+    parser.addOption(axiomOption);
+    parser.addOption(ruleOption);
+    parser.addOption(angleOption);
+    parser.addOption(generationsOption);
+    parser.addOption(sizeOption);
+    parser.addOption(threadsOption);
+    parser.addOption(lodOption);
+    parser.addOption(instancedOption);
+    parser.addOption(packedOption);
+    parser.addOption(cacheOption);
+    parser.process(app);
+
+    if (parser.positionalArguments().size() != 1)
+        parser.showHelp(1);
+    const QString output = parser.positionalArguments().first();
+
+    // the arguments override the grammar file
+    RenderSettings settings;
+    settings.axiom = "F";
+    settings.angle = 20.f;
+    settings.generations = 5;
+    settings.size = QSize(1024, 1024);
+    if (parser.isSet(fileOption) && !read_grammar_file(parser.value(fileOption), settings))
+        return 1;
+    bool ok = true;
+    if (parser.isSet(axiomOption))
+        settings.axiom = parser.value(axiomOption);
+    foreach (const QString &rule, parser.values(ruleOption))
+        ok = ok && parse_rule(rule, settings.rules);
+    if (ok && parser.isSet(angleOption))
+        settings.angle = parser.value(angleOption).toFloat(&ok);
+    if (ok && parser.isSet(generationsOption))
+        settings.generations = parser.value(generationsOption).toUInt(&ok);
+    if (ok && parser.isSet(sizeOption))
+        ok = parse_size(parser.value(sizeOption), settings.size);
+    int threads = 0;
+    if (ok && parser.isSet(threadsOption))
+        threads = parser.value(threadsOption).toInt(&ok);
+    if (!ok || (parser.isSet(lodOption) && parser.isSet(instancedOption)))
+    {
+        err << "invalid arguments, see --help" << endl;
+        return 1;
+    }
+    // the iteration uses threads of the global scheduler, the other stages
+    // share the workers of scheduler
+    QScopedPointer<TaskScheduler> own_scheduler(threads > 0 ? new TaskScheduler(threads) : nullptr);
+    TaskScheduler &scheduler = threads > 0 ? *own_scheduler : TaskScheduler::global_instance();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // iteration
+    LSystem lsystem(LSystem::string_to_state(settings.axiom), settings.rules);
+    lsystem.set_thread_count(threads);
+    // level of detail and instancing : the derivation tree must go down to
+    // the axiom, respectively to prune branches and to expand memoized symbols
+    lsystem.set_lazy(parser.isSet(lodOption) || parser.isSet(instancedOption));
+    lsystem.set_packed(parser.isSet(packedOption));
+    GenerationStorePtr store;
+    if (parser.isSet(cacheOption))
+    {
+        store = GenerationStorePtr(new GenerationStore(parser.value(cacheOption)));
+        lsystem.set_store(store);
+    }
+    lsystem.jump_to(settings.generations);
+    const DerivationTree derivation = lsystem.derivation();
+    print_timing("iteration", timer, QString("%1 generations, %2 symbols")
+                 .arg(settings.generations).arg(derivation.length()));
+
+    QPen pen(Qt::black);
+    pen.setCosmetic(true);
+    const bool svg = QFileInfo(output).suffix().toLower() == "svg";
+    const bool ppm = QFileInfo(output).suffix().toLower() == "ppm";
+
+    // instancing : the memo is built from the grammar only, and the drawing
+    // is made of copies of the drawings of a few symbols
+    QScopedPointer<GeometryMemo> memo;
+    if (parser.isSet(instancedOption))
+    {
+        memo.reset(new GeometryMemo(derivation.productions(), settings.angle,
+                                    derivation.depth()));
+        if (!memo->is_valid())
+        {
+            out << "cannot memoize this grammar, interpreting the whole state" << endl;
+            memo.reset();
+        }
+    }
+    if (!memo.isNull() && !ppm)
+    {
+        InstancedGeometry instanced;
+        if (!memo->instantiate(derivation, instanced))
+        {
+            err << "invalid state : cannot pop empty turtle stack" << endl;
+            return 1;
+        }
+        print_timing("instances", timer, QString("%1 instances of %2 prototypes, %3 segments")
+                     .arg(instanced.instances.size()).arg(instanced.prototypes.size())
+                     .arg(instanced.segment_count()));
+
+        TurtleGeometry frame;
+        frame.bounds = instanced.bounds;
+        const QTransform transform = frame.fit(settings.size);
+        const RotationTable rotations(settings.angle, 90.f);
+        QSvgGenerator generator;
+        QImage image;
+        if (svg)
+        {
+            generator.setFileName(output);
+            generator.setSize(settings.size);
+            generator.setViewBox(QRect(QPoint(0, 0), settings.size));
+        }
+        else
+        {
+            image = QImage(settings.size, QImage::Format_ARGB32_Premultiplied);
+            if (image.isNull())
+            {
+                err << "cannot allocate the image, write a .ppm instead" << endl;
+                return 1;
+            }
+            image.fill(Qt::white);
+        }
+        QPainter painter;
+        painter.begin(svg ? static_cast<QPaintDevice *>(&generator) : &image);
+        painter.setRenderHint(QPainter::Antialiasing, true);
+        painter.setPen(pen);
+        instanced.draw(painter, rotations, transform);
+        painter.end();
+        if (!svg && !image.save(output))
+        {
+            err << "cannot write " << output << endl;
+            return 1;
+        }
+        print_timing(svg ? "svg" : "raster", timer, output);
+        return 0;
+    }
+
+    // geometry, with its bounds (single pass)
+    TurtleGeometry geometry;
+    bool valid;
+    if (!memo.isNull())
+    {
+        // streamed to a file : the copies are expanded for the rasterizer
+        InstancedGeometry instanced;
+        valid = memo->instantiate(derivation, instanced);
+        instanced.expand(RotationTable(settings.angle, 90.f), geometry.segments);
+        geometry.bounds = instanced.bounds;
+    }
+    else if (parser.isSet(lodOption))
+    {
+        LodTurtleInterpreter interpreter(settings.angle);
+        valid = interpreter.interpret(derivation, settings.size, geometry);
+    }
+    else if (!store.isNull() && store->load_geometry(lsystem.grammar(), settings.generations,
+                                                     settings.angle, geometry))
+    {
+        valid = true;
+    }
+    else
+    {
+        if (derivation.length() >= ParallelTurtleInterpreter::parallel_threshold)
+        {
+            ParallelTurtleInterpreter interpreter(settings.angle, scheduler);
+            valid = interpreter.interpret(derivation, geometry);
+        }
+        else
+        {
+            TurtleInterpreter interpreter(settings.angle, geometry);
+            auto interpret = [&](char symbol) { return interpreter.interpret(symbol); };
+            valid = derivation.walk(interpret);
+            interpreter.finish();
+        }
+        if (valid && !store.isNull())
+        {
+            const QByteArray &grammar = lsystem.grammar();
+            const bool stored = store->contains(grammar, settings.generations)
+                    || store->save(grammar, settings.generations, derivation);
+            if (!stored || !store->save_geometry(grammar, settings.generations,
+                                                 settings.angle, geometry))
+                out << "cannot store the generation in " << store->directory() << endl;
+        }
+    }
+    if (!valid)
+    {
+        err << "invalid state : cannot pop empty turtle stack" << endl;
+        return 1;
+    }
+    print_timing("geometry", timer, QString("%1 segments").arg(geometry.segments.segment_count()));
+
+    const QTransform transform = geometry.fit(settings.size);
+
+    if (svg)
+    {
+        QSvgGenerator generator;
+        generator.setFileName(output);
+        generator.setSize(settings.size);
+        generator.setViewBox(QRect(QPoint(0, 0), settings.size));
+        QPainter painter(&generator);
+        painter.setPen(pen);
+        draw_segments(painter, geometry.segments, transform);
+        painter.end();
+        print_timing("svg", timer, output);
+        return 0;
+    }
+
+    // offscreen rasterization, by tiles
+    TileRasterizer rasterizer(scheduler);
+    rasterizer.set_pen(pen);
+    const QString raster_details = QString("%1x%2").arg(settings.size.width())
+            .arg(settings.size.height());
+
+    // binary PPM : streamed, for sizes too big to be kept in memory
+    if (ppm)
+    {
+        if (!rasterizer.render_to_file(geometry.segments, transform, settings.size, output))
+        {
+            err << "cannot write " << output << endl;
+            return 1;
+        }
+        print_timing("raster", timer, raster_details + ", streamed to " + output);
+        return 0;
+    }
+
+    const QImage image = rasterizer.render(geometry.segments, transform, settings.size);
+    if (image.isNull())
+    {
+        err << "cannot allocate a " << raster_details << " image, write a .ppm instead"
+            << endl;
+        return 1;
+    }
+    print_timing("raster", timer, raster_details);
+
+    if (!image.save(output))
+    {
+        err << "cannot write " << output << endl;
+        return 1;
+    }
+    print_timing("write", timer, output);
+    return 0;
+}
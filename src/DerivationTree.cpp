@@ -0,0 +1,188 @@
+#include "DerivationTree.h"
+
+#include <limits>
+
+/**
+ * @brief Addition saturated at the maximum value of quint64.
+ */
+static inline quint64 saturated_add(quint64 a, quint64 b)
+{
+    return (a > std::numeric_limits<quint64>::max() - b) ?
+                std::numeric_limits<quint64>::max() : a + b;
+}
+
+DerivationTree::DerivationTree() : m_base(new State()), m_mapped_base(),
+    m_packed_base(), m_base_symbols(m_base->data()), m_base_length(0),
+    m_productions(), m_depth(0), m_lengths(256, 1), m_length(0)
+{
+
+}
+
+DerivationTree::DerivationTree(QSharedPointer<const State> base,
+                               const ProductionTable &productions, uint depth) :
+    m_base(base), m_mapped_base(), m_packed_base(), m_base_symbols(base->data()),
+    m_base_length(base->length()), m_productions(productions), m_depth(depth),
+    m_lengths((depth + 1) * 256, 1), m_length(0)
+{
+    compute_lengths();
+}
+
+DerivationTree::DerivationTree(QSharedPointer<const PackedState> base,
+                               const ProductionTable &productions, uint depth) :
+    m_base(), m_mapped_base(), m_packed_base(base), m_base_symbols(nullptr),
+    m_base_length(0), m_productions(productions), m_depth(depth),
+    m_lengths((depth + 1) * 256, 1), m_length(0)
+{
+    compute_lengths();
+}
+
+DerivationTree::DerivationTree(QSharedPointer<const MappedState> base,
+                               const ProductionTable &productions, uint depth) :
+    m_base(), m_mapped_base(base), m_packed_base(), m_base_symbols(base->data()),
+    m_base_length(base->length()), m_productions(productions), m_depth(depth),
+    m_lengths((depth + 1) * 256, 1), m_length(0)
+{
+    compute_lengths();
+}
+
+void DerivationTree::compute_lengths()
+{
+    // memoize the expansion length of every symbol at every depth
+    for (uint g = 1; g <= m_depth; ++g)
+    {
+        const quint64 *previous = m_lengths.constData() + (g - 1) * 256;
+        quint64 *current = m_lengths.data() + g * 256;
+        for (int c = 0; c < 256; ++c)
+        {
+            const char *p = m_productions.production(static_cast<char>(c));
+            const char *end = p + m_productions.production_length(static_cast<char>(c));
+            quint64 length = 0;
+            for (; p != end; ++p)
+                length = saturated_add(length, previous[static_cast<uchar>(*p)]);
+            current[c] = length;
+        }
+    }
+
+    // the derived length is the sum of the expansions of the base symbols
+    if (m_depth == 0)
+    {
+        m_length = base_length();
+        return;
+    }
+    auto add = [this](char symbol) -> bool
+    {
+        m_length = saturated_add(m_length, expansion_length(symbol, m_depth));
+        return true;
+    };
+    if (!m_packed_base.isNull())
+        m_packed_base->walk(add);
+    else
+    {
+        for (quint64 i = 0; i < m_base_length; ++i)
+            add(m_base_symbols[i]);
+    }
+}
+
+char DerivationTree::at(quint64 index) const
+{
+    return *iterator_at(index);
+}
+
+DerivationTree::const_iterator DerivationTree::end() const
+{
+    return const_iterator(this, m_length);
+}
+
+DerivationTree::const_iterator DerivationTree::iterator_at(quint64 index) const
+{
+    return const_iterator(this, index);
+}
+
+
+DerivationTree::const_iterator::const_iterator(const DerivationTree *tree,
+                                               quint64 position) :
+    m_tree(tree), m_base_index(0), m_stack(), m_position(position)
+{
+    if (m_position >= m_tree->m_length)
+    {
+        m_position = m_tree->m_length;
+        m_base_index = m_tree->base_length();
+        return;
+    }
+    m_stack.reserve(m_tree->m_depth);
+
+    // find the base symbol whose expansion contains the position...
+    quint64 index = m_position, length;
+    char symbol;
+    while (index >= (length = m_tree->expansion_length(
+                         symbol = m_tree->base_symbol(m_base_index), m_tree->m_depth)))
+        index -= length, ++m_base_index;
+
+    // ...then the symbol containing it in each production, down to the leaf
+    const ProductionTable &productions = m_tree->m_productions;
+    for (uint level = 0; level < m_tree->m_depth; ++level)
+    {
+        if (productions.is_constant(symbol))
+            break;
+
+        const char *it = productions.production(symbol);
+        const char *end = it + productions.production_length(symbol);
+        const uint generations = m_tree->m_depth - level - 1;
+        while (index >= (length = m_tree->expansion_length(*it, generations)))
+            index -= length, ++it;
+        Frame frame = { it, end };
+        m_stack.append(frame);
+        symbol = *it;
+    }
+}
+
+DerivationTree::const_iterator &DerivationTree::const_iterator::operator++()
+{
+    ++m_position;
+    if (m_stack.isEmpty())
+        ++m_base_index;
+    else
+        ++m_stack.last().it;
+    descend();
+    return *this;
+}
+
+void DerivationTree::const_iterator::descend()
+{
+    const ProductionTable &productions = m_tree->m_productions;
+    while (true)
+    {
+        char symbol;
+        if (m_stack.isEmpty())
+        {
+            if (m_base_index >= m_tree->base_length())
+                return;
+            symbol = m_tree->base_symbol(m_base_index);
+        }
+        else
+        {
+            // production fully walked : go back to its parent's next symbol
+            Frame &top = m_stack.last();
+            if (top.it == top.end)
+            {
+                m_stack.removeLast();
+                if (m_stack.isEmpty())
+                    ++m_base_index;
+                else
+                    ++m_stack.last().it;
+                continue;
+            }
+            symbol = *top.it;
+        }
+
+        // leaves and constants are symbols of the derived state
+        if (static_cast<uint>(m_stack.size()) == m_tree->m_depth
+                || productions.is_constant(symbol))
+            return;
+
+        const char *production = productions.production(symbol);
+        Frame frame = { production,
+                        production + productions.production_length(symbol) };
+        m_stack.append(frame);
+    }
+}
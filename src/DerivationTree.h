@@ -0,0 +1,303 @@
+#ifndef DERIVATIONTREE_H
+#define DERIVATIONTREE_H
+
+#include <QSharedPointer>
+#include <QVector>
+#include <QVarLengthArray>
+
+#include "ProductionTable.h"
+#include "PackedState.h"
+#include "MappedState.h"
+
+/**
+ * @brief DerivationTree is an implicit representation of an L-System state :
+ * a base state rewritten depth times, which is never materialized.
+ *
+ * The generation N is the productions of the generation N-1, and so on down
+ * to the base state : the symbols of the generation N are produced on
+ * demand by a const_iterator walking this tree depth-first, with a memory
+ * usage of O(depth).
+ *
+ * walk() does the same depth-first expansion but pushes the symbols to a
+ * visitor, which avoids the per-symbol overhead of the iterator : this is
+ * how the renderer streams a state directly into its turtle interpreter.
+ *
+ * The base state is either a State, a MappedState (out of core) or a
+ * PackedState, which is then walked without being unpacked.
+ *
+ * The expansion lengths of every symbol at every depth are memoized (and
+ * saturated at 2^64-1), so that length() is O(1) and at() is
+ * O(base length + depth * production length).
+ */
+class DerivationTree
+{
+    /**
+     * @brief A production being walked, at the depth of its index in a stack
+     * (plus one : the base state is at depth 0).
+     */
+    struct Frame
+    {
+        const char *it, *end;
+    };
+
+public:
+    /**
+     * @brief Streaming iterator over the symbols of a DerivationTree.
+     */
+    class const_iterator
+    {
+    public:
+        inline char operator*() const
+        {
+            return m_stack.isEmpty() ? m_tree->base_symbol(m_base_index)
+                                     : *m_stack.last().it;
+        }
+        const_iterator &operator++();
+
+        /**
+         * @brief Index of the current symbol in the derived state.
+         */
+        inline quint64 position() const { return m_position; }
+
+        inline bool operator==(const const_iterator &other) const
+        {
+            return m_position == other.m_position;
+        }
+        inline bool operator!=(const const_iterator &other) const
+        {
+            return m_position != other.m_position;
+        }
+
+    private:
+        friend class DerivationTree;
+
+        const_iterator(const DerivationTree *tree, quint64 position);
+
+        /**
+         * @brief Descend into the productions until the iterator is on a symbol
+         * of the derived state, or past the end of the base state.
+         */
+        void descend();
+
+        const DerivationTree *m_tree;
+        quint64 m_base_index;
+        QVector<Frame> m_stack;
+        quint64 m_position;
+    };
+
+    /**
+     * @brief Construct an empty derivation tree.
+     */
+    DerivationTree();
+
+    /**
+     * @brief Construct the derivation tree of base rewritten depth times.
+     * @param base The state at the root of the tree.
+     * @param productions The productions used to rewrite the state.
+     * @param depth The number of rewritings.
+     */
+    DerivationTree(QSharedPointer<const State> base,
+                   const ProductionTable &productions, uint depth);
+
+    /**
+     * @brief Construct the derivation tree of a packed base rewritten depth times.
+     */
+    DerivationTree(QSharedPointer<const PackedState> base,
+                   const ProductionTable &productions, uint depth);
+
+    /**
+     * @brief Construct the derivation tree of a mapped base rewritten depth times.
+     */
+    DerivationTree(QSharedPointer<const MappedState> base,
+                   const ProductionTable &productions, uint depth);
+
+    /**
+     * @brief The productions used to rewrite the state.
+     */
+    inline const ProductionTable &productions() const { return m_productions; }
+
+    /**
+     * @brief Number of rewritings of the base state.
+     */
+    inline uint depth() const { return m_depth; }
+
+    /**
+     * @brief Length of the state at the root of the tree.
+     */
+    inline quint64 base_length() const
+    {
+        return m_packed_base.isNull() ? m_base_length : m_packed_base->length();
+    }
+
+    /**
+     * @brief Symbol at the given index of the state at the root of the tree.
+     */
+    inline char base_symbol(quint64 index) const
+    {
+        return m_packed_base.isNull() ? m_base_symbols[index] : m_packed_base->at(index);
+    }
+
+    /**
+     * @brief Length of the derived state (saturated at 2^64-1).
+     */
+    inline quint64 length() const { return m_length; }
+
+    /**
+     * @brief Length of symbol once rewritten generations times
+     * (saturated at 2^64-1), with generations <= depth().
+     */
+    inline quint64 expansion_length(char symbol, uint generations) const
+    {
+        return m_lengths[generations * 256 + static_cast<uchar>(symbol)];
+    }
+
+    /**
+     * @brief Symbol at the given index of the derived state.
+     */
+    char at(quint64 index) const;
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const;
+
+    /**
+     * @brief Iterator to the symbol at the given index of the derived state.
+     */
+    const_iterator iterator_at(quint64 index) const;
+
+    /**
+     * @brief Feed every symbol of the derived state, in order, to visitor.
+     *
+     * visitor is called as bool visitor(char symbol) and stops the walk by
+     * returning false. Memory usage is O(depth).
+     * @return False if the walk was stopped by the visitor.
+     */
+    template <typename Visitor>
+    bool walk(Visitor &visitor) const;
+
+    /**
+     * @brief Same as walk(visitor), but branches can be pruned.
+     *
+     * At every '[' of a production, pruner is called as
+     * const char *pruner(const char *open, const char *end, uint generations),
+     * with the production ending at end, whose symbols are to be rewritten
+     * generations more times. Returning a pointer to the matching ']' skips
+     * the whole branch, brackets included ; returning nullptr walks it.
+     */
+    template <typename Visitor, typename Pruner>
+    bool walk(Visitor &visitor, Pruner &pruner) const;
+
+private:
+    /**
+     * @brief Pruner never pruning anything.
+     */
+    struct NoPruning
+    {
+        inline const char *operator()(const char *, const char *, uint) const
+        {
+            return nullptr;
+        }
+    };
+
+    /**
+     * @brief Memoize the expansion lengths and compute the derived length.
+     */
+    void compute_lengths();
+
+    QSharedPointer<const State> m_base;
+    QSharedPointer<const MappedState> m_mapped_base; //!< if set, replaces m_base
+    QSharedPointer<const PackedState> m_packed_base; //!< if set, replaces m_base
+    const char *m_base_symbols; //!< of m_base or m_mapped_base, unless packed
+    quint64 m_base_length; //!< of m_base or m_mapped_base, unless packed
+    ProductionTable m_productions;
+    uint m_depth;
+    QVector<quint64> m_lengths; //!< [generations * 256 + symbol]
+    quint64 m_length;
+};
+
+template <typename Visitor>
+bool DerivationTree::walk(Visitor &visitor) const
+{
+    NoPruning pruner;
+    return walk(visitor, pruner);
+}
+
+template <typename Visitor, typename Pruner>
+bool DerivationTree::walk(Visitor &visitor, Pruner &pruner) const
+{
+    QVarLengthArray<Frame, 32> stack;
+
+    // depth-first expansion of a symbol of the base state
+    auto expand = [&](char symbol) -> bool
+    {
+        if (m_depth == 0 || m_productions.is_constant(symbol))
+            return visitor(symbol);
+
+        Frame frame = { m_productions.production(symbol),
+                        m_productions.production(symbol)
+                        + m_productions.production_length(symbol) };
+        stack.append(frame);
+        while (!stack.isEmpty())
+        {
+            Frame &top = stack.last();
+
+            // leaves : feed the whole production at once
+            if (static_cast<uint>(stack.size()) == m_depth)
+            {
+                for (; top.it != top.end; ++top.it)
+                {
+                    if (*top.it == '[')
+                    {
+                        const char *close = pruner(top.it, top.end, 0);
+                        if (close != nullptr)
+                        {
+                            top.it = close;
+                            continue;
+                        }
+                    }
+                    if (!visitor(*top.it))
+                        return false;
+                }
+            }
+            if (top.it == top.end)
+            {
+                stack.removeLast();
+                continue;
+            }
+
+            // constants are symbols of the derived state, variables are expanded
+            const char c = *top.it++;
+            if (c == '[')
+            {
+                const char *close = pruner(top.it - 1, top.end, m_depth - stack.size());
+                if (close != nullptr)
+                {
+                    top.it = close + 1;
+                    continue;
+                }
+            }
+            if (m_productions.is_constant(c))
+            {
+                if (!visitor(c))
+                    return false;
+            }
+            else
+            {
+                frame.it = m_productions.production(c);
+                frame.end = frame.it + m_productions.production_length(c);
+                stack.append(frame);
+            }
+        }
+        return true;
+    };
+
+    if (!m_packed_base.isNull())
+        return m_packed_base->walk(expand);
+
+    const char *end = m_base_symbols + m_base_length;
+    for (const char *it = m_base_symbols; it != end; ++it)
+        if (!expand(*it))
+            return false;
+    return true;
+}
+
+#endif /* DERIVATIONTREE_H */
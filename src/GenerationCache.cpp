@@ -0,0 +1,87 @@
+#include "GenerationCache.h"
+
+const quint64 GenerationCache::default_budget = Q_UINT64_C(256) << 20;
+
+quint64 GenerationSnapshot::memory_usage() const
+{
+    // lazy generations share their base : this overestimates their usage
+    return (packed.isNull() ? 0 : packed->memory_usage())
+            + (mapped.isNull() ? 0 : mapped->disk_usage())
+            + (state.isNull() ? 0 : state->capacity());
+}
+
+
+GenerationCache::GenerationCache(quint64 budget) : m_budget(budget),
+    m_usage(0), m_entries(), m_index()
+{
+
+}
+
+void GenerationCache::set_budget(quint64 budget)
+{
+    m_budget = budget;
+    evict();
+}
+
+void GenerationCache::insert(GenerationSnapshotPtr snapshot)
+{
+    const quint64 usage = snapshot->memory_usage();
+    if (usage > m_budget)
+        return;
+
+    // replace any previous snapshot of the same generation
+    QHash<uint, Entries::iterator>::iterator it = m_index.find(snapshot->generation);
+    if (it != m_index.end())
+    {
+        m_usage -= (*it.value())->memory_usage();
+        m_entries.erase(it.value());
+        m_index.erase(it);
+    }
+
+    m_entries.push_front(snapshot);
+    m_index.insert(snapshot->generation, m_entries.begin());
+    m_usage += usage;
+    evict();
+}
+
+GenerationSnapshotPtr GenerationCache::find(uint generation)
+{
+    QHash<uint, Entries::iterator>::const_iterator it = m_index.constFind(generation);
+    if (it == m_index.constEnd())
+        return GenerationSnapshotPtr();
+
+    // most recently used : move it to the front, which keeps the iterators valid
+    m_entries.splice(m_entries.begin(), m_entries, it.value());
+    return m_entries.front();
+}
+
+GenerationSnapshotPtr GenerationCache::closest(uint generation) const
+{
+    GenerationSnapshotPtr closest;
+    Entries::const_iterator it;
+    for (it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        if ((*it)->generation <= generation
+                && (closest.isNull() || (*it)->generation > closest->generation))
+            closest = *it;
+    }
+    return closest;
+}
+
+void GenerationCache::clear()
+{
+    m_entries.clear();
+    m_index.clear();
+    m_usage = 0;
+}
+
+void GenerationCache::evict()
+{
+    while (m_usage > m_budget && !m_entries.empty())
+    {
+        const GenerationSnapshotPtr &last = m_entries.back();
+        m_usage -= last->memory_usage();
+        m_index.remove(last->generation);
+        m_entries.pop_back();
+    }
+}
@@ -0,0 +1,115 @@
+#ifndef GENERATIONCACHE_H
+#define GENERATIONCACHE_H
+
+#include <QHash>
+#include <QSharedPointer>
+#include <list>
+
+#include "DerivationTree.h"
+
+/**
+ * @brief GenerationSnapshot is an immutable generation of an L-System.
+ *
+ * Snapshots are shared (see GenerationSnapshotPtr) between the LSystem, its
+ * GenerationCache and the readers, e.g. the renderer : a reader can keep
+ * working on a generation while the next one is being produced, without
+ * any copy or lock.
+ */
+struct GenerationSnapshot
+{
+    uint generation; //!< generation number
+    QSharedPointer<const State> state;        //!< materialized state, unless packed or mapped
+    QSharedPointer<const PackedState> packed; //!< packed materialized state, or null
+    QSharedPointer<const MappedState> mapped; //!< out-of-core materialized state, or null
+    DerivationTree derivation; //!< the state of the generation, possibly lazy
+
+    /**
+     * @brief Memory used by the materialized states, in bytes. A mapped
+     * state counts for its disk usage.
+     */
+    quint64 memory_usage() const;
+};
+
+/**
+ * @brief A shared pointer to an immutable GenerationSnapshot.
+ */
+typedef QSharedPointer<const GenerationSnapshot> GenerationSnapshotPtr;
+
+/**
+ * @brief GenerationCache keeps the most recently used generations of an
+ * L-System, within a memory budget.
+ *
+ * Finding a cached generation is O(1). When the budget is exceeded, the
+ * least recently used generations are dropped ; a snapshot larger than
+ * the whole budget is not cached at all.
+ *
+ * Not thread-safe : LSystem guards it with its mutex.
+ */
+class GenerationCache
+{
+public:
+    /**
+     * @brief Default memory budget, in bytes.
+     */
+    static const quint64 default_budget;
+
+    explicit GenerationCache(quint64 budget = default_budget);
+
+    /**
+     * @brief Set the memory budget, in bytes, evicting generations if needed.
+     */
+    void set_budget(quint64 budget);
+    inline quint64 budget() const { return m_budget; }
+
+    /**
+     * @brief Memory used by the cached generations, in bytes.
+     */
+    inline quint64 memory_usage() const { return m_usage; }
+
+    /**
+     * @brief Number of cached generations.
+     */
+    inline int count() const { return m_index.size(); }
+
+    /**
+     * @brief Cache snapshot, as the most recently used generation.
+     */
+    void insert(GenerationSnapshotPtr snapshot);
+
+    /**
+     * @brief Whether the given generation is cached.
+     */
+    inline bool contains(uint generation) const { return m_index.contains(generation); }
+
+    /**
+     * @brief Find the given generation, and mark it as the most recently used.
+     * @return The snapshot of the generation, or a null pointer if not cached.
+     */
+    GenerationSnapshotPtr find(uint generation);
+
+    /**
+     * @brief The latest cached generation before or at the given generation.
+     * @return A null pointer if there is none.
+     */
+    GenerationSnapshotPtr closest(uint generation) const;
+
+    /**
+     * @brief Drop all the cached generations.
+     */
+    void clear();
+
+private:
+    typedef std::list<GenerationSnapshotPtr> Entries;
+
+    /**
+     * @brief Drop the least recently used generations until within budget.
+     */
+    void evict();
+
+    quint64 m_budget;
+    quint64 m_usage;
+    Entries m_entries; //!< most recently used first
+    QHash<uint, Entries::iterator> m_index; //!< generation -> entry
+};
+
+#endif /* GENERATIONCACHE_H */
@@ -0,0 +1,308 @@
+#include "GenerationStore.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <cstring>
+#include <vector>
+
+const quint32 GenerationStore::format_version = 2;
+const quint64 GenerationStore::default_budget = Q_UINT64_C(4) << 30;
+const quint64 GenerationStore::default_total_budget = Q_UINT64_C(16) << 30;
+const char file_magic[8] = { 'L', 'S', 'Y', 'S', 'G', 'E', 'N', '\0' };
+const quint32 byte_order_mark = 0x01020304; // read back swapped on another byte order
+const quint64 section_alignment = 8;
+const int state_write_chunk_size = 1 << 20; // in symbols
+
+/**
+ * @brief Header of a file, followed by its sections at the given offsets,
+ * aligned on section_alignment bytes.
+ */
+struct GenerationStore::Header
+{
+    char magic[8];
+    quint32 version;
+    quint32 byte_order;
+    quint32 generation;
+    quint32 has_geometry;
+    float angle; //!< of the geometry
+    quint32 reserved;
+    quint64 file_length;
+    quint64 grammar_offset, grammar_length;
+    quint64 state_offset, state_length;
+    quint64 x_offset, y_offset, points; //!< of the geometry
+    quint64 runs_offset, runs;
+    double bounds[4]; //!< of the geometry : left, top, width, height
+};
+
+namespace
+{
+    inline quint64 aligned(quint64 offset)
+    {
+        return (offset + section_alignment - 1) / section_alignment * section_alignment;
+    }
+
+    /**
+     * @brief Pad file with zeros up to offset.
+     */
+    bool pad(QIODevice &file, quint64 offset)
+    {
+        const char zeros[section_alignment] = { 0 };
+        const qint64 n = static_cast<qint64>(offset) - file.pos();
+        return n == 0 || file.write(zeros, n) == n;
+    }
+
+    /**
+     * @brief Whether count items of size bytes at offset lie within a file
+     * of file_length bytes.
+     */
+    inline bool within(quint64 offset, quint64 count, quint64 size, quint64 file_length)
+    {
+        return offset <= file_length && count <= (file_length - offset) / size;
+    }
+
+    bool write_all(QIODevice &file, const void *data, quint64 length)
+    {
+        return file.write(static_cast<const char *>(data), static_cast<qint64>(length))
+                == static_cast<qint64>(length);
+    }
+}
+
+GenerationStore::GenerationStore(const QString &directory, quint64 budget,
+                                 quint64 total_budget) :
+    m_directory(directory), m_budget(budget), m_total_budget(total_budget)
+{
+
+}
+
+QString GenerationStore::path(const QByteArray &grammar, uint generation) const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(grammar);
+    hash.addData(QByteArray::number(generation));
+    return QDir(m_directory).filePath(QString::fromLatin1(hash.result().toHex()) + ".lsg");
+}
+
+QString GenerationStore::geometry_path(const QByteArray &grammar, uint generation,
+                                       float angle) const
+{
+    // the exact angle : its bits
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(grammar);
+    hash.addData(QByteArray::number(generation));
+    hash.addData(QByteArray(reinterpret_cast<const char *>(&angle), sizeof(angle)));
+    return QDir(m_directory).filePath(QString::fromLatin1(hash.result().toHex()) + ".lsg");
+}
+
+bool GenerationStore::contains(const QByteArray &grammar, uint generation) const
+{
+    Header header;
+    return read_header(path(grammar, generation), grammar, generation, header);
+}
+
+bool GenerationStore::read_header(const QString &path, const QByteArray &grammar,
+                                  uint generation, Header &header) const
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)
+            || file.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header))
+        return false;
+    if (memcmp(header.magic, file_magic, sizeof(file_magic)) != 0
+            || header.version != format_version || header.byte_order != byte_order_mark
+            || header.generation != generation
+            || header.file_length != static_cast<quint64>(file.size())
+            || header.grammar_length != static_cast<quint64>(grammar.size()))
+        return false;
+
+    // every section lies within the file, the arrays being aligned
+    const quint64 length = header.file_length;
+    if (!within(header.grammar_offset, header.grammar_length, 1, length)
+            || !within(header.state_offset, header.state_length, 1, length))
+        return false;
+    if (header.has_geometry
+            && (header.x_offset % section_alignment != 0
+                || header.y_offset % section_alignment != 0
+                || header.runs_offset % section_alignment != 0
+                || !within(header.x_offset, header.points, sizeof(float), length)
+                || !within(header.y_offset, header.points, sizeof(float), length)
+                || !within(header.runs_offset, header.runs, sizeof(quint64), length)))
+        return false;
+
+    // the grammar itself, in case of a collision of the hashes
+    return file.seek(static_cast<qint64>(header.grammar_offset))
+            && file.read(grammar.size()) == grammar;
+}
+
+QSharedPointer<const MappedState> GenerationStore::load_state(const QByteArray &grammar,
+                                                              uint generation) const
+{
+    const QString file = path(grammar, generation);
+    Header header;
+    if (!read_header(file, grammar, generation, header))
+        return QSharedPointer<const MappedState>();
+
+    QSharedPointer<MappedState> state(new MappedState());
+    if (header.has_geometry || !state->open(file, header.state_offset, header.state_length))
+        return QSharedPointer<const MappedState>();
+    touch(file);
+    return state;
+}
+
+bool GenerationStore::load_geometry(const QByteArray &grammar, uint generation, float angle,
+                                    TurtleGeometry &geometry) const
+{
+    const QString path = geometry_path(grammar, generation, angle);
+    Header header;
+    if (!read_header(path, grammar, generation, header) || !header.has_geometry
+            || header.angle != angle)
+        return false;
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const uchar *data = file.map(0, static_cast<qint64>(header.file_length));
+    if (data == nullptr)
+        return false;
+
+    // the runs are drawn without bound check : they must be ordered points
+    const quint64 *runs = reinterpret_cast<const quint64 *>(data + header.runs_offset);
+    for (quint64 i = 0; i < header.runs; ++i)
+    {
+        if (runs[i] > header.points || (i > 0 && runs[i] < runs[i - 1]))
+        {
+            file.unmap(const_cast<uchar *>(data));
+            return false;
+        }
+    }
+    geometry.segments.assign(reinterpret_cast<const float *>(data + header.x_offset),
+                             reinterpret_cast<const float *>(data + header.y_offset),
+                             header.points, runs, header.runs);
+    geometry.bounds = QRectF(header.bounds[0], header.bounds[1],
+                             header.bounds[2], header.bounds[3]);
+    file.unmap(const_cast<uchar *>(data));
+    touch(path);
+    return true;
+}
+
+bool GenerationStore::save(const QByteArray &grammar, uint generation,
+                           const DerivationTree &derivation) const
+{
+    return write_file(path(grammar, generation), grammar, generation, &derivation,
+                      nullptr, 0.f);
+}
+
+bool GenerationStore::save_geometry(const QByteArray &grammar, uint generation, float angle,
+                                    const TurtleGeometry &geometry) const
+{
+    return write_file(geometry_path(grammar, generation, angle), grammar, generation,
+                      nullptr, &geometry, angle);
+}
+
+bool GenerationStore::write_file(const QString &path, const QByteArray &grammar,
+                                 uint generation, const DerivationTree *derivation,
+                                 const TurtleGeometry *geometry, float angle) const
+{
+    // the whole layout is known beforehand
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, file_magic, sizeof(file_magic));
+    header.version = format_version;
+    header.byte_order = byte_order_mark;
+    header.generation = generation;
+    header.has_geometry = geometry != nullptr;
+    header.angle = angle;
+    header.grammar_offset = aligned(sizeof(header));
+    header.grammar_length = grammar.size();
+    header.state_offset = aligned(header.grammar_offset + header.grammar_length);
+    header.state_length = derivation != nullptr ? derivation->length() : 0;
+    if (header.state_length > m_budget)
+        return false;
+    header.file_length = header.state_offset + header.state_length;
+    if (geometry != nullptr)
+    {
+        const SegmentBuffer &segments = geometry->segments;
+        header.points = segments.point_count();
+        header.runs = segments.run_count();
+        header.x_offset = aligned(header.file_length);
+        header.y_offset = aligned(header.x_offset + header.points * sizeof(float));
+        header.runs_offset = aligned(header.y_offset + header.points * sizeof(float));
+        header.bounds[0] = geometry->bounds.left();
+        header.bounds[1] = geometry->bounds.top();
+        header.bounds[2] = geometry->bounds.width();
+        header.bounds[3] = geometry->bounds.height();
+        header.file_length = header.runs_offset + header.runs * sizeof(quint64);
+    }
+    if (header.file_length > m_budget || !QDir().mkpath(m_directory))
+        return false;
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || !write_all(file, &header, sizeof(header))
+            || !pad(file, header.grammar_offset)
+            || !write_all(file, grammar.constData(), header.grammar_length)
+            || !pad(file, header.state_offset))
+        return false;
+
+    // the state, streamed by chunks
+    std::vector<char> chunk;
+    chunk.reserve(state_write_chunk_size);
+    bool written = true;
+    auto write = [&](char symbol) -> bool
+    {
+        chunk.push_back(symbol);
+        if (chunk.size() == static_cast<size_t>(state_write_chunk_size))
+        {
+            written = write_all(file, chunk.data(), chunk.size());
+            chunk.clear();
+        }
+        return written;
+    };
+    if (derivation != nullptr
+            && (!derivation->walk(write) || !write_all(file, chunk.data(), chunk.size())))
+        return false;
+
+    if (geometry != nullptr)
+    {
+        const SegmentBuffer &segments = geometry->segments;
+        if (!pad(file, header.x_offset)
+                || !write_all(file, segments.x(), header.points * sizeof(float))
+                || !pad(file, header.y_offset)
+                || !write_all(file, segments.y(), header.points * sizeof(float))
+                || !pad(file, header.runs_offset)
+                || !write_all(file, segments.runs(), header.runs * sizeof(quint64)))
+            return false;
+    }
+    if (!file.commit())
+        return false;
+    evict(path);
+    return true;
+}
+
+void GenerationStore::touch(const QString &path) const
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    // the metadata only : the content of a file being read is never modified
+    QFile file(path);
+    if (file.open(QIODevice::ReadOnly))
+        file.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+#else
+    Q_UNUSED(path)
+#endif
+}
+
+void GenerationStore::evict(const QString &kept) const
+{
+    // the least recently used first
+    const QFileInfoList files = QDir(m_directory).entryInfoList(
+                QStringList("*.lsg"), QDir::Files, QDir::Time | QDir::Reversed);
+    quint64 total = 0;
+    for (int i = 0; i < files.size(); ++i)
+        total += static_cast<quint64>(files[i].size());
+    for (int i = 0; i < files.size() && total > m_total_budget; ++i)
+    {
+        if (files[i].filePath() != kept && QFile::remove(files[i].filePath()))
+            total -= static_cast<quint64>(files[i].size());
+    }
+}
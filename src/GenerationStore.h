@@ -0,0 +1,158 @@
+#ifndef GENERATIONSTORE_H
+#define GENERATIONSTORE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QSharedPointer>
+
+#include "DerivationTree.h"
+#include "TurtleInterpreter.h"
+
+/**
+ * @brief GenerationStore keeps generations of L-Systems in the files of a
+ * directory, so that they are reloaded in a few milliseconds rather than
+ * iterated and interpreted again, e.g. from one run to the next.
+ *
+ * A file holds either a materialized state, or its unit-scale geometry for
+ * one angle : the geometries of several angles are kept side by side, and
+ * storing one never writes the state again. A file is named after a hash of
+ * the grammar, of the generation and of the angle (see path() and
+ * geometry_path()), and holds the grammar itself, so that a collision is
+ * detected.
+ *
+ * The sections of a file are laid out as in memory, behind a fixed-size
+ * header : loading a file only checks its header (every section lying
+ * within the file), then maps the state (see MappedState) without any copy,
+ * and copies the arrays of the geometry in one go, once its runs are
+ * checked. Files of another version of the format, or written
+ * with another byte order, are ignored and replaced by the next save.
+ *
+ * The files are bounded in size one by one, and all together : once the
+ * directory exceeds its total budget, the least recently used files are
+ * removed (the least recently written ones before Qt 5.10).
+ *
+ * Thread-safe : a file is written under another name, then renamed, so
+ * that a file being read is never modified.
+ */
+class GenerationStore
+{
+public:
+    /**
+     * @brief Version of the file format, to be increased by any change.
+     */
+    static const quint32 format_version;
+
+    /**
+     * @brief Default budget of a file, in bytes.
+     */
+    static const quint64 default_budget;
+
+    /**
+     * @brief Default budget of all the files together, in bytes.
+     */
+    static const quint64 default_total_budget;
+
+    /**
+     * @brief Keep the generations in directory, created if needed.
+     * @param budget The maximal size of a file : larger generations are
+     * not stored.
+     * @param total_budget The maximal size of all the files of directory.
+     */
+    explicit GenerationStore(const QString &directory, quint64 budget = default_budget,
+                             quint64 total_budget = default_total_budget);
+
+    inline const QString &directory() const { return m_directory; }
+    inline quint64 budget() const { return m_budget; }
+    inline quint64 total_budget() const { return m_total_budget; }
+
+    /**
+     * @brief Path of the file of the state of the given generation of
+     * grammar (see LSystem::grammar()).
+     */
+    QString path(const QByteArray &grammar, uint generation) const;
+
+    /**
+     * @brief Path of the file of the geometry of the given generation of
+     * grammar, drawn with angle.
+     */
+    QString geometry_path(const QByteArray &grammar, uint generation, float angle) const;
+
+    /**
+     * @brief Whether the state of the given generation of grammar is stored.
+     */
+    bool contains(const QByteArray &grammar, uint generation) const;
+
+    /**
+     * @brief Map the state of the given generation of grammar.
+     * @return Null if it is not stored.
+     */
+    QSharedPointer<const MappedState> load_state(const QByteArray &grammar,
+                                                 uint generation) const;
+
+    /**
+     * @brief Read the geometry of the given generation of grammar, drawn
+     * with the given angle, into geometry.
+     * @return False if it is not stored, e.g. only for another angle.
+     */
+    bool load_geometry(const QByteArray &grammar, uint generation, float angle,
+                       TurtleGeometry &geometry) const;
+
+    /**
+     * @brief Store the state derived by derivation as the given generation
+     * of grammar. The state is streamed into the file, which replaces any
+     * previous one.
+     * @return False if the file would exceed the budget, or could not be
+     * written.
+     */
+    bool save(const QByteArray &grammar, uint generation,
+              const DerivationTree &derivation) const;
+
+    /**
+     * @brief Store geometry as the drawing of the given generation of
+     * grammar with angle, replacing any previous one for that angle only.
+     * @return False if the file would exceed the budget, or could not be
+     * written.
+     */
+    bool save_geometry(const QByteArray &grammar, uint generation, float angle,
+                       const TurtleGeometry &geometry) const;
+
+private:
+    struct Header;
+
+    /**
+     * @brief Read and check the header of the file at path, for the given
+     * generation of grammar.
+     */
+    bool read_header(const QString &path, const QByteArray &grammar, uint generation,
+                     Header &header) const;
+
+    /**
+     * @brief Write the file at path : its header, the grammar, then either
+     * the state derived by derivation or geometry.
+     */
+    bool write_file(const QString &path, const QByteArray &grammar, uint generation,
+                    const DerivationTree *derivation, const TurtleGeometry *geometry,
+                    float angle) const;
+
+    /**
+     * @brief Mark the file at path as used, for the eviction.
+     */
+    void touch(const QString &path) const;
+
+    /**
+     * @brief Remove the least recently used files but kept, until the
+     * directory fits in the total budget.
+     */
+    void evict(const QString &kept) const;
+
+    QString m_directory;
+    quint64 m_budget;
+    quint64 m_total_budget;
+};
+
+/**
+ * @brief A shared pointer to a GenerationStore.
+ */
+typedef QSharedPointer<const GenerationStore> GenerationStorePtr;
+
+#endif /* GENERATIONSTORE_H */
@@ -0,0 +1,355 @@
+#include "GeometryMemo.h"
+
+#include "GeometryPainter.h"
+#include "TurtleInterpreter.h"
+
+#include <QPainter>
+#include <QPen>
+#include <QStack>
+#include <limits>
+
+const quint64 GeometryMemo::max_prototype_segments = 4096;
+
+namespace
+{
+    /**
+     * @brief Rotation of a symbol not rewritten, in steps.
+     */
+    inline int symbol_rotation(char symbol)
+    {
+        return (symbol == '+') ? -1 : (symbol == '-') ? 1 : 0;
+    }
+
+    inline quint64 saturated_add(quint64 a, quint64 b)
+    {
+        return (a > std::numeric_limits<quint64>::max() - b)
+                ? std::numeric_limits<quint64>::max() : a + b;
+    }
+}
+
+void InstancedGeometry::clear()
+{
+    prototypes.clear();
+    instances.clear();
+    bounds = QRectF();
+}
+
+QTransform InstancedGeometry::placement(const Instance &instance,
+                                        const RotationTable &rotations) const
+{
+    // the rotation between the headings at 0 and at the instance's
+    const QPointF d0 = rotations.direction(0), d = rotations.direction(instance.steps);
+    const qreal c = d0.x() * d.x() + d0.y() * d.y(),
+            s = d0.x() * d.y() - d0.y() * d.x();
+    return QTransform(c, s, -s, c, instance.x, instance.y);
+}
+
+void InstancedGeometry::expand(const RotationTable &rotations, SegmentBuffer &segments) const
+{
+    for (size_t i = 0; i < instances.size(); ++i)
+    {
+        const QTransform transform = placement(instances[i], rotations);
+        const SegmentBuffer &prototype = prototypes[instances[i].prototype];
+        const float *xs = prototype.x(), *ys = prototype.y();
+        for (quint64 run = 0; run < prototype.run_count(); ++run)
+        {
+            const quint64 begin = prototype.run_begin(run), end = prototype.run_end(run);
+            for (quint64 j = begin; j < end; ++j)
+            {
+                const QPointF p = transform.map(QPointF(xs[j], ys[j]));
+                if (j == begin)
+                    segments.move_to(p.x(), p.y());
+                else
+                    segments.line_to(p.x(), p.y());
+            }
+        }
+    }
+}
+
+void InstancedGeometry::draw(QPainter &painter, const RotationTable &rotations,
+                             const QTransform &transform) const
+{
+    painter.save();
+
+    // the prototypes are scaled by the painter : keep the pen's width
+    QPen pen = painter.pen();
+    pen.setCosmetic(true);
+    painter.setPen(pen);
+
+    const QTransform identity;
+    for (size_t i = 0; i < instances.size(); ++i)
+    {
+        painter.setWorldTransform(placement(instances[i], rotations) * transform);
+        draw_segments(painter, prototypes[instances[i].prototype], identity);
+    }
+    painter.restore();
+}
+
+quint64 InstancedGeometry::segment_count() const
+{
+    quint64 count = 0;
+    for (size_t i = 0; i < instances.size(); ++i)
+        count += prototypes[instances[i].prototype].segment_count();
+    return count;
+}
+
+
+GeometryMemo::GeometryMemo(const ProductionTable &productions, float angle, uint depth) :
+    m_productions(productions), m_angle(angle), m_rotations(angle, 90.f),
+    m_valid(m_rotations.periodic()), m_period(m_rotations.period()),
+    m_symbols(0), m_entries(), m_symbol_rotations((depth + 1) * 256, 0),
+    m_moves((depth + 1) * 256, 0)
+{
+    // the drawing symbols : 'F' and the variables, whose productions must
+    // have balanced brackets
+    for (int c = 0; c < 256; ++c)
+    {
+        const char symbol = static_cast<char>(c);
+        m_index[c] = -1;
+        if (productions.is_constant(symbol))
+        {
+            if (symbol == 'F')
+                m_index[c] = m_symbols++;
+            continue;
+        }
+        if (symbol == '[' || symbol == ']')
+            m_valid = false;
+        const char *p = productions.production(symbol);
+        const char *end = p + productions.production_length(symbol);
+        int level = 0;
+        for (; p != end && level >= 0; ++p)
+        {
+            if (*p == '[')
+                ++level;
+            else if (*p == ']')
+                --level;
+        }
+        m_valid = m_valid && level == 0;
+        m_index[c] = m_symbols++;
+    }
+    if (!m_valid)
+        return;
+
+    // not rewritten : only 'F' moves, by one unit
+    m_entries.resize((depth + 1) * m_symbols * m_period);
+    for (int c = 0; c < 256; ++c)
+    {
+        m_symbol_rotations[c] = symbol_rotation(static_cast<char>(c));
+        if (m_index[c] < 0)
+            continue;
+        for (int h = 0; h < m_period; ++h)
+        {
+            Entry &e = m_entries[m_index[c] * m_period + h];
+            const Box origin = { 0, 0, 0, 0 };
+            e.displacement = (c == 'F') ? m_rotations.direction(h) : QPointF();
+            e.box = origin;
+            e.box.unite(origin, e.displacement);
+        }
+    }
+    m_moves['F'] = 1;
+
+    // each generation from the previous one, along the productions
+    QStack<TurtleInterpreter::SteppedState> stack;
+    for (uint g = 1; g <= depth; ++g)
+    {
+        for (int c = 0; c < 256; ++c)
+        {
+            const char symbol = static_cast<char>(c);
+            const int i = g * 256 + c;
+            if (productions.is_constant(symbol))
+            {
+                m_symbol_rotations[i] = m_symbol_rotations[i - 256];
+                m_moves[i] = m_moves[i - 256];
+                if (m_index[c] >= 0)
+                {
+                    for (int h = 0; h < m_period; ++h)
+                        m_entries[(g * m_symbols + m_index[c]) * m_period + h]
+                                = *entry(symbol, g - 1, h);
+                }
+                continue;
+            }
+
+            const char *begin = productions.production(symbol);
+            const char *end = begin + productions.production_length(symbol);
+            for (int h = 0; h < m_period; ++h)
+            {
+                QPointF pos;
+                int steps = h;
+                Box box = { 0, 0, 0, 0 };
+                quint64 moves = 0;
+                for (const char *p = begin; p != end; ++p)
+                {
+                    if (*p == '[')
+                        stack.push(TurtleInterpreter::SteppedState(pos, steps));
+                    else if (*p == ']')
+                    {
+                        const TurtleInterpreter::SteppedState state = stack.pop();
+                        pos = state.first, steps = state.second;
+                    }
+                    else
+                    {
+                        const Entry *e = entry(*p, g - 1, steps);
+                        if (e != nullptr)
+                        {
+                            box.unite(e->box, pos);
+                            pos += e->displacement;
+                        }
+                        steps = m_rotations.turned(steps, rotation(*p, g - 1));
+                        moves = saturated_add(moves, this->moves(*p, g - 1));
+                    }
+                }
+                Entry &e = m_entries[(g * m_symbols + m_index[c]) * m_period + h];
+                e.displacement = pos;
+                e.box = box;
+                m_symbol_rotations[i] = ((steps - h) % m_period + m_period) % m_period;
+                m_moves[i] = moves;
+            }
+        }
+    }
+}
+
+QPointF GeometryMemo::displacement(char symbol, uint generations, int steps) const
+{
+    const Entry *e = entry(symbol, generations, steps);
+    return (e != nullptr) ? e->displacement : QPointF();
+}
+
+int GeometryMemo::rotation(char symbol, uint generations) const
+{
+    return m_symbol_rotations[generations * 256 + static_cast<uchar>(symbol)];
+}
+
+QRectF GeometryMemo::bounds(char symbol, uint generations, int steps) const
+{
+    const Entry *e = entry(symbol, generations, steps);
+    if (e == nullptr)
+        return QRectF();
+    return QRectF(QPointF(e->box.left, e->box.top), QPointF(e->box.right, e->box.bottom));
+}
+
+quint64 GeometryMemo::moves(char symbol, uint generations) const
+{
+    return m_moves[generations * 256 + static_cast<uchar>(symbol)];
+}
+
+bool GeometryMemo::state_bounds(const DerivationTree &derivation, QRectF &bounds) const
+{
+    if (!m_valid)
+        return false;
+
+    const uint generations = derivation.depth();
+    QStack<TurtleInterpreter::SteppedState> stack;
+    QPointF pos;
+    int steps = 0;
+    Box box = { 0, 0, 0, 0 };
+    for (quint64 i = 0; i < derivation.base_length(); ++i)
+    {
+        const char symbol = derivation.base_symbol(i);
+        if (symbol == '[')
+            stack.push(TurtleInterpreter::SteppedState(pos, steps));
+        else if (symbol == ']')
+        {
+            if (stack.isEmpty())
+                return false;
+            const TurtleInterpreter::SteppedState state = stack.pop();
+            pos = state.first, steps = state.second;
+        }
+        else
+        {
+            const Entry *e = entry(symbol, generations, steps);
+            if (e != nullptr)
+            {
+                box.unite(e->box, pos);
+                pos += e->displacement;
+            }
+            steps = m_rotations.turned(steps, rotation(symbol, generations));
+        }
+    }
+    bounds = QRectF(QPointF(box.left, box.top), QPointF(box.right, box.bottom));
+    return true;
+}
+
+bool GeometryMemo::instantiate(const DerivationTree &derivation,
+                               InstancedGeometry &geometry) const
+{
+    geometry.clear();
+    if (!state_bounds(derivation, geometry.bounds))
+        return false;
+
+    const uint generations = derivation.depth();
+    QVector<int> prototypes((generations + 1) * 256, -1);
+    QStack<TurtleInterpreter::SteppedState> stack;
+    QPointF pos;
+    int steps = 0;
+    for (quint64 i = 0; i < derivation.base_length(); ++i)
+    {
+        const char symbol = derivation.base_symbol(i);
+        if (symbol == '[')
+            stack.push(TurtleInterpreter::SteppedState(pos, steps));
+        else if (symbol == ']')
+        {
+            const TurtleInterpreter::SteppedState state = stack.pop();
+            pos = state.first, steps = state.second;
+        }
+        else
+        {
+            place(symbol, generations, pos, steps, geometry, prototypes);
+            pos += displacement(symbol, generations, steps);
+            steps = m_rotations.turned(steps, rotation(symbol, generations));
+        }
+    }
+    return true;
+}
+
+void GeometryMemo::place(char symbol, uint generations, const QPointF &pos, int steps,
+                         InstancedGeometry &geometry, QVector<int> &prototypes) const
+{
+    const quint64 count = moves(symbol, generations);
+    if (count == 0)
+        return;
+
+    // small enough : a copy of the drawing of symbol, built once
+    if (count <= max_prototype_segments || generations == 0
+            || m_productions.is_constant(symbol))
+    {
+        int &prototype = prototypes[generations * 256 + static_cast<uchar>(symbol)];
+        if (prototype < 0)
+        {
+            TurtleGeometry drawing;
+            TurtleInterpreter interpreter(m_angle, drawing);
+            auto interpret = [&](char c) { return interpreter.interpret(c); };
+            const DerivationTree tree(QSharedPointer<const State>(new State(1, symbol)),
+                                      m_productions, generations);
+            tree.walk(interpret);
+            interpreter.finish();
+            prototype = geometry.prototypes.size();
+            geometry.prototypes.append(drawing.segments);
+        }
+        const InstancedGeometry::Instance instance = {
+            static_cast<float>(pos.x()), static_cast<float>(pos.y()), steps, prototype };
+        geometry.instances.push_back(instance);
+        return;
+    }
+
+    // otherwise : the instances of its production
+    QStack<TurtleInterpreter::SteppedState> stack;
+    QPointF p = pos;
+    const char *it = m_productions.production(symbol);
+    const char *end = it + m_productions.production_length(symbol);
+    for (; it != end; ++it)
+    {
+        if (*it == '[')
+            stack.push(TurtleInterpreter::SteppedState(p, steps));
+        else if (*it == ']')
+        {
+            const TurtleInterpreter::SteppedState state = stack.pop();
+            p = state.first, steps = state.second;
+        }
+        else
+        {
+            place(*it, generations - 1, p, steps, geometry, prototypes);
+            p += displacement(*it, generations - 1, steps);
+            steps = m_rotations.turned(steps, rotation(*it, generations - 1));
+        }
+    }
+}
@@ -0,0 +1,183 @@
+#ifndef GEOMETRYMEMO_H
+#define GEOMETRYMEMO_H
+
+#include <QRectF>
+#include <QTransform>
+#include <QVector>
+#include <vector>
+
+#include "DerivationTree.h"
+#include "SegmentBuffer.h"
+#include "VirtualTurtle.h"
+
+class QPainter;
+
+/**
+ * @brief A drawing made of copies of a few prototype drawings, each placed
+ * by a rotation and a translation.
+ *
+ * Drawing it costs as much as drawing all the segments, but building it only
+ * costs one instance per copy, and its memory usage does not depend on the
+ * size of the prototypes.
+ */
+struct InstancedGeometry
+{
+    /**
+     * @brief A copy of a prototype : the turtle state it starts from.
+     */
+    struct Instance
+    {
+        float x, y;
+        int steps; //!< heading, in rotation steps from north
+        int prototype;
+    };
+
+    QVector<SegmentBuffer> prototypes; //!< drawn from the origin, heading north
+    std::vector<Instance> instances;
+    QRectF bounds; //!< bounding box of the instances and of the origin
+
+    void clear();
+
+    /**
+     * @brief The transform placing an instance, for the given rotations.
+     */
+    QTransform placement(const Instance &instance, const RotationTable &rotations) const;
+
+    /**
+     * @brief Append the segments of every instance to segments.
+     */
+    void expand(const RotationTable &rotations, SegmentBuffer &segments) const;
+
+    /**
+     * @brief Draw every instance with painter, mapped by transform (any
+     * transform).
+     */
+    void draw(QPainter &painter, const RotationTable &rotations,
+              const QTransform &transform) const;
+
+    /**
+     * @brief Number of segments drawn.
+     */
+    quint64 segment_count() const;
+};
+
+/**
+ * @brief GeometryMemo memoizes the drawing of every symbol rewritten a number
+ * of times, as interpreted by a TurtleInterpreter.
+ *
+ * For a context-free grammar, the drawing of a symbol expanded g times only
+ * depends on the heading it starts with, up to a translation. For every
+ * symbol, number of generations and heading (the angle must make whole turns
+ * in a RotationTable period), the memo keeps :
+ * - the displacement of the turtle and its rotation, in steps,
+ * - the bounding box of its path,
+ * - the number of forward moves.
+ * Each entry is computed from the entries of the previous generation along
+ * the production, so the memo costs O(rules x generations x period) : the
+ * bounding box of a whole state is then known without interpreting it
+ * (state_bounds()).
+ *
+ * It also turns a state into an InstancedGeometry (instantiate()) : the
+ * derivation tree is only walked down to the generation where the symbols
+ * draw a few thousand segments, each being drawn by a copy of a prototype.
+ *
+ * Productions with unbalanced brackets make a symbol depend on the
+ * surrounding ones : the memo is then invalid (see is_valid()).
+ */
+class GeometryMemo
+{
+public:
+    static const quint64 max_prototype_segments;
+
+    /**
+     * @brief Memoize the drawings for up to depth rewritings.
+     * @param productions The productions used to rewrite the state.
+     * @param angle The rotation angle, in degrees.
+     */
+    GeometryMemo(const ProductionTable &productions, float angle, uint depth);
+
+    /**
+     * @brief Whether the angle is periodic and the brackets balanced.
+     */
+    inline bool is_valid() const { return m_valid; }
+
+    QPointF displacement(char symbol, uint generations, int steps) const;
+    int rotation(char symbol, uint generations) const;
+    QRectF bounds(char symbol, uint generations, int steps) const;
+    quint64 moves(char symbol, uint generations) const;
+
+    /**
+     * @brief Compute the bounding box of the drawing of the state derived by
+     * derivation (and of the origin), whose depth must not exceed the one of
+     * the memo.
+     * @return False if the memo is not valid, or if a ']' pops an empty stack.
+     */
+    bool state_bounds(const DerivationTree &derivation, QRectF &bounds) const;
+
+    /**
+     * @brief Build the drawing of the state derived by derivation as copies
+     * of prototypes of at most max_prototype_segments segments.
+     * @return False if the memo is not valid, or if a ']' pops an empty stack.
+     */
+    bool instantiate(const DerivationTree &derivation, InstancedGeometry &geometry) const;
+
+private:
+    /**
+     * @brief Add the instances drawing symbol expanded generations times,
+     * from the given position and heading, to geometry.
+     * @param prototypes Index of the prototype of every symbol and number of
+     * generations, or -1 if not built yet.
+     */
+    void place(char symbol, uint generations, const QPointF &pos, int steps,
+               InstancedGeometry &geometry, QVector<int> &prototypes) const;
+
+    /**
+     * @brief Bounding box, which unlike a QRectF can be a single point.
+     */
+    struct Box
+    {
+        qreal left, top, right, bottom;
+
+        inline void unite(const Box &other, const QPointF &offset)
+        {
+            left = qMin(left, other.left + offset.x());
+            top = qMin(top, other.top + offset.y());
+            right = qMax(right, other.right + offset.x());
+            bottom = qMax(bottom, other.bottom + offset.y());
+        }
+    };
+
+    struct Entry
+    {
+        QPointF displacement;
+        Box box;
+    };
+
+    /**
+     * @brief Entry of symbol expanded generations times from the heading
+     * steps, or nullptr for a symbol not drawing (any constant but 'F').
+     */
+    inline const Entry *entry(char symbol, uint generations, int steps) const
+    {
+        const int index = m_index[static_cast<uchar>(symbol)];
+        if (index < 0)
+            return nullptr;
+        int h = steps % m_period;
+        if (h < 0)
+            h += m_period;
+        return &m_entries[(generations * m_symbols + index) * m_period + h];
+    }
+
+    ProductionTable m_productions;
+    float m_angle;
+    RotationTable m_rotations;
+    bool m_valid;
+    int m_period;
+    int m_index[256]; //!< index of every drawing symbol, or -1
+    int m_symbols; //!< number of drawing symbols
+    QVector<Entry> m_entries; //!< [(generations * m_symbols + index) * m_period + steps]
+    QVector<int> m_symbol_rotations; //!< [generations * 256 + symbol]
+    QVector<quint64> m_moves; //!< [generations * 256 + symbol], saturated
+};
+
+#endif /* GEOMETRYMEMO_H */
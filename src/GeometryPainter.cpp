@@ -0,0 +1,96 @@
+#include "GeometryPainter.h"
+
+#include <QPainter>
+#include <QVarLengthArray>
+#include <vector>
+
+const int segment_tile_size = 2048; // maximal number of points per draw call
+
+void draw_segments(QPainter &painter, const SegmentBuffer &segments,
+                   const QTransform &transform, quint64 first_point)
+{
+    const float *xs = segments.x(), *ys = segments.y();
+    const qreal sx = transform.m11(), sy = transform.m22(),
+            dx = transform.dx(), dy = transform.dy();
+    auto map = [&](quint64 i) { return QPointF(sx * xs[i] + dx, sy * ys[i] + dy); };
+
+    QVarLengthArray<QLineF, segment_tile_size> lines;
+    QVarLengthArray<QPointF, segment_tile_size> points;
+    // from the run holding the segment ending at first_point
+    const quint64 first = first_point > 0 ? first_point - 1 : 0;
+    quint64 run = segments.run_after(first);
+    if (run > 0)
+        --run;
+    for (; run < segments.run_count(); ++run)
+    {
+        const quint64 begin = qMax(segments.run_begin(run), first),
+                end = segments.run_end(run);
+        if (end - begin < 2)
+            continue;
+
+        // isolated segments (e.g. most branches) : drawn together
+        if (end - begin == 2)
+        {
+            lines.append(QLineF(map(begin), map(begin + 1)));
+            if (lines.size() == segment_tile_size)
+            {
+                painter.drawLines(lines.constData(), lines.size());
+                lines.clear();
+            }
+            continue;
+        }
+
+        // longer runs : drawn by tiles, sharing their boundary point
+        for (quint64 i = begin; i + 1 < end; )
+        {
+            const int n = static_cast<int>(qMin<quint64>(segment_tile_size, end - i));
+            points.resize(n);
+            for (int j = 0; j < n; ++j)
+                points[j] = map(i + j);
+            painter.drawPolyline(points.constData(), n);
+            i += n - 1;
+        }
+    }
+    if (!lines.isEmpty())
+        painter.drawLines(lines.constData(), lines.size());
+}
+
+void draw_visible_segments(QPainter &painter, const SegmentBuffer &segments,
+                           const SegmentGrid &grid, const QTransform &transform,
+                           const QSize &viewport)
+{
+    const float *xs = segments.x(), *ys = segments.y();
+    const qreal sx = transform.m11(), sy = transform.m22(),
+            dx = transform.dx(), dy = transform.dy();
+    auto map = [&](quint64 i) { return QPointF(sx * xs[i] + dx, sy * ys[i] + dy); };
+
+    // sub-pixel segments : one per pixel at most
+    const int width = viewport.width(), height = viewport.height();
+    const bool sub_pixel = grid.extent() * qMax(qAbs(sx), qAbs(sy)) < 1;
+    std::vector<bool> covered(sub_pixel ? static_cast<size_t>(width) * height : 0);
+
+    QVarLengthArray<QLineF, segment_tile_size> lines;
+    const QRectF area = transform.inverted().mapRect(QRectF(QPointF(0, 0), viewport));
+    grid.visit(area, [&](quint64 i)
+    {
+        const QPointF p = map(i);
+        if (sub_pixel)
+        {
+            const int x = static_cast<int>(p.x()), y = static_cast<int>(p.y());
+            if (p.x() < 0 || p.y() < 0 || x >= width || y >= height)
+                return;
+            std::vector<bool>::reference pixel = covered[static_cast<size_t>(y) * width + x];
+            if (pixel)
+                return;
+            pixel = true;
+        }
+        lines.append(QLineF(p, map(i + 1)));
+        if (lines.size() == segment_tile_size)
+        {
+            painter.drawLines(lines.constData(), lines.size());
+            lines.clear();
+        }
+    });
+    if (!lines.isEmpty())
+        painter.drawLines(lines.constData(), lines.size());
+}
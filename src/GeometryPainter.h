@@ -0,0 +1,42 @@
+#ifndef GEOMETRYPAINTER_H
+#define GEOMETRYPAINTER_H
+
+#include <QTransform>
+
+#include "SegmentBuffer.h"
+#include "SegmentGrid.h"
+
+class QPainter;
+
+/**
+ * @brief Draw segments with painter, mapping them with transform.
+ *
+ * The transform must only be made of a scaling and a translation (see
+ * TurtleGeometry::fit()) : the points are transformed on the fly, and
+ * drawn by tiles of a few thousand points. Isolated segments are gathered
+ * into drawLines() calls, longer runs are drawn with drawPolyline().
+ *
+ * Works with any paint device : widget pixmaps, offscreen images, SVG...
+ * Only the segments ending at first_point or after are drawn, so that a
+ * buffer still growing can be drawn in several passes.
+ */
+void draw_segments(QPainter &painter, const SegmentBuffer &segments,
+                   const QTransform &transform, quint64 first_point = 0);
+
+/**
+ * @brief Draw the segments visible in a viewport of the given size, with
+ * painter, mapping them with transform.
+ *
+ * Only the cells of grid (indexing segments) overlapping the viewport are
+ * visited. Level of detail : when the segments are smaller than a pixel,
+ * a segment is only drawn if no other one started in the same pixel, so
+ * that the number of draw calls is bounded by the size of the viewport
+ * rather than by the number of segments.
+ *
+ * The transform must only be made of a scaling and a translation.
+ */
+void draw_visible_segments(QPainter &painter, const SegmentBuffer &segments,
+                           const SegmentGrid &grid, const QTransform &transform,
+                           const QSize &viewport);
+
+#endif /* GEOMETRYPAINTER_H */
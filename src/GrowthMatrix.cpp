@@ -0,0 +1,134 @@
+#include "GrowthMatrix.h"
+
+#include <limits>
+
+namespace
+{
+    const quint64 saturated = std::numeric_limits<quint64>::max();
+
+    inline quint64 saturated_add(quint64 a, quint64 b)
+    {
+        return (a > saturated - b) ? saturated : a + b;
+    }
+
+    inline quint64 saturated_multiply(quint64 a, quint64 b)
+    {
+        return (a != 0 && b > saturated / a) ? saturated : a * b;
+    }
+}
+
+GrowthMatrix::GrowthMatrix(const ProductionTable &productions, const State &base) :
+    m_alphabet(), m_matrix(), m_base()
+{
+    // the alphabet : the symbols of the base, and all they can produce
+    int index[256];
+    for (int c = 0; c < 256; ++c)
+        index[c] = -1;
+    State::const_iterator it;
+    for (it = base.begin(); it != base.end(); ++it)
+    {
+        if (index[static_cast<uchar>(*it)] < 0)
+        {
+            index[static_cast<uchar>(*it)] = m_alphabet.size();
+            m_alphabet.append(*it);
+        }
+    }
+    for (int i = 0; i < m_alphabet.size(); ++i)
+    {
+        const char *p = productions.production(m_alphabet[i]);
+        const char *end = p + productions.production_length(m_alphabet[i]);
+        for (; p != end; ++p)
+        {
+            if (index[static_cast<uchar>(*p)] < 0)
+            {
+                index[static_cast<uchar>(*p)] = m_alphabet.size();
+                m_alphabet.append(*p);
+            }
+        }
+    }
+
+    const int k = m_alphabet.size();
+    m_base.fill(0, k);
+    for (it = base.begin(); it != base.end(); ++it)
+        ++m_base[index[static_cast<uchar>(*it)]];
+    m_matrix.fill(0, k * k);
+    for (int i = 0; i < k; ++i)
+    {
+        const char *p = productions.production(m_alphabet[i]);
+        const char *end = p + productions.production_length(m_alphabet[i]);
+        for (; p != end; ++p)
+            ++m_matrix[i * k + index[static_cast<uchar>(*p)]];
+    }
+}
+
+SymbolCounts GrowthMatrix::counts(uint generations) const
+{
+    const QVector<quint64> counts = alphabet_counts(generations);
+    SymbolCounts result(256, 0);
+    for (int i = 0; i < m_alphabet.size(); ++i)
+        result[static_cast<uchar>(m_alphabet[i])] = counts[i];
+    return result;
+}
+
+quint64 GrowthMatrix::length(uint generations) const
+{
+    const QVector<quint64> counts = alphabet_counts(generations);
+    quint64 length = 0;
+    for (int i = 0; i < counts.size(); ++i)
+        length = saturated_add(length, counts[i]);
+    return length;
+}
+
+quint64 GrowthMatrix::total(const SymbolCounts &counts)
+{
+    quint64 total = 0;
+    for (int c = 0; c < counts.size(); ++c)
+        total = saturated_add(total, counts[c]);
+    return total;
+}
+
+QVector<quint64> GrowthMatrix::alphabet_counts(uint generations) const
+{
+    // counts x M^generations, squaring M for every bit of generations
+    const int k = m_alphabet.size();
+    QVector<quint64> counts = m_base;
+    Matrix power = m_matrix;
+    for (; generations > 0; generations >>= 1)
+    {
+        if (generations & 1)
+        {
+            QVector<quint64> next(k, 0);
+            for (int i = 0; i < k; ++i)
+            {
+                if (counts[i] == 0)
+                    continue;
+                for (int j = 0; j < k; ++j)
+                    next[j] = saturated_add(next[j],
+                                            saturated_multiply(counts[i], power[i * k + j]));
+            }
+            counts = next;
+        }
+        if (generations > 1)
+            power = multiply(power, power);
+    }
+    return counts;
+}
+
+GrowthMatrix::Matrix GrowthMatrix::multiply(const Matrix &a, const Matrix &b) const
+{
+    const int k = m_alphabet.size();
+    Matrix result(k * k, 0);
+    for (int i = 0; i < k; ++i)
+    {
+        for (int l = 0; l < k; ++l)
+        {
+            const quint64 x = a[i * k + l];
+            if (x == 0)
+                continue;
+            for (int j = 0; j < k; ++j)
+                result[i * k + j] = saturated_add(result[i * k + j],
+                                                  saturated_multiply(x, b[l * k + j]));
+        }
+    }
+    return result;
+}
@@ -0,0 +1,73 @@
+#ifndef GROWTHMATRIX_H
+#define GROWTHMATRIX_H
+
+#include <QVector>
+
+#include "ProductionTable.h"
+
+/**
+ * @brief Number of occurrences of every symbol in a state : [symbol],
+ * 256 entries (saturated at 2^64-1).
+ */
+typedef QVector<quint64> SymbolCounts;
+
+/**
+ * @brief GrowthMatrix predicts the symbol counts of every generation of an
+ * L-System, without iterating it.
+ *
+ * The productions only depend on the symbols, so the counts of a generation
+ * are those of the previous one multiplied by the count matrix M, where
+ * M[a][b] is the number of b in the production of a. The counts of the
+ * generation N are thus the counts of the base state times M^N, computed
+ * by repeated squaring : O(k^3 log N) for an alphabet of k symbols, which
+ * is closed under the productions (like the one of a PackedState).
+ *
+ * The arithmetic is saturated at 2^64-1, like DerivationTree::length().
+ */
+class GrowthMatrix
+{
+public:
+    /**
+     * @brief Constructor.
+     * @param productions The productions used to rewrite the state.
+     * @param base The state at generation 0.
+     */
+    GrowthMatrix(const ProductionTable &productions, const State &base);
+
+    /**
+     * @brief Number of distinct symbols the base state can produce.
+     */
+    inline int alphabet_size() const { return m_alphabet.size(); }
+
+    /**
+     * @brief Symbol counts of the base state rewritten generations times.
+     */
+    SymbolCounts counts(uint generations) const;
+
+    /**
+     * @brief Length of the base state rewritten generations times.
+     */
+    quint64 length(uint generations) const;
+
+    /**
+     * @brief Total of counts (saturated).
+     */
+    static quint64 total(const SymbolCounts &counts);
+
+private:
+    typedef QVector<quint64> Matrix; //!< [row * alphabet_size() + column]
+
+    /**
+     * @brief Counts of the base state rewritten generations times, over the
+     * alphabet.
+     */
+    QVector<quint64> alphabet_counts(uint generations) const;
+
+    Matrix multiply(const Matrix &a, const Matrix &b) const;
+
+    QVector<char> m_alphabet;
+    Matrix m_matrix;
+    QVector<quint64> m_base; //!< counts of the base state, over the alphabet
+};
+
+#endif /* GROWTHMATRIX_H */
@@ -1,11 +1,74 @@
 #include "LSystem.h"
 
+#include <QVector>
+#include <QScopedPointer>
+#include <limits>
+#include <utility>
+#include "Parallel.h"
+
+const State::size_type LSystem::parallel_threshold = 1 << 16;
+const quint64 LSystem::default_memory_budget = Q_UINT64_C(2) << 30;
+const quint64 LSystem::default_disk_budget = Q_UINT64_C(64) << 30;
+const int chunks_per_thread = 8; // for load balancing in iterate_parallel()
+// unit of work between two checks for cancellation, in symbols
+const State::size_type iteration_chunk_size = 1 << 20;
+const int progress_interval = 100; // minimal delay between two progress signals, in ms
+
+namespace
+{
+    /**
+     * @brief A slice of the state rewritten by iterate_parallel().
+     */
+    struct ExpansionChunk
+    {
+        const char *begin, *end;
+        State::size_type length; //!< expanded length
+        State::size_type offset; //!< in the new state
+    };
+
+    /**
+     * @brief Create the snapshot of a generation from its materialized state.
+     */
+    GenerationSnapshotPtr make_snapshot(uint generation,
+                                        QSharedPointer<const State> state,
+                                        QSharedPointer<const MappedState> mapped,
+                                        QSharedPointer<const PackedState> packed,
+                                        const ProductionTable &productions,
+                                        uint depth)
+    {
+        QSharedPointer<GenerationSnapshot> snapshot(new GenerationSnapshot());
+        snapshot->generation = generation;
+        snapshot->state = state, snapshot->mapped = mapped, snapshot->packed = packed;
+        if (!packed.isNull())
+            snapshot->derivation = DerivationTree(packed, productions, depth);
+        else if (!mapped.isNull())
+            snapshot->derivation = DerivationTree(mapped, productions, depth);
+        else
+            snapshot->derivation = DerivationTree(state, productions, depth);
+        return snapshot;
+    }
+}
+
 LSystem::LSystem(const State &axiom, const RulesDict &rules,
                  QObject *parent) : QObject(parent), m_mutex(),
-    m_state(axiom), m_rules(rules), m_N(0)
+    m_rules(rules), m_grammar(axiom.data(), static_cast<int>(axiom.length())),
+    m_productions(rules), m_growth(m_productions, axiom),
+    m_memory_budget(default_memory_budget), m_disk_budget(default_disk_budget),
+    m_lazy(false), m_pack(false),
+    m_current(), m_derived(), m_axiom(), m_cache(), m_store(),
+    m_scheduler(TaskScheduler::global_instance()),
+    m_thread_count(m_scheduler.thread_count()), m_cancel_requested(0),
+    m_progressTimer(), m_last_progress(0), m_progress_base(0), m_progress_total(0)
 {
+    RulesDict::const_iterator it;
+    for (it = rules.constBegin(); it != rules.constEnd(); ++it)
+        m_grammar += '\n' + QByteArray(1, it.key()) + '=' + it.value().toLatin1();
 
-
+    m_axiom = make_snapshot(0, QSharedPointer<const State>(new State(axiom)),
+                            QSharedPointer<const MappedState>(),
+                            QSharedPointer<const PackedState>(), m_productions, 0);
+    m_current = m_axiom;
+    m_cache.insert(m_axiom);
 }
 
 LSystem::~LSystem()
@@ -13,33 +76,522 @@ LSystem::~LSystem()
 
 }
 
+DerivationTree LSystem::axiom_derivation(uint generation) const
+{
+    // the axiom and the productions are immutable : no lock needed
+    return DerivationTree(m_axiom->state, m_productions, generation);
+}
+
+GenerationSnapshotPtr LSystem::latest_snapshot() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_derived.isNull() ? m_current : m_derived;
+}
+
 void LSystem::iterate()
 {
+    // a request made while idle is not meant for this iteration
+    m_cancel_requested.store(0);
     m_mutex.lock();
-    State newState;
-    State::const_iterator iter;
-    int i = 0;
-    const int L = m_state.length();
-    for (iter = m_state.begin(); iter != m_state.end(); ++iter)
+    const GenerationSnapshotPtr current = m_current;
+    // e.g. stepping forth again after stepping back : not rewritten again
+    const GenerationSnapshotPtr cached = m_cache.find(current->generation + 1);
+    m_mutex.unlock();
+
+    const GenerationSnapshotPtr next = cached.isNull() ? advance(current, true) : cached;
+    m_cancel_requested.store(0);
+    if (next.isNull())
     {
-        // if the character is not in the production rules
-        // it's a constant, hence the default value
-        const char c = *iter;
-        const QString c_product = m_rules.value(c, QChar(c));
+        emit iteration_cancelled();
+        return;
+    }
+    publish(next);
+    emit iteration_finished();
+}
 
-        // we do a 'manual append' to avoid bad_alloc exceptions
-        newState += c_product.toStdString();
+void LSystem::jump_to(uint generation)
+{
+    m_cancel_requested.store(0);
+    m_mutex.lock();
+    const GenerationStorePtr store = m_lazy ? GenerationStorePtr() : m_store;
+    GenerationSnapshotPtr start = m_cache.find(generation);
+    if (start.isNull())
+    {
+        // start from the latest generation known before the requested one
+        start = m_cache.closest(generation);
+        if (start.isNull())
+            start = m_axiom;
+        if (m_current->generation <= generation
+                && m_current->generation > start->generation)
+            start = m_current;
+    }
+    m_mutex.unlock();
 
-        // update our progress
-        emit iteration_progressed(100 * ++i /L );
+    // or from the latest one stored after it
+    for (uint n = generation; !store.isNull() && n > start->generation; --n)
+    {
+        const GenerationSnapshotPtr stored = load_stored(store, n);
+        if (!stored.isNull())
+        {
+            start = stored;
+            m_mutex.lock();
+            m_cache.insert(stored);
+            m_mutex.unlock();
+            break;
+        }
     }
 
-    m_state = newState, ++m_N;
-    m_mutex.unlock();
+    // the generations on the way are cached, but only the requested one is
+    // published : the system is left unchanged if cancelled
+    GenerationSnapshotPtr next = start;
+    for (uint n = start->generation; !next.isNull() && n < generation; ++n)
+        next = advance(next, n + 1 == generation);
+    m_cancel_requested.store(0);
 
+    if (next.isNull())
+    {
+        emit iteration_cancelled();
+        return;
+    }
+    publish(next);
     emit iteration_finished();
 }
 
+void LSystem::publish(const GenerationSnapshotPtr &next)
+{
+    QMutexLocker locker(&m_mutex);
+    m_current = next;
+    m_derived.clear();
+}
+
+GenerationSnapshotPtr LSystem::advance(const GenerationSnapshotPtr &current, bool requested)
+{
+    // take a snapshot of the modes : the mutex is only held to read them and
+    // to store the result, so that the accessors never stall
+    m_mutex.lock();
+    const bool lazy = m_lazy, pack = m_pack;
+    const quint64 budget = m_memory_budget, disk_budget = m_disk_budget;
+    const GenerationStorePtr store = m_store;
+    m_mutex.unlock();
+
+    m_progressTimer.start();
+    m_last_progress.store(0);
+
+    // a stored generation is loaded at once
+    const uint generation = current->generation + 1;
+    const GenerationSnapshotPtr stored = lazy || store.isNull() ?
+                GenerationSnapshotPtr() : load_stored(store, generation);
+    if (!stored.isNull())
+    {
+        m_mutex.lock();
+        m_cache.insert(stored);
+        m_mutex.unlock();
+        return stored;
+    }
+
+    // the requested generation can already be walked, lazily over the
+    // current materialized state : readers start on it while it is
+    // materialized
+    if (requested)
+    {
+        m_mutex.lock();
+        m_derived = make_snapshot(generation, current->state, current->mapped,
+                                  current->packed, m_productions,
+                                  current->derivation.depth() + 1);
+        m_mutex.unlock();
+        emit iteration_derived();
+    }
+
+    // switch to the requested representation
+    QSharedPointer<const State> state = current->state;
+    QSharedPointer<const MappedState> mapped = current->mapped;
+    QSharedPointer<const PackedState> packed = current->packed;
+    uint depth = current->derivation.depth();
+    uint materialized = current->generation - depth;
+    if (pack && packed.isNull())
+    {
+        // an out-of-core state is only packed if it then fits in memory
+        if (mapped.isNull() || materialized_memory(materialized, true) <= budget)
+            pack_state(state, mapped, packed);
+    }
+    else if (!pack && !packed.isNull())
+    {
+        // unpacked where it fits unpacked, as the next generations : kept
+        // packed otherwise, the next generations being then packed too, or
+        // derived over it
+        const Storage target = storage(materialized, false, budget, disk_budget);
+        if (target == InMemory || target == OnDisk)
+            unpack_state(state, mapped, packed, target);
+    }
+
+    // the work, in symbols rewritten, is known beforehand : the progress
+    // spans all the generations materialized
+    m_progress_base = 0;
+    m_progress_total = 0;
+    for (uint m = materialized; !lazy && m < generation
+         && storage(m + 1, pack, budget, disk_budget) != Derived; ++m)
+        m_progress_total += predicted_length(m);
+
+    // materialize the generations derived lazily, if any, and the next one,
+    // as long as they fit in the budgets : the others are derived lazily
+    bool done = true;
+    for (; !lazy && done && materialized < generation; ++materialized)
+    {
+        const quint64 length = predicted_length(materialized + 1);
+        const Storage target = storage(materialized + 1, pack, budget, disk_budget);
+        if (target == Derived)
+            break;
+        // the rewriting keeps the representation of the state : packed
+        // beforehand where the plain state would not fit in memory, and
+        // unpacked beforehand, where it fits, on its way out of core
+        if (target == Packed && packed.isNull())
+            pack_state(state, mapped, packed);
+        else if (target != Packed && !packed.isNull()
+                 && !unpack_state(state, mapped, packed,
+                                  storage(materialized, false, budget, disk_budget) == InMemory
+                                  ? InMemory : OnDisk))
+            break;
+        QSharedPointer<MappedState> file;
+        if (target == OnDisk)
+        {
+            // the disk may be full
+            file = QSharedPointer<MappedState>(new MappedState());
+            if (!file->allocate(length))
+                break;
+        }
+        done = rewrite(state, mapped, packed, materialized, file);
+        m_progress_base += predicted_length(materialized);
+    }
+    if (!done || cancelled())
+    {
+        m_mutex.lock();
+        m_derived.clear();
+        m_mutex.unlock();
+        return GenerationSnapshotPtr();
+    }
+    depth = generation - materialized;
+
+    const GenerationSnapshotPtr next = make_snapshot(generation, state, mapped, packed,
+                                                     m_productions, depth);
+    m_mutex.lock();
+    m_cache.insert(next);
+    m_mutex.unlock();
+    return next;
+}
+
+GenerationSnapshotPtr LSystem::load_stored(const GenerationStorePtr &store,
+                                           uint generation) const
+{
+    // rewritten with no bound check : a state of another length is corrupted
+    const QSharedPointer<const MappedState> state = store->load_state(m_grammar, generation);
+    if (state.isNull() || state->length() != predicted_length(generation))
+        return GenerationSnapshotPtr();
+    return make_snapshot(generation, QSharedPointer<const State>(), state,
+                         QSharedPointer<const PackedState>(), m_productions, 0);
+}
+
+void LSystem::pack_state(QSharedPointer<const State> &state,
+                         QSharedPointer<const MappedState> &mapped,
+                         QSharedPointer<const PackedState> &packed) const
+{
+    if (mapped.isNull())
+        packed = QSharedPointer<const PackedState>(new PackedState(*state, m_productions));
+    else
+        packed = QSharedPointer<const PackedState>(
+                    new PackedState(mapped->data(), mapped->length(), m_productions));
+    state.clear();
+    mapped.clear();
+}
+
+bool LSystem::unpack_state(QSharedPointer<const State> &state,
+                           QSharedPointer<const MappedState> &mapped,
+                           QSharedPointer<const PackedState> &packed, Storage target) const
+{
+    if (target == InMemory)
+        state = QSharedPointer<const State>(new State(packed->unpacked()));
+    else
+    {
+        QSharedPointer<MappedState> file(new MappedState());
+        // the disk may be full
+        if (!file->allocate(packed->length()))
+            return false;
+        packed->unpack(file->data());
+        mapped = file;
+    }
+    packed.clear();
+    return true;
+}
+
+void LSystem::cancel()
+{
+    m_cancel_requested.store(1);
+}
+
+bool LSystem::rewrite(QSharedPointer<const State> &state,
+                      QSharedPointer<const MappedState> &mapped,
+                      QSharedPointer<const PackedState> &packed, uint generation,
+                      QSharedPointer<MappedState> file)
+{
+    // the new state is written with no bound check, into storage of the
+    // predicted length : the state must have its predicted length too
+    const quint64 L = !packed.isNull() ? packed->length()
+                                       : !mapped.isNull() ? mapped->length() : state->length();
+    if (L != predicted_length(generation))
+        return false;
+    const quint64 length = predicted_length(generation + 1);
+
+    if (!packed.isNull())
+    {
+        PackedState *newState = rewrite_packed(*packed);
+        if (newState == nullptr)
+            return false;
+        packed = QSharedPointer<const PackedState>(newState);
+        state.clear();
+        return true;
+    }
+
+    // from memory or from a file, into either : both are contiguous symbols
+    const char *data = mapped.isNull() ? state->data() : mapped->data();
+    QScopedPointer<State> newState;
+    char *out;
+    if (file.isNull())
+    {
+        // the exact length of the new state is predicted : it is allocated once
+        newState.reset(new State(length, '\0'));
+        out = &(*newState)[0];
+    }
+    else
+        out = file->data();
+
+    m_mutex.lock();
+    const int threads = m_thread_count;
+    m_mutex.unlock();
+    const bool done = (threads > 1 && L >= parallel_threshold) ?
+                iterate_parallel(data, L, out, length, threads) :
+                iterate_serial(data, L, out);
+    if (!done)
+        return false;
+    if (file.isNull())
+        state = QSharedPointer<const State>(newState.take()), mapped.clear();
+    else
+        mapped = file, state.clear();
+    return true;
+}
+
+PackedState *LSystem::rewrite_packed(const PackedState &state)
+{
+    // first pass, done by the rewriter
+    PackedRewriter rewriter(state, m_productions);
+
+    // second pass, chunk by chunk
+    const quint64 L = state.length();
+    for (quint64 i = 0; i < L; i += iteration_chunk_size)
+    {
+        if (cancelled())
+            return nullptr;
+        const quint64 n = qMin<quint64>(iteration_chunk_size, L - i);
+        rewriter.rewrite(i, i + n);
+        report_progress(i + n);
+    }
+
+    return new PackedState(std::move(rewriter.result()));
+}
+
+bool LSystem::iterate_serial(const char *state, quint64 length, char *out)
+{
+    // copy the productions, chunk by chunk
+    for (quint64 i = 0; i < length; i += iteration_chunk_size)
+    {
+        if (cancelled())
+            return false;
+        const quint64 n = qMin<quint64>(iteration_chunk_size, length - i);
+        out = m_productions.expand(state + i, state + i + n, out);
+        report_progress(i + n);
+    }
+    return true;
+}
+
+bool LSystem::iterate_parallel(const char *state, quint64 length, char *out,
+                               quint64 out_length, int threads)
+{
+    const ProductionTable &table = m_productions;
+    const quint64 L = length;
+    // enough chunks to balance the load and to bound the cancellation latency
+    const int count = static_cast<int>(qMax<quint64>(
+            threads * chunks_per_thread,
+            (L + iteration_chunk_size - 1) / iteration_chunk_size));
+
+    QVector<ExpansionChunk> chunks(count);
+    for (int i = 0; i < count; ++i)
+    {
+        chunks[i].begin = state + L * i / count;
+        chunks[i].end = state + L * (i + 1) / count;
+    }
+
+    // first pass : expanded length of every chunk
+    parallel_for(m_scheduler, count, [&](int i) {
+        if (!cancelled())
+            chunks[i].length = table.expanded_length(chunks[i].begin, chunks[i].end);
+    }, threads);
+    if (cancelled())
+        return false;
+
+    // exclusive prefix sum : offset of every chunk in the new state
+    State::size_type offset = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        chunks[i].offset = offset;
+        offset += chunks[i].length;
+    }
+    if (offset != out_length)
+        return false;
+
+    // second pass : expand every chunk at its place in the new state
+    QAtomicInteger<quint64> done(0);
+    parallel_for(m_scheduler, count, [&](int i) {
+        if (cancelled())
+            return;
+        table.expand(chunks[i].begin, chunks[i].end, out + chunks[i].offset);
+        const quint64 n = chunks[i].end - chunks[i].begin;
+        report_progress(done.fetchAndAddRelaxed(n) + n);
+    }, threads);
+    return !cancelled();
+}
+
+void LSystem::report_progress(quint64 done)
+{
+    // throttled by the elapsed time : whatever the length of the state, the
+    // receivers only get a few signals per second
+    const int now = static_cast<int>(m_progressTimer.elapsed());
+    const int last = m_last_progress.load();
+    if (now - last < progress_interval
+            || !m_last_progress.testAndSetRelaxed(last, now))
+        return;
+    const double total = static_cast<double>(qMax<quint64>(m_progress_total, 1));
+    emit iteration_progressed(static_cast<uint>(
+            qMin(99., 100. * (m_progress_base + done) / total)));
+}
+
+quint64 LSystem::predicted_memory(uint generation) const
+{
+    m_mutex.lock();
+    const bool pack = m_pack;
+    const quint64 budget = m_memory_budget, disk_budget = m_disk_budget;
+    m_mutex.unlock();
+    return materialized_memory(generation, pack
+                               || storage(generation, pack, budget, disk_budget) == Packed);
+}
+
+quint64 LSystem::materialized_memory(uint generation, bool pack) const
+{
+    const quint64 length = predicted_length(generation);
+    if (!pack)
+        return length;
+
+    // whole 64-bit words of 4-bit or 8-bit codes, see PackedState
+    const quint64 per_word = (m_growth.alphabet_size() <= 16) ? 16 : 8;
+    const quint64 words = length / per_word + (length % per_word != 0 ? 1 : 0);
+    return (words > std::numeric_limits<quint64>::max() / sizeof(quint64))
+            ? std::numeric_limits<quint64>::max() : words * sizeof(quint64);
+}
+
+LSystem::Storage LSystem::predicted_storage(uint generation) const
+{
+    m_mutex.lock();
+    const bool lazy = m_lazy, pack = m_pack;
+    const quint64 budget = m_memory_budget, disk_budget = m_disk_budget;
+    m_mutex.unlock();
+    return lazy ? Derived : storage(generation, pack, budget, disk_budget);
+}
+
+LSystem::Storage LSystem::storage(uint generation, bool pack, quint64 budget,
+                                  quint64 disk_budget) const
+{
+    if (!pack && materialized_memory(generation, false) <= budget)
+        return InMemory;
+    // packed where the plain state would not fit : in memory rather than
+    // out of core
+    if (materialized_memory(generation, true) <= budget)
+        return Packed;
+    // one byte per symbol out of core
+    if (!pack && predicted_length(generation) <= disk_budget)
+        return OnDisk;
+    return Derived;
+}
+
+void LSystem::set_store(GenerationStorePtr store)
+{
+    QMutexLocker locker(&m_mutex);
+    m_store = store;
+}
+
+void LSystem::set_disk_budget(quint64 budget)
+{
+    QMutexLocker locker(&m_mutex);
+    m_disk_budget = budget;
+}
+
+void LSystem::set_memory_budget(quint64 budget)
+{
+    QMutexLocker locker(&m_mutex);
+    m_memory_budget = budget;
+}
+
+void LSystem::set_thread_count(int count)
+{
+    QMutexLocker locker(&m_mutex);
+    m_thread_count = count > 0 ? count : m_scheduler.thread_count();
+}
+
+int LSystem::thread_count() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_thread_count;
+}
+
+void LSystem::set_cache_budget(quint64 budget)
+{
+    QMutexLocker locker(&m_mutex);
+    m_cache.set_budget(budget);
+}
+
+bool LSystem::is_cached(uint generation) const
+{
+    QMutexLocker locker(&m_mutex);
+    return generation == 0 || m_cache.contains(generation);
+}
+
+void LSystem::set_lazy(bool lazy)
+{
+    QMutexLocker locker(&m_mutex);
+    m_lazy = lazy;
+}
+
+void LSystem::set_packed(bool packed)
+{
+    QMutexLocker locker(&m_mutex);
+    m_pack = packed;
+}
+
+QSharedPointer<const State> LSystem::state() const
+{
+    m_mutex.lock();
+    const GenerationSnapshotPtr current = m_current;
+    const quint64 budget = m_memory_budget;
+    m_mutex.unlock();
+    if (!current->state.isNull())
+        return current->state;
+
+    // packed or out of core : copied on demand, within the memory budget
+    const quint64 length = current->packed.isNull() ? current->mapped->length()
+                                                    : current->packed->length();
+    if (length > budget)
+        return QSharedPointer<const State>();
+    return QSharedPointer<const State>(current->packed.isNull() ?
+                new State(current->mapped->data(), length) :
+                new State(current->packed->unpacked()));
+}
+
 State LSystem::string_to_state(const QString &string)
 {
     return State(string.toStdString());
@@ -5,19 +5,14 @@
 #include <QMap>
 #include <list>
 #include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QAtomicInt>
 
-
-/**
- * @brief State is the container for an L-System's state.
- */
-typedef std::string State;
-
-/**
-* @brief RulesDict is a QMap of the type {variable_char:producted_string}
-* representing the production rules of an L-System.
-* Utilizes a QString as a producted string for convenience.
-*/
-typedef QMap<char, QString> RulesDict;
+#include "ProductionTable.h"
+#include "GenerationCache.h"
+#include "GrowthMatrix.h"
+#include "GenerationStore.h"
+#include "TaskScheduler.h"
 
 /**
  * @brief Implements a simple Lindenmayer System, or L-System.
@@ -36,14 +31,50 @@ typedef QMap<char, QString> RulesDict;
  * A variable need to be a single ASCII character : this speeds up
  * the iteration algorithm, reduces the needed memory and avoids any abiguous production rules.
  *
- * @todo Use compression to reduce memory usage by the State string ?
- * @todo iterate() using a variable-sized buffer : allows for cancelling
+ * In lazy mode (see set_lazy()), iterating only deepens the DerivationTree
+ * over the last materialized state : the symbols of the current generation
+ * are then produced on demand, and never stored.
+ *
+ * In packed mode (see set_packed()), the materialized state is stored as a
+ * PackedState, using 4 bits per symbol for most grammars. Otherwise, only
+ * the generations which would not fit in the memory budget plain are
+ * packed, if they then fit.
+ *
+ * Every generation is published as an immutable GenerationSnapshot, and the
+ * most recent ones are kept in a GenerationCache : readers can work on a
+ * generation while the next one is being produced, and going back to a
+ * cached generation (see jump_to()) is immediate.
+ *
+ * The generation being produced can be walked before it is done (see
+ * latest_snapshot()), lazily over the previous one : the renderer starts
+ * interpreting it while it is still being expanded.
+ *
+ * The length of any generation is known before iterating (see
+ * predicted_length()) : a generation which would not fit in the memory
+ * budget (see set_memory_budget()), even packed, is materialized out of
+ * core, in a MappedState, if it fits in the disk budget (see
+ * set_disk_budget()), and is derived lazily otherwise (see
+ * predicted_storage()).
+ *
+ * With a GenerationStore (see set_store()), the stored generations are
+ * loaded rather than produced again, e.g. from a previous run.
  */
 class LSystem : public QObject
 {
     Q_OBJECT
 
 public:
+    /**
+     * @brief Where a generation is stored.
+     */
+    enum Storage
+    {
+        InMemory, //!< materialized in memory, as a State
+        Packed,   //!< materialized in memory, as a PackedState
+        OnDisk,   //!< materialized out of core, as a MappedState
+        Derived   //!< derived lazily from a previous generation
+    };
+
     /**
      * @brief Default constructor for LSystem.
      * @param rules The RulesDict containing the production rules.
@@ -57,20 +88,244 @@ public:
     /**
      * @brief Iterate (or, biologically speaking, evolve) the system to its next
      * state according to its production (evolution) rules. Thread-safe.
+     *
+     * The work is done in chunks, between which a cancellation request
+     * (see cancel()) is checked. The mutex is only held to swap the new
+     * state in, so the accessors never wait for an iteration. A cached next
+     * generation (e.g. after going back, see jump_to()) is published at once.
      */
     void iterate();
 
+    /**
+     * @brief Request the running iterate() or jump_to() to stop as soon as
+     * possible. Thread-safe.
+     *
+     * A cancelled iteration leaves the system unchanged, and fires
+     * iteration_cancelled() instead of iteration_finished(). A request
+     * made while no iteration runs is dropped by the next one.
+     */
+    void cancel();
+
+    /**
+     * @brief Make the given generation the current one. Thread-safe.
+     *
+     * A cached generation is restored immediately ; otherwise the system is
+     * iterated from the latest generation known before it. Fires
+     * iteration_finished(), or iteration_cancelled() (see cancel()) in which
+     * case the system is left unchanged.
+     */
+    void jump_to(uint generation);
+
     /**
      * @brief Thread-safe accessor for the current generation number.
      * @return The current generation number.
      */
-    uint generation() const { QMutexLocker locker(&m_mutex); return m_N; }
+    uint generation() const { QMutexLocker locker(&m_mutex); return m_current->generation; }
 
     /**
-     * @brief Thread-safe accessor for the current state.
-     * @return A reference to the L-System state.
+     * @brief Thread-safe accessor for the current generation.
+     *
+     * The snapshot is immutable and stays valid whatever happens to the
+     * LSystem afterwards : it can be read without any lock.
      */
-    const State &state() const { QMutexLocker locker(&m_mutex); return m_state; }
+    GenerationSnapshotPtr snapshot() const { QMutexLocker locker(&m_mutex); return m_current; }
+
+    /**
+     * @brief Thread-safe accessor for the latest generation known : while
+     * iterating (see iteration_derived()), the generation being produced,
+     * derived lazily ; otherwise the current generation.
+     */
+    GenerationSnapshotPtr latest_snapshot() const;
+
+    /**
+     * @brief Thread-safe accessor for the last materialized state.
+     *
+     * Unless in lazy mode, this is the current state ; otherwise use
+     * derivation() to walk the current state.
+     * A packed or out-of-core state is copied into memory on every call,
+     * which is costly, and only if it fits in the memory budget : prefer
+     * derivation() to walk it. The snapshot is left as is.
+     * @return The last materialized state, shared with the current snapshot
+     * or copied : it stays valid whatever happens to the LSystem
+     * afterwards. Null if packed or out of core and over the memory budget.
+     */
+    QSharedPointer<const State> state() const;
+
+    /**
+     * @brief Thread-safe accessor for the derivation tree of the current state.
+     *
+     * The returned tree shares the materialized state and stays valid
+     * whatever happens to the LSystem afterwards.
+     */
+    DerivationTree derivation() const { QMutexLocker locker(&m_mutex); return m_current->derivation; }
+
+    /**
+     * @brief Derivation tree of the given generation from the axiom. Thread-safe.
+     *
+     * Nothing is materialized : this is meant to analyze a generation from
+     * the grammar (e.g. TurtleArena::profile()) in O(rules x generation),
+     * whatever the length of its materialized state.
+     */
+    DerivationTree axiom_derivation(uint generation) const;
+
+    /**
+     * @brief The grammar, as a text : the axiom, then a line per rule. Thread-safe.
+     */
+    inline const QByteArray &grammar() const { return m_grammar; }
+
+    /**
+     * @brief Set where to look for generations before producing them (null :
+     * nowhere). Thread-safe.
+     *
+     * Unless in lazy mode, iterate() and jump_to() load the generations
+     * stored for the grammar (see GenerationStore::load_state()) instead of
+     * producing them. Nothing is stored by the L-System itself : the
+     * renderer stores what it interpreted (see RenderJob).
+     */
+    void set_store(GenerationStorePtr store);
+
+    /**
+     * @brief Thread-safe accessor for the store of the generations.
+     */
+    GenerationStorePtr store() const { QMutexLocker locker(&m_mutex); return m_store; }
+
+    /**
+     * @brief Thread-safe accessor for the length of the current state.
+     */
+    quint64 length() const { QMutexLocker locker(&m_mutex); return m_current->derivation.length(); }
+
+    /**
+     * @brief Enable or disable the lazy mode. Thread-safe.
+     *
+     * When enabled, iterate() does not materialize the new state anymore.
+     * When disabled, the next iterate() materializes all the generations
+     * which were derived lazily.
+     */
+    void set_lazy(bool lazy);
+
+    /**
+     * @brief Thread-safe accessor for the lazy mode.
+     */
+    bool lazy() const { QMutexLocker locker(&m_mutex); return m_lazy; }
+
+    /**
+     * @brief Enable or disable the packed mode. Thread-safe.
+     *
+     * The materialized state is converted by the next iterate(), within
+     * the budgets like a new generation. Without the packed mode, the
+     * generations over the memory budget are still packed if they then fit
+     * in it : when disabling, the state is unpacked if it fits in memory,
+     * kept packed if it fits packed only, unpacked out of core if it fits
+     * on disk, and kept packed if it fits nowhere. Packed states are always
+     * rewritten on a single thread.
+     */
+    void set_packed(bool packed);
+
+    /**
+     * @brief Thread-safe accessor for the packed mode.
+     */
+    bool packed() const { QMutexLocker locker(&m_mutex); return m_pack; }
+
+    /**
+     * @brief Set the number of threads iterate() can use. Thread-safe.
+     *
+     * With more than one thread, the states longer than parallel_threshold
+     * are rewritten in parallel, on the global TaskScheduler : the threads
+     * are those of its workers, shared with the renderer.
+     * @param count The number of threads (0 : one per worker).
+     */
+    void set_thread_count(int count);
+
+    /**
+     * @brief Thread-safe accessor for the number of threads iterate() can use.
+     */
+    int thread_count() const;
+
+    /**
+     * @brief Set the memory budget of the generation cache, in bytes. Thread-safe.
+     */
+    void set_cache_budget(quint64 budget);
+
+    /**
+     * @brief Thread-safe accessor for the memory budget of the generation cache.
+     */
+    quint64 cache_budget() const { QMutexLocker locker(&m_mutex); return m_cache.budget(); }
+
+    /**
+     * @brief Whether the given generation is cached, i.e. whether jump_to()
+     * it is immediate. Thread-safe.
+     */
+    bool is_cached(uint generation) const;
+
+    /**
+     * @brief Symbol counts of the given generation, predicted from the
+     * grammar without iterating (saturated at 2^64-1). Thread-safe.
+     */
+    SymbolCounts predicted_counts(uint generation) const { return m_growth.counts(generation); }
+
+    /**
+     * @brief Length of the given generation, predicted from the grammar
+     * without iterating (saturated at 2^64-1). Thread-safe.
+     */
+    quint64 predicted_length(uint generation) const { return m_growth.length(generation); }
+
+    /**
+     * @brief Memory needed to materialize the given generation, packed in
+     * packed mode or where it is predicted to be packed (see
+     * predicted_storage()), in bytes (saturated at 2^64-1). Thread-safe.
+     */
+    quint64 predicted_memory(uint generation) const;
+
+    /**
+     * @brief Where iterate() would store the given generation, from the
+     * current modes and budgets. Thread-safe.
+     */
+    Storage predicted_storage(uint generation) const;
+
+    /**
+     * @brief Set the memory budget of a materialized state, in bytes. Thread-safe.
+     *
+     * iterate() packs the generations exceeding it, if they then fit in it,
+     * and materializes them out of core otherwise, if they fit in the disk
+     * budget ; the others are derived lazily, whatever the lazy mode : they
+     * are then streamed rather than stored.
+     */
+    void set_memory_budget(quint64 budget);
+
+    /**
+     * @brief Thread-safe accessor for the memory budget of a materialized state.
+     */
+    quint64 memory_budget() const { QMutexLocker locker(&m_mutex); return m_memory_budget; }
+
+    /**
+     * @brief Default memory budget of a materialized state, in bytes.
+     */
+    static const quint64 default_memory_budget;
+
+    /**
+     * @brief Set the disk budget of a state materialized out of core, in
+     * bytes (0 : never out of core). Thread-safe.
+     *
+     * Out-of-core states are plain : in packed mode, the generations
+     * exceeding the memory budget are derived lazily.
+     */
+    void set_disk_budget(quint64 budget);
+
+    /**
+     * @brief Thread-safe accessor for the disk budget of a state
+     * materialized out of core.
+     */
+    quint64 disk_budget() const { QMutexLocker locker(&m_mutex); return m_disk_budget; }
+
+    /**
+     * @brief Default disk budget of a state materialized out of core, in bytes.
+     */
+    static const quint64 default_disk_budget;
+
+    /**
+     * @brief Minimal length of a state for iterate() to rewrite it in parallel.
+     */
+    static const State::size_type parallel_threshold;
 
     /**
      * @brief Return the given string as a State.
@@ -79,21 +334,157 @@ public:
 
 signals:
     /**
-     * @brief When iterating (see iterate()), fired whenever a progress is made.
-     * @param percentage The percentage of the work done (< 100%).
+     * @brief When iterating (see iterate()), fired whenever a progress is made,
+     * at most every few tenths of second.
+     * @param percentage The percentage of the work done (< 100%), predicted
+     * from the lengths of all the generations to materialize.
      */
     void iteration_progressed(unsigned int percentage);
 
+    /**
+     * @brief When iterating, fired as soon as the next generation can be
+     * walked (see latest_snapshot()), before it is materialized.
+     */
+    void iteration_derived();
+
     /**
      * @brief Called when an iteration work is finished.
      */
     void iteration_finished();
 
+    /**
+     * @brief Called when an iteration work was cancelled (see cancel()).
+     */
+    void iteration_cancelled();
+
 private:
+    /**
+     * @brief Produce the generation following current, and cache it.
+     * @param requested Whether it is the generation requested rather than
+     * one on the way to it : it can then be walked while being produced
+     * (see latest_snapshot()).
+     * @return The new generation, or null if cancelled.
+     */
+    GenerationSnapshotPtr advance(const GenerationSnapshotPtr &current, bool requested);
+
+    /**
+     * @brief Make next the current generation.
+     */
+    void publish(const GenerationSnapshotPtr &next);
+
+    /**
+     * @brief The snapshot of the given generation from store, if stored
+     * with its predicted length.
+     */
+    GenerationSnapshotPtr load_stored(const GenerationStorePtr &store, uint generation) const;
+
+    /**
+     * @brief Memory needed to materialize the given generation, plain or
+     * packed, in bytes.
+     */
+    quint64 materialized_memory(uint generation, bool pack) const;
+
+    /**
+     * @brief Where to store the given generation, with the given modes and
+     * budgets, if it is materialized.
+     */
+    Storage storage(uint generation, bool pack, quint64 budget, quint64 disk_budget) const;
+
+    /**
+     * @brief Replace the given materialized state (plain, or mapped if set)
+     * by its packing, in memory.
+     */
+    void pack_state(QSharedPointer<const State> &state,
+                    QSharedPointer<const MappedState> &mapped,
+                    QSharedPointer<const PackedState> &packed) const;
+
+    /**
+     * @brief Replace the given packed state by its unpacking, in memory
+     * (InMemory) or out of core (OnDisk).
+     * @return False if the disk is full, the state being then left packed.
+     */
+    bool unpack_state(QSharedPointer<const State> &state,
+                      QSharedPointer<const MappedState> &mapped,
+                      QSharedPointer<const PackedState> &packed, Storage target) const;
+
+    /**
+     * @brief Replace the given materialized state (plain, mapped if set, or
+     * packed if set) of the given generation by its rewriting, whose length
+     * is predicted.
+     * @param file If set, allocated for the rewriting of a plain state,
+     * which is then out of core ; otherwise it is in memory.
+     * @return False if cancelled, or if the length of the state is not the
+     * predicted one, the state being then left unchanged.
+     */
+    bool rewrite(QSharedPointer<const State> &state,
+                 QSharedPointer<const MappedState> &mapped,
+                 QSharedPointer<const PackedState> &packed, uint generation,
+                 QSharedPointer<MappedState> file);
+
+    /**
+     * @brief Rewrite a packed state.
+     * @return The new state, or nullptr if cancelled.
+     */
+    PackedState *rewrite_packed(const PackedState &state);
+
+    /**
+     * @brief Rewrite the length symbols at state into out, on the calling
+     * thread, chunk by chunk : out is written sequentially.
+     * @param out Allocated beforehand, with the predicted length : there is
+     * no counting pass.
+     * @return False if cancelled.
+     */
+    bool iterate_serial(const char *state, quint64 length, char *out);
+
+    /**
+     * @brief Rewrite the length symbols at state into out on the scheduler,
+     * with up to threads threads.
+     *
+     * The state is split into chunks whose expanded lengths are computed
+     * concurrently ; a prefix sum of these lengths then gives the offset
+     * of each chunk in out, in which all the chunks are expanded
+     * concurrently.
+     * @param out_length The length allocated at out.
+     * @return False if cancelled, or if the new state would not be
+     * out_length long.
+     */
+    bool iterate_parallel(const char *state, quint64 length, char *out, quint64 out_length,
+                          int threads);
+
+    /**
+     * @brief Whether cancel() was called during the current iteration.
+     */
+    inline bool cancelled() const { return m_cancel_requested.load() != 0; }
+
+    /**
+     * @brief Fire iteration_progressed(), unless done too recently, done
+     * symbols of the current rewrite being rewritten. Can be called from
+     * any thread.
+     */
+    void report_progress(quint64 done);
+
     mutable QMutex m_mutex;
-    State m_state;
     RulesDict m_rules;
-    uint m_N;
+    QByteArray m_grammar; //!< see grammar(), immutable
+    ProductionTable m_productions; //!< m_rules, compiled
+    GrowthMatrix m_growth; //!< from the axiom, immutable
+    quint64 m_memory_budget;
+    quint64 m_disk_budget;
+    bool m_lazy;
+    bool m_pack; //!< requested packed mode, applied by iterate()
+    GenerationSnapshotPtr m_current; //!< current generation
+    GenerationSnapshotPtr m_derived; //!< generation being produced, derived lazily
+    GenerationSnapshotPtr m_axiom; //!< generation 0, never evicted
+    GenerationCache m_cache;
+    GenerationStorePtr m_store;
+    TaskScheduler &m_scheduler; //!< used by iterate_parallel()
+    int m_thread_count; //!< at most, working on iterate_parallel()
+
+    QAtomicInt m_cancel_requested;
+    QElapsedTimer m_progressTimer;
+    QAtomicInt m_last_progress; //!< when progress was last reported, in ms
+    quint64 m_progress_base; //!< symbols rewritten by the previous rewrites of advance()
+    quint64 m_progress_total; //!< symbols to rewrite by advance(), predicted
 };
 
 #endif /* LSYSTEM_H */
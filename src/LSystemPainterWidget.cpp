@@ -3,15 +3,20 @@
 #include <QWidget>
 #include <QPainter>
 #include <QtDebug>
+#include <QWheelEvent>
+#include <QMouseEvent>
+#include <QtMath>
 
 QBrush background_brush = QBrush(QColor(255, 255, 240)); // ivory color
 QPen text_pen = QPen(Qt::black);
 QPen path_pen = QPen(Qt::black);
+const qreal wheel_zoom_factor = 1.25; // per wheel step
 
 LSystemPainterWidget::LSystemPainterWidget(LSystemPtr lsystem, QWidget *parent):
-    LSystemRendererWidgetBase(lsystem, parent), m_pixmapSize()
+    LSystemRendererWidgetBase(lsystem, parent), m_imageSize(), m_zoom(1), m_pan()
 {
-
+    m_pen = path_pen;
+    m_background = background_brush.color();
 }
 
 LSystemPainterWidget::~LSystemPainterWidget()
@@ -26,7 +31,7 @@ void LSystemPainterWidget::paintEvent(QPaintEvent *)
     painter.fillRect(rect(), Qt::white);
 
     // before first draw : print waiting message
-    if (m_pixmap.isNull())
+    if (m_image.isNull())
     {
         painter.setPen(text_pen);
         painter.drawText(rect(), Qt::AlignCenter,
@@ -34,108 +39,93 @@ void LSystemPainterWidget::paintEvent(QPaintEvent *)
         return;
     }
 
-    // properly center the pixmap
+    // properly center the image
     painter.save();
-    //painter.translate(width() / 2 - m_pixmap.width() / 2, 0);
+    //painter.translate(width() / 2 - m_image.width() / 2, 0);
 
     // enable antialiasing
     painter.setRenderHint(QPainter::Antialiasing, true);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, true);
 
-    painter.drawPixmap(rect(), m_pixmap, m_pixmap.rect());
+    // until it is rendered again, the image is moved to the current view
+    painter.setTransform(m_imageView.inverted() * view());
+    painter.drawImage(rect(), m_image, m_image.rect());
 
     painter.restore();
 }
 
 void LSystemPainterWidget::resizeEvent(QResizeEvent *event)
 {
-    return QWidget::resizeEvent(event);
+    QWidget::resizeEvent(event);
+    if (!m_image.isNull())
+        render_lSystem();
 }
 
-/**
- * @brief Debug tool. Make the given painter draw the coordinates system.
- */
-void drawCoordinates(const QRect &rect, QPainter &painter)
+void LSystemPainterWidget::wheelEvent(QWheelEvent *event)
 {
-    painter.setPen(Qt::red);
-
-    painter.drawLine(0, 0, rect.width() / 2, 0);
-    painter.drawText(60 - rect.width() / 2,
-                     0 + rect.height() / 2, "x");
-
-    painter.drawLine(0, 0, 0, rect.height() / 2);
-    painter.drawText(0 - rect.width() / 2,
-                     60 + rect.height() / 2, "y");
+    // zoom around the cursor
+    const qreal factor = qPow(wheel_zoom_factor, event->angleDelta().y() / 120.);
+    const QPointF cursor = event->pos();
+    m_pan = cursor - (cursor - m_pan) * factor;
+    m_zoom *= factor;
+    update();
+    render_lSystem();
 }
 
-void LSystemPainterWidget::post_turtle_drawing()
+void LSystemPainterWidget::mousePressEvent(QMouseEvent *event)
 {
-    qDebug() << "post_turtle_drawing : pixmapOffset =" << m_pixmapOffset;
-
-
-    // create a painter to the pixmap and draw the background
-    QPainter painter(&m_pixmap);
-    painter.fillRect(m_pixmap.rect(), background_brush);
-
-    // enable antialiasing
-    painter.setRenderHint(QPainter::Antialiasing, true);
-
-    QTransform transform;
-    // we want to use the cartesian system
-    // which means the Y-axis must be flipped
-    // and we must also set up the correct scale
-    painter.save();
-    const float fwd = LSystemRendererWidgetBase::compute_drawing_distance();
-    const float scale_factor = fwd / default_forward_distance;
-    transform.scale(scale_factor, -scale_factor);
-    //m.translate(0, -m_pixmap.height());
-    transform.translate(-m_pixmapOffset.x(), -m_pixmapOffset.y());
-    painter.setWorldTransform(transform, false);
-
-    // do the actual rendering
-    // i.e. draw all the paths to our pixmap
-    painter.setBrush(background_brush);
-
-    painter.setPen(path_pen);
-    painter.drawPath(m_pixmapPainterPath);
-
-    // memorize the scale of the rendered pixmap
-    // the simplest way to do so is to save its size
-    m_pixmapSize = m_pixmap.size();
-
-    // debug : draw the coordinates system
-    drawCoordinates(m_pixmap.rect(), painter);
-
-    painter.restore();
-
+    if (event->button() == Qt::LeftButton)
+        m_lastDragPos = event->pos();
+}
 
-    // mark the whole widget as 'dirty' (to be completely redrawn)
+void LSystemPainterWidget::mouseMoveEvent(QMouseEvent *event)
+{
+    if (!(event->buttons() & Qt::LeftButton))
+        return;
+    m_pan += event->pos() - m_lastDragPos;
+    m_lastDragPos = event->pos();
     update();
+    render_lSystem();
 }
 
-void LSystemPainterWidget::post_boundaries_computing()
+void LSystemPainterWidget::mouseReleaseEvent(QMouseEvent *event)
 {
-    LSystemRendererWidgetBase::post_boundaries_computing();
-
-    // set up and launch the rendering to the pixmap
-    m_drawing = true;
-    m_pixmapPainterPath = QPainterPath(m_turtle.pos);
-    m_pixmap = QPixmap(size());
-    m_pixmapOffset = m_boundaries.bottomLeft();
-    emit start_processing();
+    if (event->button() == Qt::LeftButton)
+        render_lSystem();
 }
 
-void LSystemPainterWidget::turtle_pop()
+void LSystemPainterWidget::mouseDoubleClickEvent(QMouseEvent *)
 {
-    LSystemRendererWidgetBase::turtle_pop();
-    m_pixmapPainterPath.moveTo(m_turtle.pos);
+    m_zoom = 1;
+    m_pan = QPointF();
+    update();
+    render_lSystem();
 }
 
-void LSystemPainterWidget::turtle_forward(float distance)
+QTransform LSystemPainterWidget::view() const
 {
-    // make our virtual turtle move
-    m_turtle.forward(distance);
+    return QTransform(m_zoom, 0, 0, m_zoom, m_pan.x(), m_pan.y());
+}
 
-    // draw the movement we just did as a line
-    m_pixmapPainterPath.lineTo(m_turtle.pos);
+void LSystemPainterWidget::render_finished(const RenderJob &job)
+{
+    // show the image rendered by the job
+    m_image = job.output().image;
+    m_imageView = job.input().view;
+
+    // memorize the scale of the rendered image
+    // the simplest way to do so is to save its size
+    m_imageSize = m_image.size();
+
+    // mark the whole widget as 'dirty' (to be completely redrawn)
+    update();
 }
 
+void LSystemPainterWidget::render_partial(const RenderJob &job, const QImage &image)
+{
+    // show the drawing so far, until the job is done
+    m_image = image;
+    m_imageView = job.input().view;
+    m_imageSize = m_image.size();
+    update();
+}
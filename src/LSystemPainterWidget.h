@@ -3,23 +3,31 @@
 
 #include "LSystemRendererWidgetBase.h"
 
-#include <QPixmap>
-#include <QPainterPath>
+#include <QImage>
 
 class QPaintEvent;
 class QResizeEvent;
+class QWheelEvent;
+class QMouseEvent;
 
 /**
  * @brief This widget renders L-Systems using Qt's QPainter graphics system.
  *
  * Following the Qt Mandelbrot example, it does all its rendering into a cache
- * texture (a QPixmap) wich allows this widget to be responsive.
+ * texture (a QImage) wich allows this widget to be responsive.
  *
- * For instance when resizing this widget the scaled pixmap
+ * For instance when resizing this widget the scaled image
  * will be displayed until a new one is rendered.
  *
- * Internally, uses QPainterPath to draw all the lines in one call (downside :
- * no color possible...).
+ * The rendering is done by a RenderJob, the main thread only showing its
+ * image (downside : no color possible...).
+ *
+ * While a new generation is interpreted, the partial images of the job are
+ * shown, so that the drawing is seen growing.
+ *
+ * The view can be zoomed (mouse wheel) and panned (drag), and reset with a
+ * double click. Meanwhile, the last image is shown transformed, until the
+ * visible part of the geometry is rendered again.
  */
 class LSystemPainterWidget : public LSystemRendererWidgetBase
 {
@@ -30,25 +38,24 @@ public:
 protected:
     void paintEvent(QPaintEvent *) Q_DECL_OVERRIDE;
     void resizeEvent(QResizeEvent *event) Q_DECL_OVERRIDE;
+    void wheelEvent(QWheelEvent *event) Q_DECL_OVERRIDE;
+    void mousePressEvent(QMouseEvent *event) Q_DECL_OVERRIDE;
+    void mouseMoveEvent(QMouseEvent *event) Q_DECL_OVERRIDE;
+    void mouseReleaseEvent(QMouseEvent *event) Q_DECL_OVERRIDE;
+    void mouseDoubleClickEvent(QMouseEvent *event) Q_DECL_OVERRIDE;
 
-    void post_turtle_drawing() Q_DECL_OVERRIDE;
-    void post_boundaries_computing() Q_DECL_OVERRIDE;
-
-    void turtle_pop() Q_DECL_OVERRIDE;
+    void render_finished(const RenderJob &job) Q_DECL_OVERRIDE;
+    void render_partial(const RenderJob &job, const QImage &image) Q_DECL_OVERRIDE;
+    QTransform view() const Q_DECL_OVERRIDE;
 
 private:
-   /**
-    * @brief Overrides LSystemRendererWidgetBase::turtle_forward to draw the
-    * required lines.
-    * @param distance Forward distance to be drawn from the VirtualTurtle's
-    * current position.
-    */
-   virtual void turtle_forward(float distance) Q_DECL_OVERRIDE;
-
-    QPixmap m_pixmap;       //!< offscreen paint device acting as a rendering cache
-    QPointF m_pixmapOffset; //!< origin offset used in the rendering of the pixmap
-    QPainterPath m_pixmapPainterPath;
-    QSize m_pixmapSize;   //!< size of the rendered pixmap
+    QImage m_image;       //!< offscreen paint device acting as a rendering cache
+    QSize m_imageSize;   //!< size of the rendered image
+    QTransform m_imageView; //!< view of the rendered image
+
+    qreal m_zoom;         //!< scale of the view, 1 showing the whole geometry
+    QPointF m_pan;        //!< translation of the view, in pixels
+    QPoint m_lastDragPos;
 };
 
 #endif /* LSYSTEMPAINTERWIDGET_H */
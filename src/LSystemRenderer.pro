@@ -17,12 +17,53 @@ SOURCES += main.cpp\
         MainWindow.cpp \
     LSystem.cpp \
     LSystemRendererWidgetBase.cpp \
-    LSystemPainterWidget.cpp
+    LSystemPainterWidget.cpp \
+    ProductionTable.cpp \
+    DerivationTree.cpp \
+    PackedState.cpp \
+    MappedState.cpp \
+    GenerationCache.cpp \
+    GenerationStore.cpp \
+    TurtleInterpreter.cpp \
+    SegmentBuffer.cpp \
+    ParallelTurtleInterpreter.cpp \
+    GeometryPainter.cpp \
+    TileRasterizer.cpp \
+    SegmentGrid.cpp \
+    TurtleExtents.cpp \
+    LodTurtleInterpreter.cpp \
+    GeometryMemo.cpp \
+    GrowthMatrix.cpp \
+    RewriteKernel.cpp \
+    TurtleArena.cpp \
+    RenderJob.cpp \
+    TaskScheduler.cpp
 
 HEADERS  += MainWindow.h \
     LSystem.h \
     LSystemRendererWidgetBase.h \
     VirtualTurtle.h \
-    LSystemPainterWidget.h
+    LSystemPainterWidget.h \
+    ProductionTable.h \
+    Parallel.h \
+    DerivationTree.h \
+    PackedState.h \
+    MappedState.h \
+    GenerationCache.h \
+    GenerationStore.h \
+    TurtleInterpreter.h \
+    SegmentBuffer.h \
+    ParallelTurtleInterpreter.h \
+    GeometryPainter.h \
+    TileRasterizer.h \
+    SegmentGrid.h \
+    TurtleExtents.h \
+    LodTurtleInterpreter.h \
+    GeometryMemo.h \
+    GrowthMatrix.h \
+    RewriteKernel.h \
+    TurtleArena.h \
+    RenderJob.h \
+    TaskScheduler.h
 
 FORMS    += mainwindow.ui
@@ -2,40 +2,12 @@
 #define LSYSTEMRENDERERWIDGETBASE_H
 
 #include <QWidget>
-#include <QThread>
-#include <QElapsedTimer>
-#include <QStack>
+#include <QPen>
 
-#include "VirtualTurtle.h"
+#include "RenderJob.h"
+#include "TurtleArena.h"
 
 class LSystem;
-class LSystemRendererWidgetBase;
-
-/**
- * @brief Interpreter for the L-System state.
- *
- * Allows LSystemRendererWidgetBase::process_lsystem to be non-blocking.
- */
-class LSystemProcessor : public QObject
-{
-    Q_OBJECT
-
-public:
-    explicit LSystemProcessor(LSystemRendererWidgetBase &master,
-                              QObject *parent = 0);
-    ~LSystemProcessor() {}
-
-public slots:
-    void process();
-
-signals:
-    void progressed(uint progress);
-    void finished();
-    void error(const QString &error);
-
-protected:
-    LSystemRendererWidgetBase &m_master;
-};
 
 /**
  * @brief A shared pointer to an L-System.
@@ -46,12 +18,17 @@ typedef QSharedPointer<LSystem> LSystemPtr;
  * @brief The LSystemRendererWidgetBase is the base widget for any
  * L-System visualization widget.
  *
- * No actual rendering is done by this virtual class.
+ * The rendering is done by a RenderJob on the global TaskScheduler, from
+ * the latest snapshot of the L-System : the widget only shows the results,
+ * handed back in the main thread (see render_finished()). The geometry of
+ * the last generation rendered is kept, so that rendering it again (e.g.
+ * for another view) does not interpret the state anymore ; the storage of
+ * the turtle is kept too, for the next generations (see TurtleArena).
+ * While a new generation is interpreted, partial images are handed out at
+ * a bounded rate (see render_partial()).
  */
 class LSystemRendererWidgetBase : public QWidget
 {
-    friend class LSystemProcessor;
-
     Q_OBJECT
 
 public:
@@ -66,7 +43,10 @@ public:
 public slots:
     /**
      * @brief Call whenever the L-System needs to be (re)drawn, e.g. when
-     * it has just been iterated.
+     * it has just been iterated, or when the view changed.
+     *
+     * If a rendering is already running, it is done again once it is
+     * finished. Nothing is done if the last rendering is still up to date.
      */
     void render_lSystem();
 
@@ -83,113 +63,67 @@ signals:
      */
     void progress_changed(uint percentage);
 
-    /**
-     * @brief Order the LSystemProcessor to start working.
-     */
-    void start_processing();
-
 protected:
     /**
-     * @brief Deduce from the bounding box found in the virtual drawing step
-     * and from the widget size the forward drawing distance to use to fit all
-     * the drawing inside the widget.
+     * @brief Pure virtual function called in the main thread once job
+     * successfully rendered the L-System : this is where its image should
+     * be shown.
      */
-    float compute_drawing_distance();
+    virtual void render_finished(const RenderJob &job) = 0;
 
     /**
-     * @brief Pure virtual function called after the rendering processing
-     * step is done.
+     * @brief Virtual function called in the main thread when job drew a
+     * partial image of the L-System, while still interpreting it : this is
+     * where it can be shown until render_finished().
+     * Default behavior : nothing.
      */
-    virtual void post_turtle_drawing() = 0;
+    virtual void render_partial(const RenderJob &job, const QImage &image)
+    {
+        Q_UNUSED(job);
+        Q_UNUSED(image);
+    }
 
     /**
-     * @brief Virtual function called after the bounding fox was found
-     * in the virtual drawing step, or directly in render_lSystem() if this step
-     * did not need to be redone.
-     * This is where the actual drawing should be started.
-     *
-     * Default behavior : resets the VirtualTurtle and the processing timer,
-     * and updates the generation processed counter (see m_generation_processed).
-     *
-     * N.B. : overriding function should not do heavy computation in the main
-     * thread to not freeze the GUI.
-     */
-    virtual void post_boundaries_computing();
-
-    /**
-     * @brief Make the turtle go forward
-     * Virtual function that must be implemented by the child classes in order
-     * to do any drawing.
-     * Default behavior : make the turtle go forward by distance.
-     *
-     * N.B. : this function is called by LSystemProcessor during its work.
-     *
-     * @param distance Forward distance to be drawn from the VirtualTurtle's
-     * current position.
+     * @brief Virtual function giving the current view of the widget (zoom
+     * and pan), applied after fitting the geometry to the widget.
+     * Default behavior : the identity, i.e. the whole geometry.
      */
-    virtual void turtle_forward(float distance);
+    virtual QTransform view() const { return QTransform(); }
 
     /**
-     * @brief Push the turtle's state to the turtle states stack.
-     */
-    virtual void turtle_push();
-
-    /**
-     * @brief Restore from the stack the state of the VirtualTurtle.
-     *
-     * It is assumed here that m_turtle_stack is not empty.
+     * @brief Whether a rendering is running.
      */
-    virtual void turtle_pop();
+    inline bool is_rendering() const { return m_job != nullptr; }
 
-    QRectF m_boundaries;
-    VirtualTurtle m_turtle;
-    static const float default_forward_distance; //!< used for computing boundaries
-    float m_forward_distance;
-    QPointF m_origin_offset;
-
-    bool m_drawing; // if false and processing : currently computing boundaries
+    float m_rotation_angle;
+    QPen m_pen;          //!< pen of the segments
+    QColor m_background; //!< color of the background
 
 private slots:
     /**
-     * @brief Called by LSystemProcessor to update its progress.
-     * @param progress In percentage, from 0 to 100. At 100 : the processor finished.
+     * @brief Called when the running job made a progress.
      */
-    void processor_progressed(uint progress);
+    void job_progressed(uint progress);
 
     /**
-     * @brief Called by LSystemProcessor when it finished processing the LSystem.
+     * @brief Called when the running job drew a partial image.
      */
-    void processor_finished();
+    void job_frame_ready(const QImage &image);
 
     /**
-     * @brief Called by LSystemProcessor when it encountered an error.
+     * @brief Called when the running job is finished.
      */
-    void processor_error(const QString &error);
+    void job_finished();
 
 private:
-    /**
-     * @brief Translate the L-System's state into a series of commands for
-     * the VirtualTurtle and execute them.
-     *
-     */
-    void process_lsystem();
-
-    void turtle_reset();
-
     QSharedPointer<LSystem> m_lsystem;
-    QString m_emptyState;
+    RenderJob *m_job; //!< running job, or nullptr
+    bool m_render_again; //!< whether to render again once m_job is finished
+    TurtleArena m_arena; //!< of the turtle of the jobs, one at a time
 
-    QThread m_processingThread;
-    QElapsedTimer m_processingTimer;
-    LSystemProcessor *m_processor;
-    float m_rotation_angle;
-    QStack<TurtleState> m_turtle_stack;
-    /**
-     * @brief Last processed generation (-1 if none).
-     * Does not reflect the rendering part of the processing but only
-     * the virtual draw step.
-     */
-    int m_generation_processed;
+    RenderInput m_rendered; //!< input of the last job done, and of m_geometry
+    QSharedPointer<const TurtleGeometry> m_geometry; //!< last geometry built
+    QSharedPointer<const SegmentGrid> m_grid; //!< index of m_geometry, if built
 };
 
 #endif /* LSYSTEMRENDERERWIDGETBASE_H */
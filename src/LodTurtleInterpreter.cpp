@@ -0,0 +1,55 @@
+#include "LodTurtleInterpreter.h"
+
+#include "TurtleExtents.h"
+#include <cmath>
+
+const qreal LodTurtleInterpreter::default_pixel_threshold = 1;
+const qreal lod_rescale_ratio = 1.5; // interpret again if the actual scale is larger
+
+LodTurtleInterpreter::LodTurtleInterpreter(float angle) :
+    m_angle(angle), m_pixel_threshold(default_pixel_threshold)
+{
+
+}
+
+bool LodTurtleInterpreter::interpret(const DerivationTree &derivation, const QSizeF &target,
+                                     TurtleGeometry &geometry)
+{
+    const TurtleExtents extents(derivation.productions(), derivation.depth());
+    const qreal radius = extents.state_extent(derivation);
+    if (m_pixel_threshold <= 0 || !extents.is_bounded() || !std::isfinite(radius) || radius <= 0)
+        return interpret(derivation, extents, 0, geometry);
+
+    // the drawing is within radius of the origin : lower bound of the scale
+    const qreal scale = qMin(target.width(), target.height()) / (2 * radius);
+    if (!interpret(derivation, extents, m_pixel_threshold / scale, geometry))
+        return false;
+
+    const qreal actual = geometry.fit_scale(target);
+    if (actual > lod_rescale_ratio * scale)
+        return interpret(derivation, extents, m_pixel_threshold / actual, geometry);
+    return true;
+}
+
+bool LodTurtleInterpreter::interpret(const DerivationTree &derivation,
+                                     const TurtleExtents &extents, qreal min_length,
+                                     TurtleGeometry &geometry)
+{
+    geometry.clear();
+    TurtleInterpreter interpreter(m_angle, geometry);
+    interpreter.set_min_length(min_length);
+    auto interpret = [&](char symbol) { return interpreter.interpret(symbol); };
+    auto prune = [&](const char *open, const char *end, uint generations) -> const char *
+    {
+        const char *close;
+        const qreal extent = extents.branch_extent(open, end, generations, close);
+        return (extent < min_length) ? close : nullptr;
+    };
+
+    const bool valid = (min_length > 0) ? derivation.walk(interpret, prune)
+                                        : derivation.walk(interpret);
+    if (!valid)
+        return false;
+    interpreter.finish();
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef LODTURTLEINTERPRETER_H
+#define LODTURTLEINTERPRETER_H
+
+#include <QSizeF>
+
+#include "DerivationTree.h"
+#include "TurtleInterpreter.h"
+
+class TurtleExtents;
+
+/**
+ * @brief LodTurtleInterpreter builds the TurtleGeometry of a state at the
+ * level of detail of a target size, like TurtleInterpreter otherwise.
+ *
+ * Details smaller than the pixel threshold are dropped :
+ * - the branches ('[' ... ']') whose extent is below the threshold are
+ * pruned from the derivation tree without being walked, their extent being
+ * bounded from the grammar by TurtleExtents,
+ * - consecutive moves are collapsed into one segment until they span the
+ * threshold (see TurtleInterpreter::set_min_length()).
+ * The work is thus about proportional to the number of pixels rather than
+ * to the length of the state.
+ *
+ * The scale being only known once the bounding box is, a first pass uses
+ * the scale given by the extent of the whole state, which is a lower bound ;
+ * the state is interpreted again at the actual scale if it is much larger.
+ * Pruned branches may extend the bounding box by less than the threshold.
+ */
+class LodTurtleInterpreter
+{
+public:
+    static const qreal default_pixel_threshold; //!< in pixels
+
+    /**
+     * @brief Constructor.
+     * @param angle The rotation angle, in degrees.
+     */
+    explicit LodTurtleInterpreter(float angle);
+
+    inline void set_pixel_threshold(qreal pixels) { m_pixel_threshold = pixels; }
+
+    /**
+     * @brief Interpret the state derived by derivation into geometry, for a
+     * target of the given size (in pixels).
+     * @return False if a ']' pops an empty stack, geometry being then left
+     * unspecified.
+     */
+    bool interpret(const DerivationTree &derivation, const QSizeF &target,
+                   TurtleGeometry &geometry);
+
+private:
+    /**
+     * @brief Interpret derivation into geometry, dropping the details
+     * smaller than the given length (in units).
+     */
+    bool interpret(const DerivationTree &derivation, const TurtleExtents &extents,
+                   qreal min_length, TurtleGeometry &geometry);
+
+    float m_angle;
+    qreal m_pixel_threshold;
+};
+
+#endif /* LODTURTLEINTERPRETER_H */
@@ -3,13 +3,31 @@
 
 #include <QDebug>
 #include <QCloseEvent>
+#include <QLabel>
 #include <QProgressBar>
 #include <QVBoxLayout>
+#include <QStandardPaths>
 #include "LSystem.h"
 #include "LSystemPainterWidget.h"
 
+namespace
+{
+    /**
+     * @brief Format a number of bytes for the user, e.g. "1.5 GB".
+     */
+    QString format_bytes(quint64 bytes)
+    {
+        const char *units[] = { "B", "KB", "MB", "GB", "TB", "PB", "EB" };
+        int unit = 0;
+        double value = static_cast<double>(bytes);
+        for (; value >= 1024 && unit < 6; ++unit)
+            value /= 1024;
+        return QString("%1 %2").arg(value, 0, 'f', unit > 0 ? 1 : 0).arg(units[unit]);
+    }
+}
+
 MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWindow),
-    m_iterationThread(), m_iterationTimer(), m_iterating(false)
+    m_iteration(TaskScheduler::global_instance()), m_iterationTimer(), m_iterating(false)
 {
     ui->setupUi(this);
 
@@ -17,15 +35,20 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
     RulesDict rules;
     rules['F'] = "F[+F]F[-F][F]";
     m_lsystem = LSystemPtr(new LSystem("F", rules));
-    m_lsystem->moveToThread(&m_iterationThread);
 
-    connect(this, &MainWindow::start_iteration,
-            &*m_lsystem, &LSystem::iterate);
+    // the long generations rendered are kept from one run to the next
+    const QString cache = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (!cache.isEmpty())
+        m_lsystem->set_store(GenerationStorePtr(new GenerationStore(cache)));
+
+    // the L-System iterates on the workers of the global scheduler, and
+    // signals the main thread
     connect(&*m_lsystem, &LSystem::iteration_finished,
             this, &MainWindow::iteration_finished);
+    connect(&*m_lsystem, &LSystem::iteration_cancelled,
+            this, &MainWindow::iteration_cancelled);
     connect(&*m_lsystem, &LSystem::iteration_progressed,
             this, &MainWindow::update_progress);
-    m_iterationThread.start();
 
     // set up the renderer
     QVBoxLayout *centralLayout = new QVBoxLayout();
@@ -38,6 +61,11 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
     connect(m_rendererWidget, &LSystemRendererWidgetBase::progress_changed,
             this, &MainWindow::update_progress);
 
+    // render the next generation as soon as it can be walked : it is
+    // interpreted while the L-System is still expanding it
+    connect(&*m_lsystem, &LSystem::iteration_derived,
+            m_rendererWidget, &LSystemRendererWidgetBase::render_lSystem);
+
     // create the progress bar in the status bar
     m_progressBar = new QProgressBar(ui->statusBar);
     m_progressBar->setMaximumSize(180, 20);
@@ -45,6 +73,11 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
     m_progressBar->setMinimum(0);
     m_progressBar->setMaximum(100);
     ui->statusBar->addPermanentWidget(m_progressBar);
+
+    // and the prediction for the next generation, on its left
+    m_predictionLabel = new QLabel(ui->statusBar);
+    ui->statusBar->insertPermanentWidget(0, m_predictionLabel);
+    update_prediction();
 }
 
 MainWindow::~MainWindow()
@@ -52,8 +85,7 @@ MainWindow::~MainWindow()
     delete ui;
     delete m_rendererWidget;
 
-    m_iterationThread.quit();
-    m_iterationThread.wait();
+    m_iteration.wait();
 
     m_lsystem.clear();
 }
@@ -75,14 +107,18 @@ void MainWindow::renderer_status_update(const QString &status)
 
 void MainWindow::closeEvent(QCloseEvent *event)
 {
-    // in case we are currently iterating
-    //!! @todo Immediatly stop the iteration work
+    // in case we are currently iterating : stop the iteration work first
     if (m_iterating)
     {
-        qDebug() << "Iterating, cannot close now...";
+        qDebug() << "Iterating, stopping the iteration before closing...";
+        // once, however many times the user tries to close
         connect(&*m_lsystem, &LSystem::iteration_finished,
-                this, &MainWindow::close);
+                this, &MainWindow::close, Qt::UniqueConnection);
+        connect(&*m_lsystem, &LSystem::iteration_cancelled,
+                this, &MainWindow::close, Qt::UniqueConnection);
+        m_lsystem->cancel();
         event->ignore();
+        return;
     }
     // otherwise, we can close the window
     qDebug() << "Closing MainWindow.";
@@ -93,26 +129,119 @@ void MainWindow::iteration_finished()
 {
     // Wrap up the iteration job
     qDebug() << "generation = " << m_lsystem->generation()
-             << ", state_len = " << m_lsystem->state().length();
+             << ", state_len = " << m_lsystem->length();
     QString status = tr("Iterated in %1 ms").arg(m_iterationTimer.elapsed());
     ui->statusBar->showMessage(status, 3000);
     ui->action_nextIteration->setEnabled(true);
+    ui->action_previousIteration->setEnabled(m_lsystem->generation() > 0);
     ui->action_render_LSystem->setEnabled(true);
+    ui->action_stopIteration->setEnabled(false);
     m_iterating = false;
+    update_prediction();
+
+    // e.g. a cached generation, restored without deriving anything
+    m_rendererWidget->render_lSystem();
 }
 
+void MainWindow::iteration_cancelled()
+{
+    ui->statusBar->showMessage(tr("Iteration cancelled"), 3000);
+    m_progressBar->reset();
+    ui->action_nextIteration->setEnabled(true);
+    ui->action_previousIteration->setEnabled(m_lsystem->generation() > 0);
+    ui->action_render_LSystem->setEnabled(true);
+    ui->action_stopIteration->setEnabled(false);
+    m_iterating = false;
+    update_prediction();
 
-void MainWindow::on_action_nextIteration_triggered()
+    // back to the current generation
+    m_rendererWidget->render_lSystem();
+}
+
+
+void MainWindow::iteration_started()
 {
     ui->statusBar->showMessage("Iterating...");
     ui->action_nextIteration->setEnabled(false);
+    ui->action_previousIteration->setEnabled(false);
     ui->action_render_LSystem->setEnabled(false);
+    ui->action_stopIteration->setEnabled(true);
     m_iterationTimer.start();
     m_iterating = true;
-    emit start_iteration();
+}
+
+void MainWindow::update_prediction()
+{
+    const uint next = m_lsystem->generation() + 1;
+    const quint64 memory = m_lsystem->predicted_memory(next);
+    QString prediction = tr("Next : %1 symbols").arg(m_lsystem->predicted_length(next));
+    const LSystem::Storage storage = m_lsystem->predicted_storage(next);
+    if (m_lsystem->lazy())
+        prediction += tr(" (lazy)");
+    else if (storage == LSystem::Packed && !m_lsystem->packed())
+        prediction += tr(" (%1, over budget : packed)").arg(format_bytes(memory));
+    else if (storage == LSystem::OnDisk)
+        prediction += tr(" (%1, over budget : on disk)").arg(format_bytes(memory));
+    else if (storage == LSystem::Derived)
+        prediction += tr(" (%1, over budget : lazy)").arg(format_bytes(memory));
+    else
+        prediction += tr(" (%1)").arg(format_bytes(memory));
+    m_predictionLabel->setText(prediction);
+}
+
+void MainWindow::on_action_nextIteration_triggered()
+{
+    iteration_started();
+
+    // known before any work : warn if the state will not be stored, unless
+    // cached (e.g. after going back), the iteration being then immediate
+    const uint next = m_lsystem->generation() + 1;
+    const quint64 memory = m_lsystem->predicted_memory(next);
+    const LSystem::Storage storage = m_lsystem->is_cached(next) ?
+                LSystem::InMemory : m_lsystem->predicted_storage(next);
+    if (storage == LSystem::Packed && !m_lsystem->packed())
+        ui->statusBar->showMessage(tr("Iterating... generation %1 would need %2 : "
+                                      "packed").arg(next).arg(format_bytes(memory)));
+    else if (storage == LSystem::OnDisk)
+        ui->statusBar->showMessage(tr("Iterating... generation %1 would need %2 : "
+                                      "stored on disk").arg(next).arg(format_bytes(memory)));
+    else if (!m_lsystem->lazy() && storage == LSystem::Derived)
+        ui->statusBar->showMessage(tr("Iterating... generation %1 would need %2 : "
+                                      "derived lazily").arg(next).arg(format_bytes(memory)));
+    const LSystemPtr lsystem = m_lsystem;
+    m_iteration.run([lsystem]() { lsystem->iterate(); });
+}
+
+void MainWindow::on_action_previousIteration_triggered()
+{
+    const uint generation = m_lsystem->generation();
+    if (generation == 0)
+        return;
+    // immediate if the previous generation is still cached
+    iteration_started();
+    const LSystemPtr lsystem = m_lsystem;
+    m_iteration.run([lsystem, generation]() { lsystem->jump_to(generation - 1); });
+}
+
+void MainWindow::on_action_stopIteration_triggered()
+{
+    // not queued : the L-System is busy iterating
+    m_lsystem->cancel();
 }
 
 void MainWindow::on_action_render_LSystem_triggered()
 {
     m_rendererWidget->render_lSystem();
 }
+
+void MainWindow::on_action_lazyIteration_toggled(bool checked)
+{
+    m_lsystem->set_lazy(checked);
+    update_prediction();
+}
+
+void MainWindow::on_action_packedIteration_toggled(bool checked)
+{
+    m_lsystem->set_packed(checked);
+    update_prediction();
+}
@@ -4,10 +4,12 @@
 #include <QMainWindow>
 #include <QElapsedTimer>
 #include "LSystemRendererWidgetBase.h"
+#include "TaskScheduler.h"
 
 namespace Ui {
 class MainWindow;
 }
+class QLabel;
 class QProgressBar;
 class QCloseEvent;
 
@@ -34,25 +36,38 @@ private slots:
     // UI slots
     void on_actionQuit_triggered();
     void on_action_nextIteration_triggered();
+    void on_action_previousIteration_triggered();
+    void on_action_stopIteration_triggered();
 
     // L-System and rendering slots
     void renderer_status_update(const QString &status);
     void iteration_finished(); //!< Fired when L-System finished iterating
+    void iteration_cancelled(); //!< Fired when L-System stopped iterating
 
     void on_action_render_LSystem_triggered();
-
-signals:
-    void start_iteration();
+    void on_action_lazyIteration_toggled(bool checked);
+    void on_action_packedIteration_toggled(bool checked);
 
 private:
     void closeEvent(QCloseEvent *event);
 
+    /**
+     * @brief Update the UI before an iteration work starts.
+     */
+    void iteration_started();
+
+    /**
+     * @brief Show the length and memory predicted for the next generation.
+     */
+    void update_prediction();
+
     Ui::MainWindow *ui;
     QProgressBar *m_progressBar;
+    QLabel *m_predictionLabel;
     LSystemRendererWidgetBase *m_rendererWidget;
 
     LSystemPtr m_lsystem;
-    QThread m_iterationThread;
+    TaskGroup m_iteration; //!< on the global TaskScheduler
     QElapsedTimer m_iterationTimer;
     bool m_iterating;
 };
@@ -0,0 +1,61 @@
+#include "MappedState.h"
+
+#include <QDir>
+#include <QStorageInfo>
+#include <QTemporaryFile>
+
+namespace
+{
+    char empty_state[] = ""; // data() of the empty states : nothing is mapped
+}
+
+MappedState::MappedState() : m_file(), m_data(empty_state), m_length(0)
+{
+
+}
+
+MappedState::~MappedState()
+{
+    // a temporary file is removed as well
+    if (m_length > 0)
+        m_file->unmap(reinterpret_cast<uchar *>(m_data));
+}
+
+bool MappedState::allocate(quint64 length)
+{
+    if (!m_file.isNull() || length == 0)
+        return m_length == length;
+
+    // the file is sparse : writing to a mapping beyond the free space would
+    // crash rather than fail, so it is checked beforehand
+    const QStorageInfo storage(QDir::tempPath());
+    if (!storage.isValid() || static_cast<quint64>(storage.bytesAvailable()) < length)
+        return false;
+
+    QTemporaryFile *file = new QTemporaryFile(
+                QDir(QDir::tempPath()).filePath("lsystem-state-XXXXXX"));
+    m_file.reset(file);
+    if (!file->open() || !file->resize(static_cast<qint64>(length)))
+        return false;
+    return map(0, length);
+}
+
+bool MappedState::open(const QString &path, quint64 offset, quint64 length)
+{
+    if (!m_file.isNull())
+        return false;
+    m_file.reset(new QFile(path));
+    if (!m_file->open(QIODevice::ReadOnly))
+        return false;
+    return length == 0 || map(offset, length);
+}
+
+bool MappedState::map(quint64 offset, quint64 length)
+{
+    uchar *data = m_file->map(static_cast<qint64>(offset), static_cast<qint64>(length));
+    if (data == nullptr)
+        return false;
+    m_data = reinterpret_cast<char *>(data);
+    m_length = length;
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef MAPPEDSTATE_H
+#define MAPPEDSTATE_H
+
+#include <QFile>
+#include <QScopedPointer>
+
+#include "ProductionTable.h"
+
+/**
+ * @brief MappedState stores a State out of core, in a memory-mapped
+ * temporary file.
+ *
+ * The symbols are laid out as in a State, one byte each, but their pages
+ * are loaded and written back by the system as they are accessed : a
+ * state written or walked sequentially only needs a few pages in memory at
+ * once, so that its length is bounded by the disk space rather than by the
+ * memory.
+ *
+ * The state is either allocated in a temporary file, removed with the
+ * state, or read from a part of an existing file (see GenerationStore),
+ * without any copy.
+ */
+class MappedState
+{
+public:
+    MappedState();
+    ~MappedState();
+
+    /**
+     * @brief Create a temporary file with room for length symbols, and map it.
+     *
+     * The file is created in QDir::tempPath() (see the TMPDIR environment
+     * variable), which must not be an in-memory filesystem for this to help.
+     * @return False if there is not enough disk space, or if the file
+     * could not be created or mapped.
+     */
+    bool allocate(quint64 length);
+
+    /**
+     * @brief Map, read-only, the length symbols stored at offset in the
+     * existing file at path. The state must then not be written.
+     * @return False if the file could not be opened or mapped.
+     */
+    bool open(const QString &path, quint64 offset, quint64 length);
+
+    /**
+     * @brief Number of symbols.
+     */
+    inline quint64 length() const { return m_length; }
+
+    /**
+     * @brief The symbols, contiguous as those of a State.
+     */
+    inline const char *data() const { return m_data; }
+    inline char *data() { return m_data; }
+
+    /**
+     * @brief Symbol at the given index.
+     */
+    inline char operator[](quint64 index) const { return m_data[index]; }
+
+    /**
+     * @brief Disk space used by the state, in bytes.
+     */
+    inline quint64 disk_usage() const { return m_length; }
+
+private:
+    Q_DISABLE_COPY(MappedState)
+
+    /**
+     * @brief Map length bytes of m_file from offset.
+     */
+    bool map(quint64 offset, quint64 length);
+
+    QScopedPointer<QFile> m_file;
+    char *m_data; //!< the mapping of m_file, or an empty string
+    quint64 m_length;
+};
+
+#endif /* MAPPEDSTATE_H */
@@ -0,0 +1,133 @@
+#include "PackedState.h"
+
+#include <cstring>
+
+PackedState::PackedState() : m_alphabet_size(0), m_bits(4), m_words(),
+    m_length(0)
+{
+    memset(m_symbols, 0, sizeof(m_symbols));
+    memset(m_codes, 0, sizeof(m_codes));
+}
+
+PackedState::PackedState(const State &state, const ProductionTable &productions) :
+    PackedState(state.data(), state.length(), productions)
+{
+
+}
+
+PackedState::PackedState(const char *symbols, quint64 length,
+                         const ProductionTable &productions) :
+    m_alphabet_size(0), m_bits(4), m_words(), m_length(length)
+{
+    memset(m_symbols, 0, sizeof(m_symbols));
+    memset(m_codes, 0, sizeof(m_codes));
+
+    // the alphabet : the symbols of the state, and all they can produce
+    bool known[256] = { false };
+    std::vector<char> pending;
+    for (quint64 i = 0; i < m_length; ++i)
+    {
+        if (!known[static_cast<uchar>(symbols[i])])
+        {
+            known[static_cast<uchar>(symbols[i])] = true;
+            pending.push_back(symbols[i]);
+        }
+    }
+    while (!pending.empty())
+    {
+        const char symbol = pending.back();
+        pending.pop_back();
+        m_codes[static_cast<uchar>(symbol)] = static_cast<uchar>(m_alphabet_size);
+        m_symbols[m_alphabet_size++] = symbol;
+
+        const char *p = productions.production(symbol);
+        const char *end = p + productions.production_length(symbol);
+        for (; p != end; ++p)
+        {
+            if (!known[static_cast<uchar>(*p)])
+            {
+                known[static_cast<uchar>(*p)] = true;
+                pending.push_back(*p);
+            }
+        }
+    }
+    m_bits = (m_alphabet_size <= 16) ? 4 : 8;
+
+    // encode the symbols
+    const int per_word = 64 / m_bits;
+    m_words.assign((m_length + per_word - 1) / per_word, 0);
+    for (quint64 i = 0; i < m_length; ++i)
+        m_words[i / per_word] |= static_cast<quint64>(m_codes[static_cast<uchar>(symbols[i])])
+                << (i % per_word * m_bits);
+}
+
+State PackedState::unpacked() const
+{
+    State state(m_length, '\0');
+    if (m_length > 0)
+        unpack(&state[0]);
+    return state;
+}
+
+void PackedState::unpack(char *out) const
+{
+    for_each_code(0, m_length, [&](uint code) { *out++ = m_symbols[code]; });
+}
+
+
+PackedRewriter::PackedRewriter(const PackedState &source,
+                               const ProductionTable &productions) :
+    m_source(source), m_result(), m_production_words(), m_bit_position(0)
+{
+    // the rewriting keeps the alphabet of the source
+    memcpy(m_result.m_symbols, source.m_symbols, sizeof(m_result.m_symbols));
+    memcpy(m_result.m_codes, source.m_codes, sizeof(m_result.m_codes));
+    m_result.m_alphabet_size = source.m_alphabet_size;
+    m_result.m_bits = source.m_bits;
+
+    // encode the production of every code
+    const int bits = source.m_bits, per_word = 64 / bits;
+    for (int code = 0; code < source.m_alphabet_size; ++code)
+    {
+        const char symbol = source.m_symbols[code];
+        const char *production = productions.production(symbol);
+        m_lengths[code] = productions.production_length(symbol);
+        m_offsets[code] = static_cast<int>(m_production_words.size());
+        m_production_words.resize(m_offsets[code]
+                                  + (m_lengths[code] + per_word - 1) / per_word, 0);
+        for (quint64 i = 0; i < m_lengths[code]; ++i)
+            m_production_words[m_offsets[code] + i / per_word] |=
+                    static_cast<quint64>(source.m_codes[static_cast<uchar>(production[i])])
+                    << (i % per_word * bits);
+    }
+
+    // first pass : length of the rewriting, allocated once
+    quint64 length = 0;
+    source.for_each_code(0, source.m_length,
+                         [&](uint code) { length += m_lengths[code]; });
+    m_result.m_length = length;
+    m_result.m_words.assign((length + per_word - 1) / per_word, 0);
+}
+
+void PackedRewriter::rewrite(quint64 begin, quint64 end)
+{
+    const quint64 bits = m_source.m_bits;
+    quint64 *out = m_result.m_words.data();
+    const quint64 *words = m_production_words.data();
+    quint64 position = m_bit_position;
+
+    // second pass : OR every encoded production at its bit position
+    m_source.for_each_code(begin, end, [&](uint code) {
+        const quint64 *word = words + m_offsets[code];
+        for (quint64 remaining = m_lengths[code] * bits; remaining > 0; ++word)
+        {
+            const quint64 n = qMin<quint64>(remaining, 64);
+            const quint64 index = position / 64, shift = position % 64;
+            out[index] |= *word << shift;
+            if (shift + n > 64)
+                out[index + 1] |= *word >> (64 - shift);
+            position += n, remaining -= n;
+        }
+    });
+    m_bit_position = position;
+}
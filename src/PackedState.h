@@ -0,0 +1,214 @@
+#ifndef PACKEDSTATE_H
+#define PACKEDSTATE_H
+
+#include <vector>
+
+#include "ProductionTable.h"
+
+/**
+ * @brief PackedState is a dictionary-encoded, compact storage for a State.
+ *
+ * Every symbol is replaced by its code in the alphabet of the state, stored
+ * in 4 bits when the alphabet has at most 16 symbols (which is the case of
+ * most grammars : 'F', 'G', '+', '-', '[', ']'...) and in 8 bits otherwise.
+ * The codes are packed in 64-bit words, lowest bits first.
+ *
+ * The alphabet is closed under the productions the state was encoded with,
+ * so that its rewritings (see PackedRewriter) keep the same alphabet and
+ * never need to be re-encoded.
+ */
+class PackedState
+{
+    friend class PackedRewriter;
+
+public:
+    /**
+     * @brief Iterator decoding the symbols of a PackedState.
+     */
+    class const_iterator
+    {
+    public:
+        const_iterator(const PackedState *state, quint64 index)
+            : m_state(state), m_index(index) { }
+
+        inline char operator*() const { return m_state->at(m_index); }
+        inline const_iterator &operator++() { ++m_index; return *this; }
+        inline bool operator==(const const_iterator &other) const
+        {
+            return m_index == other.m_index;
+        }
+        inline bool operator!=(const const_iterator &other) const
+        {
+            return m_index != other.m_index;
+        }
+
+    private:
+        const PackedState *m_state;
+        quint64 m_index;
+    };
+
+    /**
+     * @brief Construct an empty state, with an empty alphabet.
+     */
+    PackedState();
+
+    /**
+     * @brief Encode state.
+     * @param state The state to encode.
+     * @param productions The productions the state will be rewritten with.
+     */
+    PackedState(const State &state, const ProductionTable &productions);
+
+    /**
+     * @brief Encode the length symbols at symbols, e.g. those of a
+     * MappedState.
+     */
+    PackedState(const char *symbols, quint64 length, const ProductionTable &productions);
+
+    /**
+     * @brief Number of symbols.
+     */
+    inline quint64 length() const { return m_length; }
+
+    /**
+     * @brief Number of bits used by every symbol (4 or 8).
+     */
+    inline int bits_per_symbol() const { return m_bits; }
+
+    /**
+     * @brief Number of distinct symbols of the alphabet.
+     */
+    inline int alphabet_size() const { return m_alphabet_size; }
+
+    /**
+     * @brief Memory used by the encoded symbols, in bytes.
+     */
+    inline quint64 memory_usage() const { return m_words.size() * sizeof(quint64); }
+
+    /**
+     * @brief Symbol at the given index.
+     */
+    inline char at(quint64 index) const { return m_symbols[code_at(index)]; }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, m_length); }
+
+    /**
+     * @brief Decode the whole state.
+     */
+    State unpacked() const;
+
+    /**
+     * @brief Decode the whole state into out, of length() symbols (e.g. the
+     * data of a MappedState).
+     */
+    void unpack(char *out) const;
+
+    /**
+     * @brief Feed every symbol, in order, to visitor.
+     *
+     * visitor is called as bool visitor(char symbol) and stops the walk by
+     * returning false.
+     * @return False if the walk was stopped by the visitor.
+     */
+    template <typename Visitor>
+    bool walk(Visitor &visitor) const;
+
+private:
+    inline uint code_at(quint64 index) const
+    {
+        const int per_word = 64 / m_bits;
+        return (m_words[index / per_word] >> (index % per_word * m_bits))
+                & ((1u << m_bits) - 1);
+    }
+
+    /**
+     * @brief Call f(code) for the code of every symbol in [begin, end),
+     * decoding the state word by word.
+     */
+    template <typename Function>
+    void for_each_code(quint64 begin, quint64 end, Function f) const;
+
+    char m_symbols[256]; //!< code -> symbol
+    uchar m_codes[256];  //!< symbol -> code
+    int m_alphabet_size;
+    int m_bits;
+    std::vector<quint64> m_words; //!< not a QVector : may exceed 2 GB
+    quint64 m_length;
+};
+
+template <typename Function>
+void PackedState::for_each_code(quint64 begin, quint64 end, Function f) const
+{
+    const int per_word = 64 / m_bits;
+    const quint64 mask = (1u << m_bits) - 1;
+    quint64 i = begin;
+    while (i < end)
+    {
+        quint64 word = m_words[i / per_word] >> (i % per_word * m_bits);
+        const quint64 word_end = qMin(end, (i / per_word + 1) * per_word);
+        for (; i < word_end; ++i, word >>= m_bits)
+            f(static_cast<uint>(word & mask));
+    }
+}
+
+template <typename Visitor>
+bool PackedState::walk(Visitor &visitor) const
+{
+    const int per_word = 64 / m_bits;
+    const quint64 mask = (1u << m_bits) - 1;
+    for (quint64 w = 0, i = 0; i < m_length; ++w)
+    {
+        quint64 word = m_words[w];
+        const quint64 word_end = qMin(m_length, i + per_word);
+        for (; i < word_end; ++i, word >>= m_bits)
+            if (!visitor(m_symbols[word & mask]))
+                return false;
+    }
+    return true;
+}
+
+/**
+ * @brief PackedRewriter rewrites a PackedState without decoding it.
+ *
+ * The productions are encoded once with the alphabet of the source state :
+ * the length of the rewriting is computed on construction (first pass), the
+ * result is allocated once, and the second pass appends the encoded
+ * productions bit-string by bit-string.
+ *
+ * The second pass can be split in consecutive ranges of the source state
+ * (e.g. to report progress), which must be rewritten in order.
+ *
+ * The productions must be the ones the source state was encoded with.
+ */
+class PackedRewriter
+{
+public:
+    PackedRewriter(const PackedState &source, const ProductionTable &productions);
+
+    /**
+     * @brief Length of the rewriting of the whole source state.
+     */
+    inline quint64 length() const { return m_result.m_length; }
+
+    /**
+     * @brief Append the rewriting of the source symbols [begin, end).
+     */
+    void rewrite(quint64 begin, quint64 end);
+
+    /**
+     * @brief The rewriting of the source state, once fully rewritten.
+     * Can be moved from.
+     */
+    PackedState &result() { return m_result; }
+
+private:
+    const PackedState &m_source;
+    PackedState m_result;
+    std::vector<quint64> m_production_words; //!< all the encoded productions
+    int m_offsets[256];  //!< code -> offset of its production in m_production_words
+    quint64 m_lengths[256]; //!< code -> length of its production
+    quint64 m_bit_position; //!< where the next production is written in m_result
+};
+
+#endif /* PACKEDSTATE_H */
@@ -0,0 +1,38 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <QAtomicInt>
+
+#include "TaskScheduler.h"
+
+/**
+ * @brief Call job(i) for every i in [0, count) on scheduler, and wait until
+ * all the jobs are done.
+ *
+ * Up to width threads (0 : as many as the scheduler has workers) take the
+ * jobs in turn, so count should be a few times the number of threads for
+ * the load to be balanced. The calling thread takes part in the work, and
+ * can itself be a task of the scheduler : parallel_for() calls nest.
+ */
+template <typename Job>
+void parallel_for(TaskScheduler &scheduler, int count, Job job, int width = 0)
+{
+    if (count <= 0)
+        return;
+
+    const int workers = qBound(1, width > 0 ? width : scheduler.thread_count(), count);
+    QAtomicInt next(0);
+    auto work = [&]()
+    {
+        int i;
+        while ((i = next.fetchAndAddRelaxed(1)) < count)
+            job(i);
+    };
+    TaskGroup group(scheduler);
+    for (int w = 1; w < workers; ++w)
+        group.run(work);
+    work();
+    group.wait();
+}
+
+#endif /* PARALLEL_H */
@@ -0,0 +1,199 @@
+#include "ParallelTurtleInterpreter.h"
+
+#include <QVector>
+#include <QAtomicInteger>
+#include <QMutex>
+#include "Parallel.h"
+#include "TurtleArena.h"
+
+const quint64 ParallelTurtleInterpreter::parallel_threshold = 1 << 20;
+const int turtle_chunks_per_thread = 8; // for load balancing
+const quint64 min_turtle_chunk_length = 1 << 16;
+
+namespace
+{
+    typedef TurtleInterpreter::SteppedState SteppedState;
+
+    /**
+     * @brief A slice of the state, and its net effect on the turtle.
+     */
+    struct TurtleChunk
+    {
+        quint64 begin, end;
+        int pops; //!< number of ']' popping the states pushed by the previous chunks
+        SteppedState state; //!< final state, relative to the last popped one
+        QVector<SteppedState> pushes; //!< states left pushed, relative to the same
+        SteppedState start; //!< actual state at the beginning of the chunk
+        QStack<SteppedState> stack; //!< actual stack at the beginning of the chunk
+    };
+
+    /**
+     * @brief The actual state of a state given relatively to base.
+     */
+    inline SteppedState compose(const RotationTable &rotations, const SteppedState &base,
+                                const SteppedState &relative)
+    {
+        return SteppedState(base.first + rotations.rotated(relative.first, base.second),
+                            rotations.turned(base.second, relative.second));
+    }
+
+    /**
+     * @brief Run the turtle over chunk from the canonical state, to find its
+     * net effect.
+     */
+    void summarize(const DerivationTree &derivation, const RotationTable &rotations,
+                   TurtleChunk &chunk)
+    {
+        const SteppedState identity(QPointF(0, 0), 0);
+        SteppedState state = identity;
+        QVector<SteppedState> &stack = chunk.pushes;
+        chunk.pops = 0;
+
+        DerivationTree::const_iterator it = derivation.iterator_at(chunk.begin);
+        for (quint64 i = chunk.begin; i < chunk.end; ++i, ++it)
+        {
+            switch (*it)
+            {
+                case 'F':
+                    state.first += rotations.direction(state.second);
+                    break;
+                case '+':
+                    state.second = rotations.turned(state.second, -1);
+                    break;
+                case '-':
+                    state.second = rotations.turned(state.second, 1);
+                    break;
+                case '[':
+                    stack.append(state);
+                    break;
+                case ']':
+                    // popping a state of a previous chunk : what follows is
+                    // relative to that state
+                    if (stack.isEmpty())
+                        ++chunk.pops, state = identity;
+                    else
+                        state = stack.takeLast();
+                    break;
+            }
+        }
+        chunk.state = state;
+    }
+}
+
+ParallelTurtleInterpreter::ParallelTurtleInterpreter(float angle, TaskScheduler &scheduler) :
+    m_angle(angle), m_scheduler(scheduler), m_chunk_count(0), m_progress(),
+    m_chunk_drawn()
+{
+
+}
+
+bool ParallelTurtleInterpreter::interpret(const DerivationTree &derivation,
+                                          TurtleGeometry &geometry)
+{
+    QVector<TurtleGeometry> buffers;
+    return interpret(derivation, geometry, buffers);
+}
+
+bool ParallelTurtleInterpreter::interpret(const DerivationTree &derivation, TurtleArena &arena)
+{
+    return interpret(derivation, arena.geometry, arena.chunks);
+}
+
+bool ParallelTurtleInterpreter::interpret(const DerivationTree &derivation,
+                                          TurtleGeometry &geometry,
+                                          QVector<TurtleGeometry> &buffers)
+{
+    const RotationTable rotations(m_angle, 90.f); // as TurtleInterpreter
+    const quint64 L = derivation.length();
+    int count = m_chunk_count;
+    if (count <= 0)
+        count = static_cast<int>(qBound<quint64>(1, L / min_turtle_chunk_length,
+                m_scheduler.thread_count() * turtle_chunks_per_thread));
+    count = static_cast<int>(qMax<quint64>(1, qMin<quint64>(count, L)));
+
+    QVector<TurtleChunk> chunks(count);
+    if (buffers.size() < count)
+        buffers.resize(count);
+    for (int i = 0; i < count; ++i)
+    {
+        chunks[i].begin = i * (L / count) + qMin<quint64>(i, L % count);
+        chunks[i].end = (i + 1) * (L / count) + qMin<quint64>(i + 1, L % count);
+    }
+
+    // both passes count for half of the work
+    QAtomicInteger<quint64> done(0);
+    QAtomicInt last_progress(0);
+    auto report_progress = [&](quint64 n)
+    {
+        if (!m_progress || L == 0)
+            return;
+        const int progress = static_cast<int>(100 * (done.fetchAndAddRelaxed(n) + n) / (2 * L));
+        const int last = last_progress.load();
+        if (progress > last && last_progress.testAndSetRelaxed(last, progress))
+            m_progress(progress);
+    };
+
+    // first pass : net effect of every chunk
+    parallel_for(m_scheduler, count, [&](int i) {
+        summarize(derivation, rotations, chunks[i]);
+        report_progress(chunks[i].end - chunks[i].begin);
+    });
+
+    // compose the effects, giving the actual state and stack at every chunk
+    SteppedState state(QPointF(0, 0), 0);
+    QStack<SteppedState> stack;
+    for (int i = 0; i < count; ++i)
+    {
+        TurtleChunk &chunk = chunks[i];
+        chunk.start = state, chunk.stack = stack;
+
+        SteppedState base = state;
+        for (int p = 0; p < chunk.pops; ++p)
+        {
+            if (stack.isEmpty())
+                return false;
+            base = stack.pop();
+        }
+        state = compose(rotations, base, chunk.state);
+        QVector<SteppedState>::const_iterator it;
+        for (it = chunk.pushes.constBegin(); it != chunk.pushes.constEnd(); ++it)
+            stack.push(compose(rotations, base, *it));
+    }
+
+    // second pass : draw every chunk from its actual state ; the chunks
+    // drawn are handed out in order, by the thread completing the sequence
+    QVector<bool> drawn(count, false);
+    int next_drawn = 0;
+    QMutex drawn_mutex;
+    parallel_for(m_scheduler, count, [&](int i) {
+        TurtleChunk &chunk = chunks[i];
+        buffers[i].clear(); // keeping the storage of a previous call
+        TurtleInterpreter interpreter(m_angle, buffers[i]);
+        interpreter.start_from(chunk.start, chunk.stack);
+        DerivationTree::const_iterator it = derivation.iterator_at(chunk.begin);
+        for (quint64 j = chunk.begin; j < chunk.end; ++j, ++it)
+            interpreter.interpret(*it);
+        interpreter.finish();
+        report_progress(chunk.end - chunk.begin);
+        if (m_chunk_drawn)
+        {
+            QMutexLocker locker(&drawn_mutex);
+            drawn[i] = true;
+            for (; next_drawn < count && drawn[next_drawn]; ++next_drawn)
+                m_chunk_drawn(buffers[next_drawn]);
+        }
+    });
+
+    // gather the geometries, in order
+    geometry.clear();
+    quint64 points = 0;
+    for (int i = 0; i < count; ++i)
+        points += buffers[i].segments.point_count();
+    geometry.segments.reserve(points);
+    for (int i = 0; i < count; ++i)
+    {
+        geometry.segments.append(buffers[i].segments);
+        geometry.bounds = geometry.bounds.united(buffers[i].bounds);
+    }
+    return true;
+}
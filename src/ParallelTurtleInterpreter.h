@@ -0,0 +1,93 @@
+#ifndef PARALLELTURTLEINTERPRETER_H
+#define PARALLELTURTLEINTERPRETER_H
+
+#include <functional>
+
+#include "DerivationTree.h"
+#include "TaskScheduler.h"
+#include "TurtleInterpreter.h"
+
+class TurtleArena;
+
+/**
+ * @brief ParallelTurtleInterpreter builds the TurtleGeometry of a state, like
+ * TurtleInterpreter, using a TaskScheduler.
+ *
+ * The state is split into chunks, and the turtle is run over each of them
+ * from a canonical state (origin, north, empty stack), which gives the net
+ * effect of the chunk relative to its start :
+ * - the number of ']' popping states pushed by the previous chunks,
+ * - the final state of the turtle, relative to the last state popped (or to
+ * the start of the chunk if none),
+ * - the states left pushed, relative to the same state.
+ * These effects are composed chunk by chunk, giving the actual state and
+ * stack of the turtle at the start of every chunk ; the chunks are then
+ * interpreted concurrently, each into its own geometry, and the results
+ * concatenated.
+ *
+ * Every symbol is thus interpreted twice, but both passes are parallel.
+ */
+class ParallelTurtleInterpreter
+{
+public:
+    /**
+     * @brief Minimal length of a state for the parallel interpretation to
+     * be worth it.
+     */
+    static const quint64 parallel_threshold;
+
+    /**
+     * @brief Constructor.
+     * @param angle The rotation angle, in degrees.
+     * @param scheduler The scheduler to run the chunks on.
+     */
+    ParallelTurtleInterpreter(float angle, TaskScheduler &scheduler);
+
+    /**
+     * @brief Set the number of chunks (0 : a few per thread, the default).
+     */
+    inline void set_chunk_count(int count) { m_chunk_count = count; }
+
+    /**
+     * @brief Set the function called with the percentage of the work done,
+     * from any thread, whenever it increases.
+     */
+    inline void set_progress(std::function<void(uint)> progress) { m_progress = progress; }
+
+    /**
+     * @brief Set the function called with the geometry of every chunk, in
+     * the order of the state, as soon as it and the chunks before it are
+     * drawn (e.g. to draw a partial image) : from any thread, but one call
+     * at a time.
+     */
+    inline void set_chunk_drawn(std::function<void(const TurtleGeometry &)> drawn)
+    {
+        m_chunk_drawn = drawn;
+    }
+
+    /**
+     * @brief Interpret the state derived by derivation into geometry.
+     * @return False if a ']' pops an empty stack, geometry being then left
+     * unspecified.
+     */
+    bool interpret(const DerivationTree &derivation, TurtleGeometry &geometry);
+
+    /**
+     * @brief Interpret the state derived by derivation into the geometry of
+     * arena, the chunks being drawn into its storage rather than into
+     * buffers allocated by every call.
+     */
+    bool interpret(const DerivationTree &derivation, TurtleArena &arena);
+
+private:
+    bool interpret(const DerivationTree &derivation, TurtleGeometry &geometry,
+                   QVector<TurtleGeometry> &buffers);
+
+    float m_angle;
+    TaskScheduler &m_scheduler;
+    int m_chunk_count;
+    std::function<void(uint)> m_progress;
+    std::function<void(const TurtleGeometry &)> m_chunk_drawn;
+};
+
+#endif /* PARALLELTURTLEINTERPRETER_H */
@@ -0,0 +1,80 @@
+#include "ProductionTable.h"
+
+#include <cstring>
+
+ProductionTable::ProductionTable()
+{
+    compile(RulesDict());
+}
+
+ProductionTable::ProductionTable(const RulesDict &rules)
+{
+    compile(rules);
+}
+
+void ProductionTable::compile(const RulesDict &rules)
+{
+    m_data.clear();
+
+    // every symbol first produces itself (constants)...
+    for (int c = 0; c < 256; ++c)
+    {
+        m_entries[c].offset = c;
+        m_entries[c].length = 1;
+        m_data += static_cast<char>(c);
+    }
+
+    // ...then the production rules override the variables
+    RulesDict::const_iterator it;
+    for (it = rules.constBegin(); it != rules.constEnd(); ++it)
+    {
+        const std::string product = it.value().toStdString();
+        Entry &entry = m_entries[static_cast<uchar>(it.key())];
+        entry.offset = static_cast<quint32>(m_data.length());
+        entry.length = static_cast<quint32>(product.length());
+        m_data += product;
+    }
+    m_kernel.compile(*this);
+}
+
+State::size_type ProductionTable::expanded_length(const char *begin,
+                                                  const char *end) const
+{
+    if (m_kernel.is_active())
+        return m_kernel.expanded_length(begin, end);
+
+    State::size_type length = 0;
+    for (const char *it = begin; it != end; ++it)
+        length += m_entries[static_cast<uchar>(*it)].length;
+    return length;
+}
+
+char *ProductionTable::expand(const char *begin, const char *end,
+                              char *out) const
+{
+    if (m_kernel.is_active())
+        return m_kernel.expand(begin, end, out);
+
+    const char *data = m_data.data();
+    for (const char *it = begin; it != end; ++it)
+    {
+        const Entry &entry = m_entries[static_cast<uchar>(*it)];
+        // most symbols are constants : avoid the memcpy call for them
+        if (entry.length == 1)
+            *out++ = data[entry.offset];
+        else
+        {
+            memcpy(out, data + entry.offset, entry.length);
+            out += entry.length;
+        }
+    }
+    return out;
+}
+
+State ProductionTable::apply(const State &state) const
+{
+    const char *begin = state.data(), *end = begin + state.length();
+    State result(expanded_length(begin, end), '\0');
+    expand(begin, end, &result[0]);
+    return result;
+}
@@ -0,0 +1,127 @@
+#ifndef PRODUCTIONTABLE_H
+#define PRODUCTIONTABLE_H
+
+#include <QMap>
+#include <QString>
+#include <string>
+
+#include "RewriteKernel.h"
+
+/**
+ * @brief State is the container for an L-System's state.
+ */
+typedef std::string State;
+
+/**
+* @brief RulesDict is a QMap of the type {variable_char:producted_string}
+* representing the production rules of an L-System.
+* Utilizes a QString as a producted string for convenience.
+*/
+typedef QMap<char, QString> RulesDict;
+
+/**
+ * @brief ProductionTable is the compiled form of a RulesDict, used as the
+ * rewrite engine of LSystem.
+ *
+ * All the productions are stored one after the other in a single buffer,
+ * and a flat 256-entries table indexed by the symbol (as an unsigned byte)
+ * gives the offset and length of each production. Constants (i.e. symbols
+ * without a production rule) are compiled as producing themselves, so that
+ * no lookup ever needs a branch.
+ *
+ * Rewriting a state is done in two passes : the exact length of the next
+ * state is first computed, which allows to allocate it only once, and the
+ * productions are then copied into it. Both passes use a RewriteKernel when
+ * the productions are short enough.
+ */
+class ProductionTable
+{
+public:
+    /**
+     * @brief Construct an identity table (every symbol is a constant).
+     */
+    ProductionTable();
+
+    /**
+     * @brief Construct the table from the given production rules.
+     */
+    explicit ProductionTable(const RulesDict &rules);
+
+    /**
+     * @brief (Re)compile the table from the given production rules.
+     */
+    void compile(const RulesDict &rules);
+
+    /**
+     * @brief Pointer to the first character of the production of symbol.
+     */
+    inline const char *production(char symbol) const
+    {
+        return m_data.data() + m_entries[static_cast<uchar>(symbol)].offset;
+    }
+
+    /**
+     * @brief Length of the production of symbol (1 for a constant).
+     */
+    inline State::size_type production_length(char symbol) const
+    {
+        return m_entries[static_cast<uchar>(symbol)].length;
+    }
+
+    /**
+     * @brief Whether symbol is a constant, i.e. only produces itself.
+     */
+    inline bool is_constant(char symbol) const
+    {
+        const Entry &entry = m_entries[static_cast<uchar>(symbol)];
+        return entry.length == 1 && m_data[entry.offset] == symbol;
+    }
+
+    /**
+     * @brief First pass : exact length of the rewriting of [begin, end).
+     */
+    State::size_type expanded_length(const char *begin, const char *end) const;
+
+    /**
+     * @brief Second pass : write the rewriting of [begin, end) to out.
+     *
+     * out must point to at least expanded_length(begin, end) characters.
+     * @return A pointer past the last character written.
+     */
+    char *expand(const char *begin, const char *end, char *out) const;
+
+    /**
+     * @brief Convenience function returning the rewriting of the given state.
+     */
+    State apply(const State &state) const;
+
+    /**
+     * @brief Select the instruction set of the rewriting (RewriteKernel::Scalar
+     * to disable the SIMD kernel), if supported.
+     */
+    inline void set_instruction_set(RewriteKernel::InstructionSet instruction_set)
+    {
+        m_kernel.set_instruction_set(instruction_set);
+    }
+
+    /**
+     * @brief The instruction set actually used by the rewriting.
+     */
+    inline RewriteKernel::InstructionSet instruction_set() const
+    {
+        return m_kernel.instruction_set();
+    }
+
+private:
+    struct Entry
+    {
+        quint32 offset; //!< offset of the production in m_data
+        quint32 length; //!< length of the production
+    };
+
+    Entry m_entries[256];
+    std::string m_data; //!< all the productions, concatenated
+    RewriteKernel m_kernel;
+};
+
+#endif /* PRODUCTIONTABLE_H */
@@ -0,0 +1,297 @@
+#include "RenderJob.h"
+
+#include <QElapsedTimer>
+#include <QPainter>
+
+#include "LSystem.h"
+#include "TurtleArena.h"
+#include "GeometryMemo.h"
+#include "TurtleExtents.h"
+#include "ParallelTurtleInterpreter.h"
+#include "GeometryPainter.h"
+#include "TileRasterizer.h"
+
+const uint progress_step = 5; // report only every x % (0 <= x <= 100)
+const quint64 frame_check_mask = 0xfff; // the clock is read every 4096 symbols
+const quint64 store_min_length = 1 << 20; // shorter states are not worth storing
+
+RenderInput::RenderInput() :
+    snapshot(), sizing(), angle(0), size(), view(), pen(Qt::black),
+    background(Qt::white), frame_interval(0),
+    geometry(), grid(), store(), grammar()
+{
+
+}
+
+RenderInput::RenderInput(const LSystem &lsystem) :
+    snapshot(lsystem.latest_snapshot()), sizing(), angle(0), size(), view(), pen(Qt::black),
+    background(Qt::white), frame_interval(0),
+    geometry(), grid(), store(lsystem.store()), grammar(lsystem.grammar())
+{
+    sizing = lsystem.axiom_derivation(snapshot->generation);
+}
+
+RenderOutput::RenderOutput() :
+    valid(false), error(), geometry(), grid(), image(), elapsed(0)
+{
+
+}
+
+RenderJob::RenderJob(const RenderInput &input, QObject *parent) :
+    QObject(parent), m_input(input), m_output(),
+    m_scheduler(&TaskScheduler::global_instance()), m_arena(nullptr), m_done(),
+    m_started(false)
+{
+
+}
+
+RenderJob::~RenderJob()
+{
+    // the job must not be destroyed while running
+    wait();
+}
+
+void RenderJob::start(TaskScheduler &scheduler)
+{
+    m_scheduler = &scheduler;
+    m_started = true;
+    scheduler.submit([this]() { run(); });
+}
+
+void RenderJob::wait()
+{
+    if (!m_started)
+        return;
+    m_done.acquire();
+    m_done.release();
+}
+
+void RenderJob::run()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    m_output.geometry = m_input.geometry;
+    m_output.grid = m_input.grid;
+    m_output.valid = !m_output.geometry.isNull() || load_geometry();
+    if (!m_output.valid && interpret())
+    {
+        m_output.valid = true;
+        store_geometry();
+    }
+    if (m_output.valid)
+        rasterize();
+    m_output.elapsed = timer.elapsed();
+
+    emit finished();
+    if (m_started)
+        m_done.release();
+}
+
+bool RenderJob::interpret()
+{
+    if (m_input.snapshot.isNull())
+    {
+        m_output.error = tr("RenderJob error : nothing to render");
+        return false;
+    }
+
+    // the turtle draws into storage sized from the grammar beforehand, kept
+    // by the arena of the caller for the next jobs
+    const DerivationTree &derivation = m_input.snapshot->derivation;
+    TurtleArena own_arena;
+    TurtleArena &arena = m_arena ? *m_arena : own_arena;
+    arena.prepare(m_input.sizing.base_length() > 0 ? m_input.sizing : derivation);
+
+    const quint64 length = derivation.length();
+    const bool long_state = length >= ParallelTurtleInterpreter::parallel_threshold;
+    const bool instanced = long_state && instantiate(arena.geometry);
+
+    // progressive : the partial image needs the bounds beforehand, and the
+    // segments in their order ; an instanced geometry is built too fast to
+    // be worth it
+    QRectF bounds;
+    const bool progressive = !instanced && m_input.frame_interval > 0
+            && !m_input.size.isEmpty() && predict_bounds(bounds);
+
+    // the partial image, fitted to the predicted bounds
+    QImage frame;
+    QPainter painter;
+    QTransform transform;
+    QElapsedTimer clock;
+    if (progressive)
+    {
+        TurtleGeometry predicted;
+        predicted.bounds = bounds;
+        transform = predicted.fit(m_input.size) * m_input.view;
+        frame = QImage(m_input.size, QImage::Format_ARGB32_Premultiplied);
+        frame.fill(m_input.background);
+        painter.begin(&frame);
+        painter.setPen(m_input.pen);
+        clock.start();
+    }
+
+    bool valid = instanced;
+    if (!instanced && long_state && m_scheduler->thread_count() > 1)
+    {
+        ParallelTurtleInterpreter interpreter(m_input.angle, *m_scheduler);
+        // called from the workers
+        interpreter.set_progress([this](uint progress) { emit progressed(progress); });
+        if (progressive)
+        {
+            // the chunks come in order : the frame grows as with the serial turtle
+            interpreter.set_chunk_drawn([&](const TurtleGeometry &chunk) {
+                draw_segments(painter, chunk.segments, transform, 0);
+                if (clock.elapsed() >= m_input.frame_interval)
+                {
+                    emit frame_ready(frame.copy()); // still painted on
+                    clock.restart();
+                }
+            });
+        }
+        valid = interpreter.interpret(derivation, arena);
+    }
+    else if (!instanced)
+    {
+        TurtleInterpreter interpreter(m_input.angle, arena);
+        const SegmentBuffer &segments = arena.geometry.segments;
+        quint64 i = 0;
+        quint64 drawn = 0; // number of points drawn into the frame
+        uint last_progress = 0;
+        auto interpret = [&](char symbol) -> bool
+        {
+            if (!interpreter.interpret(symbol))
+                return false;
+            // avoid sending too many signals (it's quite slow with very long states)
+            const uint progress = static_cast<uint>(100 * ++i / length);
+            if (progress >= last_progress + progress_step && progress < 100)
+            {
+                last_progress = progress;
+                emit progressed(progress);
+            }
+            // only the segments added since the last frame are drawn
+            if (progressive && (i & frame_check_mask) == 0
+                    && clock.elapsed() >= m_input.frame_interval
+                    && segments.point_count() > drawn)
+            {
+                draw_segments(painter, segments, transform, drawn);
+                drawn = segments.point_count();
+                emit frame_ready(frame.copy()); // still painted on
+                clock.restart();
+            }
+            return true;
+        };
+        valid = derivation.walk(interpret);
+        interpreter.finish();
+    }
+    if (!valid)
+    {
+        arena.reset();
+        m_output.error = tr("RenderJob error : cannot pop empty turtle stack");
+        return false;
+    }
+
+    // a copy of the exact size : the arena keeps its storage
+    m_output.geometry = QSharedPointer<TurtleGeometry>(new TurtleGeometry(arena.geometry));
+    arena.reset();
+    m_output.grid.clear();
+    return true;
+}
+
+bool RenderJob::instantiate(TurtleGeometry &geometry) const
+{
+    // from the axiom : the memo then holds the drawings of the longest subtrees
+    const DerivationTree &derivation = m_input.sizing.base_length() > 0
+            ? m_input.sizing : m_input.snapshot->derivation;
+    const GeometryMemo memo(derivation.productions(), m_input.angle, derivation.depth());
+    InstancedGeometry instanced;
+    if (!memo.is_valid() || !memo.instantiate(derivation, instanced))
+        return false;
+    instanced.expand(RotationTable(m_input.angle, 90.f), geometry.segments);
+    geometry.bounds = instanced.bounds;
+    return true;
+}
+
+bool RenderJob::predict_bounds(QRectF &bounds) const
+{
+    const DerivationTree &derivation = m_input.sizing.base_length() > 0
+            ? m_input.sizing : m_input.snapshot->derivation;
+    const GeometryMemo memo(derivation.productions(), m_input.angle, derivation.depth());
+    if (memo.state_bounds(derivation, bounds))
+        return true;
+
+    // the drawing then looks smaller than in the final image
+    const TurtleExtents extents(derivation.productions(), derivation.depth());
+    if (!extents.is_bounded())
+        return false;
+    const qreal extent = extents.state_extent(derivation);
+    bounds = QRectF(-extent, -extent, 2 * extent, 2 * extent);
+    return true;
+}
+
+bool RenderJob::load_geometry()
+{
+    if (m_input.store.isNull() || m_input.snapshot.isNull())
+        return false;
+    QSharedPointer<TurtleGeometry> geometry(new TurtleGeometry);
+    if (!m_input.store->load_geometry(m_input.grammar, m_input.snapshot->generation,
+                                      m_input.angle, *geometry))
+        return false;
+    m_output.geometry = geometry;
+    m_output.grid.clear();
+    return true;
+}
+
+void RenderJob::store_geometry()
+{
+    if (m_input.store.isNull()
+            || m_input.snapshot->derivation.length() < store_min_length)
+        return;
+
+    // writing may take long : the job does not wait for it
+    const GenerationStorePtr store = m_input.store;
+    const QByteArray grammar = m_input.grammar;
+    const GenerationSnapshotPtr snapshot = m_input.snapshot;
+    const QSharedPointer<const TurtleGeometry> geometry = m_output.geometry;
+    const float angle = m_input.angle;
+    m_scheduler->submit([store, grammar, snapshot, geometry, angle]() {
+        // e.g. a state mapped from the store : not written again
+        if (!store->contains(grammar, snapshot->generation))
+            store->save(grammar, snapshot->generation, snapshot->derivation);
+        store->save_geometry(grammar, snapshot->generation, angle, *geometry);
+    });
+}
+
+void RenderJob::rasterize()
+{
+    if (m_input.size.isEmpty())
+        return;
+
+    // the unit-scale geometry is fitted to the image here
+    const TurtleGeometry &geometry = *m_output.geometry;
+    const QTransform transform = geometry.fit(m_input.size) * m_input.view;
+    if (m_input.view.isIdentity())
+    {
+        TileRasterizer rasterizer(*m_scheduler);
+        rasterizer.set_background(m_input.background);
+        rasterizer.set_pen(m_input.pen);
+        m_output.image = rasterizer.render(geometry.segments, transform, m_input.size);
+        return;
+    }
+
+    // zoomed or panned : only the visible segments
+    if (m_output.grid.isNull())
+    {
+        QSharedPointer<SegmentGrid> grid(new SegmentGrid);
+        grid->build(geometry.segments, geometry.bounds, *m_scheduler);
+        m_output.grid = grid;
+    }
+    m_output.image = QImage(m_input.size, QImage::Format_ARGB32_Premultiplied);
+    if (m_output.image.isNull())
+        return;
+    m_output.image.fill(m_input.background);
+    QPainter painter(&m_output.image);
+    painter.setRenderHint(QPainter::Antialiasing, true);
+    painter.setPen(m_input.pen);
+    draw_visible_segments(painter, geometry.segments, *m_output.grid, transform, m_input.size);
+}
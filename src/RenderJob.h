@@ -0,0 +1,231 @@
+#ifndef RENDERJOB_H
+#define RENDERJOB_H
+
+#include <QObject>
+#include <QImage>
+#include <QPen>
+#include <QSemaphore>
+
+#include "GenerationCache.h"
+#include "TurtleInterpreter.h"
+#include "SegmentGrid.h"
+#include "TaskScheduler.h"
+#include "GenerationStore.h"
+
+class LSystem;
+class TurtleArena;
+
+/**
+ * @brief What a RenderJob renders : everything is copied into the job, and
+ * the snapshot and the geometry are immutable, so the job shares nothing
+ * that can change under it.
+ */
+struct RenderInput
+{
+    /**
+     * @brief Render nothing : set at least the snapshot.
+     */
+    RenderInput();
+
+    /**
+     * @brief Render the latest generation of lsystem (see
+     * LSystem::latest_snapshot()). Thread-safe.
+     */
+    explicit RenderInput(const LSystem &lsystem);
+
+    GenerationSnapshotPtr snapshot; //!< the generation to render
+    /**
+     * @brief The same state, derived from the axiom, to size the storage of
+     * the turtle (see TurtleArena::profile()) ; the derivation of the
+     * snapshot if empty.
+     */
+    DerivationTree sizing;
+    float angle; //!< rotation angle, in degrees
+    QSize size; //!< size of the image : empty to build the geometry only
+    QTransform view; //!< applied after fitting the geometry to the image
+    QPen pen;
+    QColor background;
+    /**
+     * @brief Interval between the partial images drawn while interpreting
+     * (see RenderJob::frame_ready()), in ms ; 0 : none.
+     */
+    int frame_interval;
+
+    /**
+     * @brief The drawing of the snapshot with the same angle, from a
+     * previous job : the state is then not interpreted again.
+     */
+    QSharedPointer<const TurtleGeometry> geometry;
+    QSharedPointer<const SegmentGrid> grid; //!< index of geometry, if built
+
+    /**
+     * @brief Where the geometry is loaded from, if stored, and stored once
+     * interpreted, for long states (see GenerationStore) ; null : nowhere.
+     */
+    GenerationStorePtr store;
+    QByteArray grammar; //!< of the snapshot, for the store (see LSystem::grammar())
+};
+
+/**
+ * @brief What a RenderJob produced.
+ */
+struct RenderOutput
+{
+    RenderOutput();
+
+    bool valid; //!< false if the state could not be interpreted (see error)
+    QString error;
+    QSharedPointer<const TurtleGeometry> geometry; //!< unit-scale drawing
+    /**
+     * @brief Index of the geometry, built when only a part of it is visible
+     * (zoomed or panned view) ; null otherwise.
+     */
+    QSharedPointer<const SegmentGrid> grid;
+    QImage image; //!< null if no size was given
+    qint64 elapsed; //!< in ms
+};
+
+/**
+ * @brief RenderJob interprets a generation of an L-System and rasterizes it,
+ * independently from any widget.
+ *
+ * The job owns its turtle and its output : jobs share nothing, so many of
+ * them can run concurrently, e.g. to render several grammars or viewports
+ * at once. A job is run either on the calling thread (see run(), for
+ * headless callers) or as a task of a TaskScheduler (see start()), its
+ * results being then handed back by finished().
+ *
+ * The state is interpreted in a single pass into a unit-scale
+ * TurtleGeometry, which is then fitted to the image. The turtle draws into
+ * a TurtleArena : that of the caller, if given (see set_arena()), keeps its
+ * storage from a job to the next one, the output being a copy of its
+ * geometry. The geometry of a long
+ * state of a grammar which can be memoized is rather made of copies of the
+ * drawings of its subtrees (see instantiate()) ; only the visible
+ * segments are drawn when the view is zoomed or panned. The parallel parts
+ * (interpretation of long states, rasterization) are split into tasks of
+ * the same scheduler, the global one for run().
+ *
+ * With a frame interval, the job also draws the segments into a partial
+ * image as the turtle goes, handed out at that rate (see frame_ready()) :
+ * the drawing is seen growing long before the final image is done. This
+ * needs the bounds of the drawing beforehand (see predict_bounds()) ; the
+ * chunks of a parallel interpretation are drawn in order. An instanced
+ * geometry has no partial images.
+ *
+ * With a GenerationStore, the geometry is loaded from it rather than
+ * interpreted, if stored ; otherwise, the new geometry (and the state, if
+ * not stored yet) is stored by a later task of the scheduler, if the state
+ * is long enough.
+ */
+class RenderJob : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit RenderJob(const RenderInput &input, QObject *parent = 0);
+    ~RenderJob();
+
+    inline const RenderInput &input() const { return m_input; }
+
+    /**
+     * @brief Draw into arena rather than into an arena of the job, so that
+     * its storage is reused by the next jobs ; it is reset once the job is
+     * done. The arena must outlive the job, and not be used by another job
+     * meanwhile. To be set before running the job.
+     */
+    inline void set_arena(TurtleArena *arena) { m_arena = arena; }
+
+    /**
+     * @brief The results, once finished() was fired.
+     */
+    inline const RenderOutput &output() const { return m_output; }
+
+    /**
+     * @brief Run the job on the calling thread, firing finished() once done.
+     */
+    void run();
+
+    /**
+     * @brief Run the job on scheduler. finished() is then fired from one of
+     * its workers : connected objects of other threads receive it queued.
+     *
+     * The job waits until it is done before being destroyed : delete it
+     * later (see QObject::deleteLater()) rather than from a slot directly
+     * connected to finished().
+     */
+    void start(TaskScheduler &scheduler);
+
+    /**
+     * @brief Wait until the job started on a scheduler is done. Thread-safe.
+     */
+    void wait();
+
+signals:
+    /**
+     * @brief When interpreting, fired whenever a progress is made.
+     * @param percentage The percentage of the work done (< 100%).
+     */
+    void progressed(uint percentage);
+
+    /**
+     * @brief With a frame interval, fired while interpreting whenever new
+     * segments were drawn into the partial image.
+     * @param image A copy of the partial image.
+     */
+    void frame_ready(const QImage &image);
+
+    /**
+     * @brief Fired once the job is done, successfully or not (see output()).
+     */
+    void finished();
+
+private:
+    /**
+     * @brief Interpret the snapshot into a new geometry.
+     * @return False if the state could not be interpreted.
+     */
+    bool interpret();
+
+    /**
+     * @brief Build the geometry of the snapshot by instancing the memoized
+     * drawings of its subtrees (see GeometryMemo::instantiate()), without
+     * walking the state.
+     * @return False if the grammar cannot be memoized.
+     */
+    bool instantiate(TurtleGeometry &geometry) const;
+
+    /**
+     * @brief Compute the bounding box of the drawing of the snapshot before
+     * interpreting it : exact for periodic angles (see GeometryMemo), a
+     * square bounding it otherwise (see TurtleExtents).
+     * @return False if the drawing cannot be bounded.
+     */
+    bool predict_bounds(QRectF &bounds) const;
+
+    /**
+     * @brief Load the geometry from the store.
+     * @return False if it is not stored.
+     */
+    bool load_geometry();
+
+    /**
+     * @brief Store the geometry interpreted, and the snapshot if not stored
+     * yet, later.
+     */
+    void store_geometry();
+
+    /**
+     * @brief Rasterize the geometry into the image.
+     */
+    void rasterize();
+
+    const RenderInput m_input;
+    RenderOutput m_output;
+    TaskScheduler *m_scheduler; //!< of the parallel parts
+    TurtleArena *m_arena; //!< of the caller, or nullptr
+    QSemaphore m_done; //!< released once started and done, see wait()
+    bool m_started;
+};
+
+#endif /* RENDERJOB_H */
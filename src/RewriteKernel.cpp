@@ -0,0 +1,326 @@
+#include "RewriteKernel.h"
+
+#include "ProductionTable.h"
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define REWRITE_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+#ifdef REWRITE_KERNEL_X86
+namespace
+{
+    /**
+     * @brief Lengths of the productions of 16 symbols : shuffle-based lookups.
+     */
+    __attribute__((target("sse4.1")))
+    inline __m128i lengths_sse(__m128i symbols, __m128i class_low, __m128i class_high,
+                               __m128i length_low, __m128i length_high)
+    {
+        const __m128i nibble = _mm_set1_epi8(0x0f);
+        const __m128i low = _mm_and_si128(symbols, nibble),
+                high = _mm_and_si128(_mm_srli_epi16(symbols, 4), nibble);
+        // one bit per variable, none for the constants
+        const __m128i classes = _mm_and_si128(_mm_shuffle_epi8(class_low, low),
+                                              _mm_shuffle_epi8(class_high, high));
+        const __m128i lengths = _mm_or_si128(
+                _mm_shuffle_epi8(length_low, _mm_and_si128(classes, nibble)),
+                _mm_shuffle_epi8(length_high, _mm_and_si128(_mm_srli_epi16(classes, 4), nibble)));
+        const __m128i constants = _mm_and_si128(_mm_cmpeq_epi8(classes, _mm_setzero_si128()),
+                                                _mm_set1_epi8(1));
+        return _mm_add_epi8(lengths, constants);
+    }
+
+    __attribute__((target("avx2")))
+    inline __m256i lengths_avx2(__m256i symbols, __m256i class_low, __m256i class_high,
+                                __m256i length_low, __m256i length_high)
+    {
+        const __m256i nibble = _mm256_set1_epi8(0x0f);
+        const __m256i low = _mm256_and_si256(symbols, nibble),
+                high = _mm256_and_si256(_mm256_srli_epi16(symbols, 4), nibble);
+        const __m256i classes = _mm256_and_si256(_mm256_shuffle_epi8(class_low, low),
+                                                 _mm256_shuffle_epi8(class_high, high));
+        const __m256i lengths = _mm256_or_si256(
+                _mm256_shuffle_epi8(length_low, _mm256_and_si256(classes, nibble)),
+                _mm256_shuffle_epi8(length_high,
+                                    _mm256_and_si256(_mm256_srli_epi16(classes, 4), nibble)));
+        const __m256i constants = _mm256_and_si256(
+                _mm256_cmpeq_epi8(classes, _mm256_setzero_si256()), _mm256_set1_epi8(1));
+        return _mm256_add_epi8(lengths, constants);
+    }
+
+    /**
+     * @brief Inclusive prefix sum of 8 16-bit lanes.
+     */
+    __attribute__((target("sse4.1")))
+    inline __m128i prefix_sum_sse(__m128i v)
+    {
+        v = _mm_add_epi16(v, _mm_slli_si128(v, 2));
+        v = _mm_add_epi16(v, _mm_slli_si128(v, 4));
+        return _mm_add_epi16(v, _mm_slli_si128(v, 8));
+    }
+
+    /**
+     * @brief Inclusive prefix sum of 16 16-bit lanes.
+     */
+    __attribute__((target("avx2")))
+    inline __m256i prefix_sum_avx2(__m256i v)
+    {
+        // within each 128-bit lane...
+        v = _mm256_add_epi16(v, _mm256_slli_si256(v, 2));
+        v = _mm256_add_epi16(v, _mm256_slli_si256(v, 4));
+        v = _mm256_add_epi16(v, _mm256_slli_si256(v, 8));
+        // ...then the total of the low lane is carried to the high lane
+        const __m256i low = _mm256_permute2x128_si256(v, v, 0x08);
+        return _mm256_add_epi16(v, _mm256_shuffle_epi8(low, _mm256_set1_epi16(0x0f0e)));
+    }
+
+    __attribute__((target("sse4.1")))
+    quint64 expanded_length_sse(const char *begin, const char *end, const uchar *tables[4],
+                                const char *&stop)
+    {
+        const __m128i class_low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[0])),
+                class_high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[1])),
+                length_low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[2])),
+                length_high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[3]));
+        __m128i total = _mm_setzero_si128();
+        const char *it = begin;
+        for (; end - it >= 16; it += 16)
+        {
+            const __m128i symbols = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+            const __m128i lengths = lengths_sse(symbols, class_low, class_high,
+                                                length_low, length_high);
+            total = _mm_add_epi64(total, _mm_sad_epu8(lengths, _mm_setzero_si128()));
+        }
+        stop = it;
+        return static_cast<quint64>(_mm_cvtsi128_si64(total))
+                + static_cast<quint64>(_mm_extract_epi64(total, 1));
+    }
+
+    __attribute__((target("avx2")))
+    quint64 expanded_length_avx2(const char *begin, const char *end, const uchar *tables[4],
+                                 const char *&stop)
+    {
+        const __m256i class_low = _mm256_broadcastsi128_si256(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[0]))),
+                class_high = _mm256_broadcastsi128_si256(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[1]))),
+                length_low = _mm256_broadcastsi128_si256(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[2]))),
+                length_high = _mm256_broadcastsi128_si256(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[3])));
+        __m256i total = _mm256_setzero_si256();
+        const char *it = begin;
+        for (; end - it >= 32; it += 32)
+        {
+            const __m256i symbols = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(it));
+            const __m256i lengths = lengths_avx2(symbols, class_low, class_high,
+                                                 length_low, length_high);
+            total = _mm256_add_epi64(total, _mm256_sad_epu8(lengths, _mm256_setzero_si256()));
+        }
+        stop = it;
+        return static_cast<quint64>(_mm256_extract_epi64(total, 0))
+                + static_cast<quint64>(_mm256_extract_epi64(total, 1))
+                + static_cast<quint64>(_mm256_extract_epi64(total, 2))
+                + static_cast<quint64>(_mm256_extract_epi64(total, 3));
+    }
+
+    __attribute__((target("sse4.1")))
+    char *expand_sse(const char *begin, const char *end, char *out, const uchar *tables[4],
+                     const char (*padded)[RewriteKernel::max_production_length])
+    {
+        const __m128i class_low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[0])),
+                class_high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[1])),
+                length_low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[2])),
+                length_high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[3]));
+        quint16 offsets[17];
+        offsets[0] = 0;
+        for (const char *it = begin; it != end; it += 16)
+        {
+            const __m128i symbols = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+            const __m128i lengths = lengths_sse(symbols, class_low, class_high,
+                                                length_low, length_high);
+            const __m128i low = prefix_sum_sse(_mm_cvtepu8_epi16(lengths));
+            const __m128i high = _mm_add_epi16(
+                        prefix_sum_sse(_mm_cvtepu8_epi16(_mm_srli_si128(lengths, 8))),
+                        _mm_set1_epi16(static_cast<short>(_mm_extract_epi16(low, 7))));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(offsets + 1), low);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(offsets + 9), high);
+
+            for (int i = 0; i < 16; ++i)
+            {
+                const __m128i production = _mm_loadu_si128(
+                            reinterpret_cast<const __m128i *>(padded[static_cast<uchar>(it[i])]));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + offsets[i]), production);
+            }
+            out += offsets[16];
+        }
+        return out;
+    }
+
+    __attribute__((target("avx2")))
+    char *expand_avx2(const char *begin, const char *end, char *out, const uchar *tables[4],
+                      const char (*padded)[RewriteKernel::max_production_length])
+    {
+        const __m256i class_low = _mm256_broadcastsi128_si256(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[0]))),
+                class_high = _mm256_broadcastsi128_si256(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[1]))),
+                length_low = _mm256_broadcastsi128_si256(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[2]))),
+                length_high = _mm256_broadcastsi128_si256(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[3])));
+        quint16 offsets[33];
+        offsets[0] = 0;
+        for (const char *it = begin; it != end; it += 32)
+        {
+            const __m256i symbols = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(it));
+            const __m256i lengths = lengths_avx2(symbols, class_low, class_high,
+                                                 length_low, length_high);
+            const __m256i low = prefix_sum_avx2(
+                        _mm256_cvtepu8_epi16(_mm256_castsi256_si128(lengths)));
+            const __m256i high = _mm256_add_epi16(
+                        prefix_sum_avx2(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(lengths, 1))),
+                        _mm256_set1_epi16(static_cast<short>(_mm256_extract_epi16(low, 15))));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(offsets + 1), low);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(offsets + 17), high);
+
+            for (int i = 0; i < 32; ++i)
+            {
+                const __m128i production = _mm_loadu_si128(
+                            reinterpret_cast<const __m128i *>(padded[static_cast<uchar>(it[i])]));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + offsets[i]), production);
+            }
+            out += offsets[32];
+        }
+        return out;
+    }
+}
+#endif
+
+RewriteKernel::InstructionSet RewriteKernel::supported_instruction_set()
+{
+#ifdef REWRITE_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return SSE41;
+#endif
+    return Scalar;
+}
+
+RewriteKernel::RewriteKernel() : m_applicable(false),
+    m_requested(supported_instruction_set())
+{
+    memset(m_class_low, 0, sizeof(m_class_low));
+    memset(m_class_high, 0, sizeof(m_class_high));
+    memset(m_length_low, 0, sizeof(m_length_low));
+    memset(m_length_high, 0, sizeof(m_length_high));
+    memset(m_lengths, 0, sizeof(m_lengths));
+    memset(m_padded, 0, sizeof(m_padded));
+}
+
+void RewriteKernel::compile(const ProductionTable &productions)
+{
+    memset(m_class_low, 0, sizeof(m_class_low));
+    memset(m_class_high, 0, sizeof(m_class_high));
+    memset(m_length_low, 0, sizeof(m_length_low));
+    memset(m_length_high, 0, sizeof(m_length_high));
+    memset(m_padded, 0, sizeof(m_padded));
+    m_applicable = true;
+
+    int variables = 0;
+    for (int c = 0; c < 256 && m_applicable; ++c)
+    {
+        const char symbol = static_cast<char>(c);
+        const State::size_type length = productions.production_length(symbol);
+        m_lengths[c] = static_cast<uchar>(qMin<State::size_type>(length, 255));
+        if (productions.is_constant(symbol))
+        {
+            m_padded[c][0] = symbol;
+            continue;
+        }
+        if (variables == max_variables || length > State::size_type(max_production_length))
+        {
+            m_applicable = false;
+            break;
+        }
+
+        // the class of the variable : its bit, in both nibble tables
+        const uchar bit = static_cast<uchar>(1 << variables);
+        m_class_low[c & 0x0f] |= bit;
+        m_class_high[c >> 4] |= bit;
+        if (variables < 4)
+            m_length_low[bit] = static_cast<uchar>(length);
+        else
+            m_length_high[bit >> 4] = static_cast<uchar>(length);
+        memcpy(m_padded[c], productions.production(symbol), length);
+        ++variables;
+    }
+}
+
+void RewriteKernel::set_instruction_set(InstructionSet instruction_set)
+{
+    m_requested = qMin(instruction_set, supported_instruction_set());
+}
+
+RewriteKernel::InstructionSet RewriteKernel::instruction_set() const
+{
+    return m_applicable ? m_requested : Scalar;
+}
+
+quint64 RewriteKernel::expanded_length(const char *begin, const char *end) const
+{
+    quint64 length = 0;
+    const char *it = begin;
+#ifdef REWRITE_KERNEL_X86
+    const uchar *tables[4] = { m_class_low, m_class_high, m_length_low, m_length_high };
+    if (instruction_set() == AVX2)
+        length = expanded_length_avx2(begin, end, tables, it);
+    else if (instruction_set() == SSE41)
+        length = expanded_length_sse(begin, end, tables, it);
+#endif
+    for (; it != end; ++it)
+        length += m_lengths[static_cast<uchar>(*it)];
+    return length;
+}
+
+char *RewriteKernel::expand(const char *begin, const char *end, char *out) const
+{
+#ifdef REWRITE_KERNEL_X86
+    // the last symbols, producing the last 16 bytes at least, are rewritten
+    // one at a time : the 16-byte stores of the others stay within the output
+    const char *tail = end;
+    int tail_length = 0;
+    while (tail != begin && tail_length < max_production_length)
+        tail_length += m_lengths[static_cast<uchar>(*--tail)];
+    if (tail_length < max_production_length)
+        return expand_scalar(begin, end, out);
+
+    const uchar *tables[4] = { m_class_low, m_class_high, m_length_low, m_length_high };
+    const int block = (instruction_set() == AVX2) ? 32 : 16;
+    const char *vector_end = begin + (tail - begin) / block * block;
+    if (instruction_set() == AVX2)
+        out = expand_avx2(begin, vector_end, out, tables, m_padded);
+    else if (instruction_set() == SSE41)
+        out = expand_sse(begin, vector_end, out, tables, m_padded);
+    else
+        vector_end = begin;
+    return expand_scalar(vector_end, end, out);
+#else
+    return expand_scalar(begin, end, out);
+#endif
+}
+
+char *RewriteKernel::expand_scalar(const char *begin, const char *end, char *out) const
+{
+    for (const char *it = begin; it != end; ++it)
+    {
+        const uchar symbol = static_cast<uchar>(*it);
+        memcpy(out, m_padded[symbol], m_lengths[symbol]);
+        out += m_lengths[symbol];
+    }
+    return out;
+}
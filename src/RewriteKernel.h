@@ -0,0 +1,98 @@
+#ifndef REWRITEKERNEL_H
+#define REWRITEKERNEL_H
+
+#include <QtGlobal>
+
+class ProductionTable;
+
+/**
+ * @brief RewriteKernel rewrites states 16 or 32 symbols at a time with SIMD
+ * instructions, for the grammars made of a few short productions (e.g.
+ * Algae or Sierpinski).
+ *
+ * For every block of symbols :
+ * - the symbols are classified with shuffle-based lookups : each variable
+ * has a bit, set in a table indexed by the low nibble of the symbol and in
+ * another indexed by its high nibble, and the class of a symbol is the AND
+ * of both lookups ; the lengths of the productions are then looked up from
+ * the class the same way,
+ * - the offsets of the productions in the output are an in-register prefix
+ * sum of these lengths,
+ * - every production is written with a single unaligned 16-byte store,
+ * from a table of productions padded to 16 bytes, in order : the garbage
+ * past a production is overwritten by the next one.
+ * The last symbols, whose stores could write past the output, are rewritten
+ * one at a time.
+ *
+ * The instruction set (SSE4.1 or AVX2) is chosen at runtime ; on other
+ * compilers and architectures, the kernel is never active and ProductionTable
+ * uses its scalar loops.
+ */
+class RewriteKernel
+{
+public:
+    static const int max_variables = 8;
+    static const int max_production_length = 16;
+
+    enum InstructionSet
+    {
+        Scalar, //!< the kernel is not used
+        SSE41,
+        AVX2
+    };
+
+    /**
+     * @brief The best instruction set supported by the processor.
+     */
+    static InstructionSet supported_instruction_set();
+
+    /**
+     * @brief Construct an inactive kernel.
+     */
+    RewriteKernel();
+
+    /**
+     * @brief Compile the kernel for the given productions. It is only active
+     * if they have at most max_variables variables, whose productions are
+     * at most max_production_length symbols long.
+     */
+    void compile(const ProductionTable &productions);
+
+    /**
+     * @brief Use the given instruction set, if supported and if the kernel
+     * applies to the productions ; the best one is used by default.
+     */
+    void set_instruction_set(InstructionSet instruction_set);
+
+    /**
+     * @brief The instruction set actually used : Scalar if inactive.
+     */
+    InstructionSet instruction_set() const;
+
+    inline bool is_active() const { return instruction_set() != Scalar; }
+
+    /**
+     * @brief Same as ProductionTable::expanded_length(), if active.
+     */
+    quint64 expanded_length(const char *begin, const char *end) const;
+
+    /**
+     * @brief Same as ProductionTable::expand(), if active.
+     */
+    char *expand(const char *begin, const char *end, char *out) const;
+
+private:
+    /**
+     * @brief Rewrite [begin, end) one symbol at a time.
+     */
+    char *expand_scalar(const char *begin, const char *end, char *out) const;
+
+    bool m_applicable; //!< whether the productions fit the kernel
+    InstructionSet m_requested;
+    uchar m_class_low[16], m_class_high[16]; //!< variable bits, by nibble
+    uchar m_length_low[16], m_length_high[16]; //!< production lengths, by class nibble
+    uchar m_lengths[256]; //!< production lengths, by symbol
+    char m_padded[256][max_production_length]; //!< productions, by symbol
+};
+
+#endif /* REWRITEKERNEL_H */
@@ -0,0 +1,52 @@
+#include "SegmentBuffer.h"
+
+#include <algorithm>
+
+SegmentBuffer::SegmentBuffer() : m_x(), m_y(), m_runs()
+{
+
+}
+
+void SegmentBuffer::clear()
+{
+    m_x.clear();
+    m_y.clear();
+    m_runs.clear();
+}
+
+void SegmentBuffer::reserve(quint64 points, quint64 runs)
+{
+    m_x.reserve(points);
+    m_y.reserve(points);
+    m_runs.reserve(runs);
+}
+
+void SegmentBuffer::append(const SegmentBuffer &other)
+{
+    const quint64 offset = m_x.size();
+    m_x.insert(m_x.end(), other.m_x.begin(), other.m_x.end());
+    m_y.insert(m_y.end(), other.m_y.begin(), other.m_y.end());
+    m_runs.reserve(m_runs.size() + other.m_runs.size());
+    std::vector<quint64>::const_iterator it;
+    for (it = other.m_runs.begin(); it != other.m_runs.end(); ++it)
+        m_runs.push_back(offset + *it);
+}
+
+void SegmentBuffer::assign(const float *x, const float *y, quint64 points,
+                           const quint64 *runs, quint64 run_count)
+{
+    m_x.assign(x, x + points);
+    m_y.assign(y, y + points);
+    m_runs.assign(runs, runs + run_count);
+}
+
+quint64 SegmentBuffer::run_after(quint64 point) const
+{
+    return std::upper_bound(m_runs.begin(), m_runs.end(), point) - m_runs.begin();
+}
+
+quint64 SegmentBuffer::memory_usage() const
+{
+    return (m_x.capacity() + m_y.capacity()) * sizeof(float)
+            + m_runs.capacity() * sizeof(quint64);
+}
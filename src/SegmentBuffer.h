@@ -0,0 +1,124 @@
+#ifndef SEGMENTBUFFER_H
+#define SEGMENTBUFFER_H
+
+#include <QtGlobal>
+#include <vector>
+
+/**
+ * @brief SegmentBuffer stores line segments as polyline runs, in a structure
+ * of arrays : the coordinates of all the points are contiguous floats.
+ *
+ * A run is started by move_to() and extended by line_to() ; the segments
+ * of a run join its consecutive points. Compared to a QPainterPath, this
+ * takes 8 bytes per point and no per-element bookkeeping, and the runs can
+ * be drawn in batches.
+ *
+ * std::vector is used rather than QVector, which is limited to 2 GB.
+ */
+class SegmentBuffer
+{
+public:
+    SegmentBuffer();
+
+    /**
+     * @brief Remove all the points.
+     */
+    void clear();
+
+    /**
+     * @brief Reserve room for the given number of points and of runs.
+     */
+    void reserve(quint64 points, quint64 runs = 0);
+
+    /**
+     * @brief Append the runs of other.
+     */
+    void append(const SegmentBuffer &other);
+
+    /**
+     * @brief Start a new run at (x, y).
+     */
+    inline void move_to(float x, float y)
+    {
+        m_runs.push_back(m_x.size());
+        m_x.push_back(x);
+        m_y.push_back(y);
+    }
+
+    /**
+     * @brief Extend the current run to (x, y). A run must have been started.
+     */
+    inline void line_to(float x, float y)
+    {
+        m_x.push_back(x);
+        m_y.push_back(y);
+    }
+
+    inline quint64 run_count() const { return m_runs.size(); }
+    inline quint64 point_count() const { return m_x.size(); }
+    inline quint64 segment_count() const { return point_count() - run_count(); }
+    inline bool is_empty() const { return m_x.empty(); }
+
+    /**
+     * @brief Index of the first point of the given run.
+     */
+    inline quint64 run_begin(quint64 run) const { return m_runs[run]; }
+
+    /**
+     * @brief Index past the last point of the given run.
+     */
+    inline quint64 run_end(quint64 run) const
+    {
+        return (run + 1 < m_runs.size()) ? m_runs[run + 1] : m_x.size();
+    }
+
+    /**
+     * @brief Index of the first run starting after the given point, or
+     * run_count() if none.
+     */
+    quint64 run_after(quint64 point) const;
+
+    /**
+     * @brief Call function(i) for every segment starting at a point i of
+     * [begin, end), i.e. joining the points i and i + 1 of a run.
+     */
+    template <typename Function>
+    void for_each_segment(quint64 begin, quint64 end, Function function) const
+    {
+        quint64 run = run_after(begin);
+        for (quint64 i = begin; i < end && i + 1 < point_count(); ++i)
+        {
+            // i + 1 starting a run : no segment between i and i + 1
+            if (run < run_count() && i + 1 == m_runs[run])
+                ++run;
+            else
+                function(i);
+        }
+    }
+
+    inline const float *x() const { return m_x.data(); }
+    inline const float *y() const { return m_y.data(); }
+
+    /**
+     * @brief Index of the first point of every run.
+     */
+    inline const quint64 *runs() const { return m_runs.data(); }
+
+    /**
+     * @brief Replace the content by the given arrays, as returned by x(),
+     * y() and runs() : e.g. to read a buffer back from a file.
+     */
+    void assign(const float *x, const float *y, quint64 points,
+                const quint64 *runs, quint64 run_count);
+
+    /**
+     * @brief Memory used by the buffer, in bytes.
+     */
+    quint64 memory_usage() const;
+
+private:
+    std::vector<float> m_x, m_y; //!< coordinates of the points
+    std::vector<quint64> m_runs; //!< index of the first point of each run
+};
+
+#endif /* SEGMENTBUFFER_H */
@@ -0,0 +1,111 @@
+#include "SegmentGrid.h"
+
+#include <QVector>
+#include <cmath>
+#include "Parallel.h"
+
+const int SegmentGrid::max_cells_per_axis = 512;
+const int SegmentGrid::segments_per_cell = 16;
+const int grid_chunks_per_thread = 2; // each chunk counts all the cells
+const quint64 min_grid_chunk_length = 1 << 16;
+
+SegmentGrid::SegmentGrid() :
+    m_bounds(), m_cell_size(1), m_columns(0), m_rows(0), m_extent(0),
+    m_offsets(), m_segments()
+{
+
+}
+
+void SegmentGrid::build(const SegmentBuffer &segments, const QRectF &bounds,
+                        TaskScheduler &scheduler)
+{
+    clear();
+    const quint64 count = segments.segment_count();
+    if (count == 0)
+        return;
+
+    // square cells, about segments_per_cell segments in each
+    m_bounds = bounds;
+    const qreal width = qMax<qreal>(bounds.width(), 1e-6),
+            height = qMax<qreal>(bounds.height(), 1e-6);
+    const qreal cells = qMax<qreal>(1, static_cast<qreal>(count) / segments_per_cell);
+    m_cell_size = qMax(std::sqrt(width * height / cells),
+                       qMax(width, height) / max_cells_per_axis);
+    m_columns = qBound(1, static_cast<int>(std::ceil(width / m_cell_size)), max_cells_per_axis);
+    m_rows = qBound(1, static_cast<int>(std::ceil(height / m_cell_size)), max_cells_per_axis);
+    const int cell_count = m_columns * m_rows;
+
+    const quint64 points = segments.point_count();
+    const int chunk_count = static_cast<int>(qBound<quint64>(1, points / min_grid_chunk_length,
+            scheduler.thread_count() * grid_chunks_per_thread));
+    const float *xs = segments.x(), *ys = segments.y();
+
+    // count the segments of every cell, by chunk
+    QVector<std::vector<quint64> > starts(chunk_count);
+    QVector<qreal> extents(chunk_count, 0);
+    parallel_for(scheduler, chunk_count, [&](int c) {
+        std::vector<quint64> &counts = starts[c];
+        counts.assign(cell_count, 0);
+        qreal &extent = extents[c];
+        segments.for_each_segment(c * points / chunk_count, (c + 1) * points / chunk_count,
+                                  [&](quint64 i) {
+            ++counts[cell_of(xs[i], ys[i])];
+            extent = qMax<qreal>(extent, qMax(qAbs(xs[i + 1] - xs[i]), qAbs(ys[i + 1] - ys[i])));
+        });
+    });
+
+    // where each chunk writes into each cell, keeping the order
+    m_offsets.resize(cell_count + 1);
+    quint64 offset = 0;
+    for (int cell = 0; cell < cell_count; ++cell)
+    {
+        m_offsets[cell] = offset;
+        for (int c = 0; c < chunk_count; ++c)
+        {
+            const quint64 n = starts[c][cell];
+            starts[c][cell] = offset;
+            offset += n;
+        }
+    }
+    m_offsets[cell_count] = offset;
+    for (int c = 0; c < chunk_count; ++c)
+        m_extent = qMax(m_extent, extents[c]);
+
+    // fill the cells
+    m_segments.resize(offset);
+    parallel_for(scheduler, chunk_count, [&](int c) {
+        std::vector<quint64> &next = starts[c];
+        segments.for_each_segment(c * points / chunk_count, (c + 1) * points / chunk_count,
+                                  [&](quint64 i) {
+            m_segments[next[cell_of(xs[i], ys[i])]++] = i;
+        });
+    });
+}
+
+void SegmentGrid::clear()
+{
+    m_bounds = QRectF();
+    m_cell_size = 1;
+    m_columns = m_rows = 0;
+    m_extent = 0;
+    std::vector<quint64>().swap(m_offsets);
+    std::vector<quint64>().swap(m_segments);
+}
+
+quint64 SegmentGrid::memory_usage() const
+{
+    return (m_offsets.capacity() + m_segments.capacity()) * sizeof(quint64);
+}
+
+bool SegmentGrid::cell_range(const QRectF &area, int &left, int &top,
+                             int &right, int &bottom) const
+{
+    if (area.right() < m_bounds.left() || area.left() > m_bounds.right()
+            || area.bottom() < m_bounds.top() || area.top() > m_bounds.bottom())
+        return false;
+    const int top_left = cell_of(area.left(), area.top()),
+            bottom_right = cell_of(area.right(), area.bottom());
+    left = top_left % m_columns, top = top_left / m_columns;
+    right = bottom_right % m_columns, bottom = bottom_right / m_columns;
+    return true;
+}
@@ -0,0 +1,108 @@
+#ifndef SEGMENTGRID_H
+#define SEGMENTGRID_H
+
+#include <QRectF>
+#include <vector>
+
+#include "SegmentBuffer.h"
+#include "TaskScheduler.h"
+
+/**
+ * @brief SegmentGrid is a spatial index over the segments of a SegmentBuffer :
+ * a uniform grid over their bounding box, each cell listing the segments
+ * starting inside it.
+ *
+ * Every segment is stored once, in the cell of its first point ; the
+ * queries are thus extended by the largest extent of a segment (one unit for
+ * a TurtleGeometry). The cells are stored contiguously (compressed rows),
+ * keeping the order of the segments within each cell.
+ *
+ * The grid is built in parallel, and only refers to the buffer by index :
+ * it must be rebuilt whenever the buffer changes.
+ */
+class SegmentGrid
+{
+public:
+    static const int max_cells_per_axis;
+    static const int segments_per_cell; //!< on average, when possible
+
+    SegmentGrid();
+
+    /**
+     * @brief Index segments, whose points are inside bounds.
+     */
+    void build(const SegmentBuffer &segments, const QRectF &bounds, TaskScheduler &scheduler);
+
+    /**
+     * @brief Remove all the segments.
+     */
+    void clear();
+
+    inline bool is_empty() const { return m_segments.empty(); }
+    inline int columns() const { return m_columns; }
+    inline int rows() const { return m_rows; }
+
+    /**
+     * @brief Largest extent of a segment along an axis.
+     */
+    inline qreal extent() const { return m_extent; }
+
+    /**
+     * @brief Call visitor(i) for every segment i (joining the points i and
+     * i + 1) possibly intersecting area, cell by cell.
+     *
+     * Segments near area may be visited too, but never twice.
+     */
+    template <typename Visitor>
+    void visit(const QRectF &area, Visitor visitor) const
+    {
+        if (is_empty())
+            return;
+        int left, top, right, bottom;
+        if (!cell_range(area.adjusted(-m_extent, -m_extent, m_extent, m_extent),
+                        left, top, right, bottom))
+            return;
+        for (int row = top; row <= bottom; ++row)
+        {
+            const int first = row * m_columns;
+            const quint64 begin = m_offsets[first + left],
+                    end = m_offsets[first + right + 1];
+            for (quint64 k = begin; k < end; ++k)
+                visitor(m_segments[k]);
+        }
+    }
+
+    /**
+     * @brief Memory used by the grid, in bytes.
+     */
+    quint64 memory_usage() const;
+
+private:
+    /**
+     * @brief Cell containing the point (x, y), clamped to the grid.
+     */
+    inline int cell_of(qreal x, qreal y) const
+    {
+        // clamped before the conversion, which would overflow far outside
+        const int column = static_cast<int>(qBound<qreal>(
+                0, (x - m_bounds.left()) / m_cell_size, m_columns - 1));
+        const int row = static_cast<int>(qBound<qreal>(
+                0, (y - m_bounds.top()) / m_cell_size, m_rows - 1));
+        return row * m_columns + column;
+    }
+
+    /**
+     * @brief The cells overlapping area.
+     * @return False if there is none.
+     */
+    bool cell_range(const QRectF &area, int &left, int &top, int &right, int &bottom) const;
+
+    QRectF m_bounds;
+    qreal m_cell_size;
+    int m_columns, m_rows;
+    qreal m_extent;
+    std::vector<quint64> m_offsets; //!< the segments of cell c are in [offsets[c], offsets[c + 1])
+    std::vector<quint64> m_segments;
+};
+
+#endif /* SEGMENTGRID_H */
@@ -0,0 +1,224 @@
+#include "TaskScheduler.h"
+
+#include <QThread>
+#include <utility>
+
+namespace
+{
+    // the scheduler and the index of the worker running on this thread
+    thread_local const TaskScheduler *current_scheduler = nullptr;
+    thread_local int current_index = -1;
+}
+
+/**
+ * @brief A thread of a TaskScheduler.
+ */
+class TaskWorker : public QThread
+{
+public:
+    TaskWorker(TaskScheduler &scheduler, int index) :
+        m_scheduler(scheduler), m_index(index) { }
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        current_scheduler = &m_scheduler;
+        current_index = m_index;
+        m_scheduler.work(m_index);
+    }
+
+private:
+    TaskScheduler &m_scheduler;
+    const int m_index;
+};
+
+TaskScheduler::TaskScheduler(int thread_count) :
+    m_queues(), m_injected(), m_workers(), m_pending(0), m_sleep_mutex(),
+    m_wake(), m_stopping(false)
+{
+    const int count = thread_count > 0 ? thread_count : qMax(1, QThread::idealThreadCount());
+    for (int i = 0; i < count; ++i)
+        m_queues.append(new TaskQueue());
+    for (int i = 0; i < count; ++i)
+        m_workers.append(new TaskWorker(*this, i));
+    for (int i = 0; i < count; ++i)
+        m_workers[i]->start();
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    m_sleep_mutex.lock();
+    m_stopping = true;
+    m_wake.wakeAll();
+    m_sleep_mutex.unlock();
+
+    for (int i = 0; i < m_workers.size(); ++i)
+    {
+        m_workers[i]->wait();
+        delete m_workers[i];
+    }
+    qDeleteAll(m_queues);
+}
+
+TaskScheduler &TaskScheduler::global_instance()
+{
+    static TaskScheduler scheduler;
+    return scheduler;
+}
+
+void TaskScheduler::submit(Task task)
+{
+    const int index = current_worker();
+    TaskQueue &queue = index >= 0 ? *m_queues[index] : m_injected;
+    queue.mutex.lock();
+    queue.tasks.push_back(std::move(task));
+    queue.mutex.unlock();
+    m_pending.fetchAndAddOrdered(1);
+
+    // an idle worker checks m_pending while holding the mutex : it cannot
+    // miss this wake-up
+    m_sleep_mutex.lock();
+    m_wake.wakeOne();
+    m_sleep_mutex.unlock();
+}
+
+void TaskScheduler::work(int index)
+{
+    Task task;
+    forever
+    {
+        if (pop(index, task) || steal(index, task) || take_injected(task))
+        {
+            task();
+            task = Task(); // release what it holds right away
+            continue;
+        }
+
+        QMutexLocker locker(&m_sleep_mutex);
+        if (m_pending.loadAcquire() > 0)
+            continue;
+        if (m_stopping)
+            return;
+        m_wake.wait(&m_sleep_mutex);
+    }
+}
+
+bool TaskScheduler::pop(int index, Task &task)
+{
+    TaskQueue &queue = *m_queues[index];
+    QMutexLocker locker(&queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    m_pending.fetchAndAddOrdered(-1);
+    return true;
+}
+
+bool TaskScheduler::steal(int index, Task &task)
+{
+    // from the next queue on, so that the thieves spread over the victims
+    const int count = m_queues.size();
+    for (int i = 1; i <= count; ++i)
+    {
+        const int victim = (index + i) % count;
+        if (victim == index)
+            continue;
+        TaskQueue &queue = *m_queues[victim];
+        QMutexLocker locker(&queue.mutex);
+        if (queue.tasks.empty())
+            continue;
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        m_pending.fetchAndAddOrdered(-1);
+        return true;
+    }
+    return false;
+}
+
+bool TaskScheduler::take_injected(Task &task)
+{
+    QMutexLocker locker(&m_injected.mutex);
+    if (m_injected.tasks.empty())
+        return false;
+    task = std::move(m_injected.tasks.front());
+    m_injected.tasks.pop_front();
+    m_pending.fetchAndAddOrdered(-1);
+    return true;
+}
+
+int TaskScheduler::current_worker() const
+{
+    return current_scheduler == this ? current_index : -1;
+}
+
+TaskGroup::State::State() : mutex(), changed(), tasks(), pending(0)
+{
+
+}
+
+TaskGroup::TaskGroup(TaskScheduler &scheduler) :
+    m_scheduler(scheduler), m_state(new State())
+{
+
+}
+
+TaskGroup::~TaskGroup()
+{
+    wait();
+}
+
+void TaskGroup::run(Task task)
+{
+    m_state->pending.fetchAndAddOrdered(1);
+    m_state->mutex.lock();
+    m_state->tasks.push_back(std::move(task));
+    m_state->changed.wakeAll();
+    m_state->mutex.unlock();
+
+    // the ticket finds nothing if the waiting thread ran the task already
+    QSharedPointer<State> state = m_state;
+    m_scheduler.submit([state]() { run_next(*state, false); });
+}
+
+void TaskGroup::wait()
+{
+    while (!is_done())
+    {
+        if (run_next(*m_state, true))
+            continue;
+        // the tasks left are running on other threads : wait for them, or
+        // for the tasks they add to the group
+        QMutexLocker locker(&m_state->mutex);
+        if (!is_done() && m_state->tasks.empty())
+            m_state->changed.wait(&m_state->mutex);
+    }
+}
+
+bool TaskGroup::run_next(State &state, bool recent)
+{
+    Task task;
+    {
+        QMutexLocker locker(&state.mutex);
+        if (state.tasks.empty())
+            return false;
+        if (recent)
+        {
+            task = std::move(state.tasks.back());
+            state.tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(state.tasks.front());
+            state.tasks.pop_front();
+        }
+    }
+    task();
+    task = Task(); // release what it holds before the group is done
+
+    // under the mutex : the waiting thread checks is_done() while holding it
+    QMutexLocker locker(&state.mutex);
+    if (state.pending.fetchAndAddOrdered(-1) == 1)
+        state.changed.wakeAll();
+    return true;
+}
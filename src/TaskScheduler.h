@@ -0,0 +1,172 @@
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QVector>
+#include <QSharedPointer>
+#include <deque>
+#include <functional>
+
+class TaskWorker;
+
+/**
+ * @brief A unit of work for a TaskScheduler.
+ */
+typedef std::function<void()> Task;
+
+/**
+ * @brief TaskScheduler runs tasks on a fixed set of worker threads, shared by
+ * all the stages of the renderer : iteration, interpretation, rasterization.
+ *
+ * Every worker has its own deque of tasks. A task submitted from a worker is
+ * pushed onto the back of its deque, which the worker pops first (the most
+ * recent task, whose data is still in its cache) ; an idle worker steals from
+ * the front of the others' deques (the oldest task, usually the biggest).
+ * Tasks submitted from any other thread go to a shared injection queue, which
+ * the workers only take from when there is nothing left to steal : the work
+ * already started is finished before a new one is begun.
+ *
+ * Since the stages submit many small tasks to the same workers rather than
+ * each owning its threads, they overlap and balance : a worker done with the
+ * chunks of one stage picks those of the next one, or those of another job.
+ * Tasks may themselves submit tasks and wait for them (see TaskGroup).
+ */
+class TaskScheduler
+{
+public:
+    /**
+     * @brief Start the workers.
+     * @param thread_count The number of worker threads (0 : one per core).
+     */
+    explicit TaskScheduler(int thread_count = 0);
+
+    /**
+     * @brief Run the tasks left, then stop the workers.
+     */
+    ~TaskScheduler();
+
+    /**
+     * @brief The scheduler shared by the whole application, with one worker
+     * per core.
+     */
+    static TaskScheduler &global_instance();
+
+    inline int thread_count() const { return m_workers.size(); }
+
+    /**
+     * @brief Run task on a worker. Thread-safe.
+     */
+    void submit(Task task);
+
+private:
+    friend class TaskWorker;
+
+    /**
+     * @brief The deque of tasks of a worker.
+     */
+    struct TaskQueue
+    {
+        QMutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    /**
+     * @brief Main loop of the worker index.
+     */
+    void work(int index);
+
+    /**
+     * @brief Pop the most recent task of the queue index.
+     */
+    bool pop(int index, Task &task);
+
+    /**
+     * @brief Steal the oldest task of a queue other than index.
+     */
+    bool steal(int index, Task &task);
+
+    /**
+     * @brief Take the oldest task submitted by a thread other than the workers.
+     */
+    bool take_injected(Task &task);
+
+    /**
+     * @brief Index of the calling thread among the workers, or -1.
+     */
+    int current_worker() const;
+
+    QVector<TaskQueue *> m_queues;
+    TaskQueue m_injected; //!< the tasks submitted by other threads
+    QVector<TaskWorker *> m_workers;
+    QAtomicInt m_pending; //!< number of tasks in the queues
+    QMutex m_sleep_mutex;
+    QWaitCondition m_wake; //!< idle workers wait on it
+    bool m_stopping;
+};
+
+/**
+ * @brief TaskGroup runs tasks on a TaskScheduler and waits for them.
+ *
+ * The group keeps its tasks until they are started, the scheduler only
+ * being handed a ticket for each, which runs the oldest task of the group
+ * left (if any). The waiting thread helps : it runs the tasks of the group
+ * not started yet, most recent first, so that tasks can wait for the tasks
+ * they submitted without starving the workers. It never runs a task of
+ * another group, which could be unrelated and long.
+ */
+class TaskGroup
+{
+public:
+    explicit TaskGroup(TaskScheduler &scheduler);
+
+    /**
+     * @brief Wait for the tasks left.
+     */
+    ~TaskGroup();
+
+    /**
+     * @brief Run task on the scheduler, as part of the group. Thread-safe.
+     */
+    void run(Task task);
+
+    /**
+     * @brief Wait until all the tasks of the group are done.
+     */
+    void wait();
+
+    /**
+     * @brief Whether all the tasks of the group are done. Thread-safe.
+     */
+    inline bool is_done() const { return m_state->pending.load() == 0; }
+
+private:
+    Q_DISABLE_COPY(TaskGroup)
+
+    /**
+     * @brief The tasks of a group, shared with the tickets, which can run
+     * after the group is destroyed.
+     */
+    struct State
+    {
+        State();
+
+        QMutex mutex;
+        QWaitCondition changed; //!< a task was added, or the last one is done
+        std::deque<Task> tasks; //!< not started yet
+        QAtomicInt pending; //!< number of tasks not done yet
+    };
+
+    /**
+     * @brief Run the most recent (or else the oldest) task of state not
+     * started yet.
+     * @return False if there was none.
+     */
+    static bool run_next(State &state, bool recent);
+
+    TaskScheduler &m_scheduler;
+    QSharedPointer<State> m_state;
+};
+
+#endif /* TASKSCHEDULER_H */
@@ -0,0 +1,244 @@
+#include "TileRasterizer.h"
+
+#include <QFile>
+#include <QPainter>
+#include <QVarLengthArray>
+#include "Parallel.h"
+
+const quint64 TileRasterizer::default_band_memory = Q_UINT64_C(64) << 20;
+const int bin_chunks_per_thread = 4; // for load balancing
+const quint64 min_bin_chunk_length = 1 << 16;
+const int tile_line_batch = 1024; // maximal number of lines per draw call
+
+namespace
+{
+    typedef std::vector<quint64> SegmentBin;
+
+    /**
+     * @brief The bins [first, last] crossed by the interval [low, high] of
+     * pixels, along an axis of limit pixels cut into bins of tile pixels.
+     * @return False if the interval is outside of the axis.
+     */
+    inline bool bin_range(qreal low, qreal high, int tile, int limit,
+                          int &first, int &last)
+    {
+        if (high < 0 || low >= limit)
+            return false;
+        first = static_cast<int>(qMax<qreal>(0, low)) / tile;
+        last = static_cast<int>(qMin<qreal>(limit - 1, high)) / tile;
+        return true;
+    }
+
+    /**
+     * @brief Bin count items into bins, in parallel : bin_chunk(begin, end,
+     * bins) bins the items [begin, end) into its own bins, which are then
+     * concatenated in order.
+     */
+    template <typename BinChunk>
+    QVector<SegmentBin> parallel_bin(TaskScheduler &scheduler, quint64 count, int bins,
+                                     BinChunk bin_chunk)
+    {
+        const int chunk_count = static_cast<int>(qBound<quint64>(1, count / min_bin_chunk_length,
+                scheduler.thread_count() * bin_chunks_per_thread));
+        QVector<QVector<SegmentBin> > chunks(chunk_count);
+        parallel_for(scheduler, chunk_count, [&](int c) {
+            chunks[c].resize(bins);
+            bin_chunk(c * count / chunk_count, (c + 1) * count / chunk_count, chunks[c]);
+        });
+
+        QVector<SegmentBin> merged(bins);
+        parallel_for(scheduler, bins, [&](int b) {
+            size_t size = 0;
+            for (int c = 0; c < chunk_count; ++c)
+                size += chunks[c][b].size();
+            merged[b].reserve(size);
+            for (int c = 0; c < chunk_count; ++c)
+            {
+                merged[b].insert(merged[b].end(), chunks[c][b].begin(), chunks[c][b].end());
+                SegmentBin().swap(chunks[c][b]); // free it right away
+            }
+        });
+        return merged;
+    }
+}
+
+TileRasterizer::TileRasterizer(TaskScheduler &scheduler) :
+    m_scheduler(scheduler), m_tile_size(default_tile_size), m_pen(Qt::black), m_background(Qt::white),
+    m_antialiasing(true), m_band_memory(default_band_memory), m_progress(),
+    m_tile_count(0), m_tiles_done(0), m_last_progress(0)
+{
+    m_pen.setCosmetic(true);
+}
+
+QImage TileRasterizer::render(const SegmentBuffer &segments, const QTransform &transform,
+                              const QSize &size)
+{
+    if (size.isEmpty())
+        return QImage();
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    if (image.isNull())
+        return image;
+
+    const QVector<SegmentBin> rows = bin_rows(segments, transform, size);
+    const int columns = (size.width() + m_tile_size - 1) / m_tile_size;
+    m_tile_count = rows.size() * columns;
+    m_tiles_done.store(0), m_last_progress.store(0);
+    render_band(segments, transform, size, rows, 0, rows.size(), image);
+    return image;
+}
+
+bool TileRasterizer::render_to_file(const SegmentBuffer &segments, const QTransform &transform,
+                                    const QSize &size, const QString &path)
+{
+    if (size.isEmpty())
+        return false;
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    const QByteArray header = QString("P6\n%1 %2\n255\n").arg(size.width())
+            .arg(size.height()).toLatin1();
+    if (file.write(header) != header.size())
+        return false;
+
+    QVector<SegmentBin> rows = bin_rows(segments, transform, size);
+    const int columns = (size.width() + m_tile_size - 1) / m_tile_size;
+    m_tile_count = rows.size() * columns;
+    m_tiles_done.store(0), m_last_progress.store(0);
+
+    // as many rows of tiles per band as the memory allows
+    const quint64 row_memory = quint64(size.width()) * m_tile_size * 4;
+    const int band_rows = static_cast<int>(qBound<quint64>(1, m_band_memory / row_memory,
+                                                           rows.size()));
+    QImage band(size.width(), band_rows * m_tile_size, QImage::Format_ARGB32_Premultiplied);
+    if (band.isNull())
+        return false;
+
+    QByteArray line(3 * size.width(), 0);
+    for (int first = 0; first < rows.size(); first += band_rows)
+    {
+        const int last = qMin(rows.size(), first + band_rows);
+        render_band(segments, transform, size, rows, first, last, band);
+        for (int r = first; r < last; ++r)
+            SegmentBin().swap(rows[r]);
+
+        // premultiplied pixels : the transparency is dropped
+        const int height = qMin(last * m_tile_size, size.height()) - first * m_tile_size;
+        for (int y = 0; y < height; ++y)
+        {
+            const QRgb *pixels = reinterpret_cast<const QRgb *>(band.constScanLine(y));
+            char *rgb = line.data();
+            for (int x = 0; x < size.width(); ++x)
+            {
+                *rgb++ = static_cast<char>(qRed(pixels[x]));
+                *rgb++ = static_cast<char>(qGreen(pixels[x]));
+                *rgb++ = static_cast<char>(qBlue(pixels[x]));
+            }
+            if (file.write(line) != line.size())
+                return false;
+        }
+    }
+    return file.flush();
+}
+
+QVector<TileRasterizer::SegmentBin> TileRasterizer::bin_rows(const SegmentBuffer &segments,
+                                                             const QTransform &transform,
+                                                             const QSize &size) const
+{
+    const int rows = (size.height() + m_tile_size - 1) / m_tile_size;
+    const float *ys = segments.y();
+    const qreal sy = transform.m22(), dy = transform.dy(), pad = padding();
+
+    return parallel_bin(m_scheduler, segments.point_count(), rows,
+                        [&](quint64 begin, quint64 end, QVector<SegmentBin> &bins)
+    {
+        segments.for_each_segment(begin, end, [&](quint64 i) {
+            const qreal y0 = sy * ys[i] + dy, y1 = sy * ys[i + 1] + dy;
+            int first, last;
+            if (!bin_range(qMin(y0, y1) - pad, qMax(y0, y1) + pad, m_tile_size,
+                           size.height(), first, last))
+                return;
+            for (int r = first; r <= last; ++r)
+                bins[r].push_back(i);
+        });
+    });
+}
+
+void TileRasterizer::render_band(const SegmentBuffer &segments, const QTransform &transform,
+                                 const QSize &size, const QVector<SegmentBin> &rows,
+                                 int first, int last, QImage &band)
+{
+    const int columns = (size.width() + m_tile_size - 1) / m_tile_size;
+    const float *xs = segments.x(), *ys = segments.y();
+    const qreal sx = transform.m11(), sy = transform.m22(),
+            dx = transform.dx(), dy = transform.dy(), pad = padding();
+
+    // bin the segments of every row by column
+    QVector<QVector<SegmentBin> > tiles;
+    for (int r = first; r < last; ++r)
+    {
+        const SegmentBin &row = rows[r];
+        tiles.append(parallel_bin(m_scheduler, row.size(), columns,
+                                  [&](quint64 begin, quint64 end, QVector<SegmentBin> &bins)
+        {
+            for (quint64 k = begin; k < end; ++k)
+            {
+                const quint64 i = row[k];
+                const qreal x0 = sx * xs[i] + dx, x1 = sx * xs[i + 1] + dx;
+                int first_column, last_column;
+                if (!bin_range(qMin(x0, x1) - pad, qMax(x0, x1) + pad, m_tile_size,
+                               size.width(), first_column, last_column))
+                    continue;
+                for (int c = first_column; c <= last_column; ++c)
+                    bins[c].push_back(i);
+            }
+        }));
+    }
+
+    // paint every tile in place : bits() is called once, as it may detach
+    uchar *bits = band.bits();
+    const int bytes_per_line = band.bytesPerLine();
+    const QImage::Format format = band.format();
+    const int band_top = first * m_tile_size;
+    parallel_for(m_scheduler, (last - first) * columns, [&](int t) {
+        const int r = t / columns, c = t % columns;
+        const QRect tile = QRect(c * m_tile_size, (first + r) * m_tile_size,
+                                 m_tile_size, m_tile_size) & QRect(QPoint(0, 0), size);
+        QImage image(bits + (tile.y() - band_top) * bytes_per_line + tile.x() * 4,
+                     tile.width(), tile.height(), bytes_per_line, format);
+        image.fill(m_background);
+
+        QPainter painter(&image);
+        painter.setRenderHint(QPainter::Antialiasing, m_antialiasing);
+        painter.setPen(m_pen);
+        const qreal tx = dx - tile.x(), ty = dy - tile.y();
+        auto map = [&](quint64 i) { return QPointF(sx * xs[i] + tx, sy * ys[i] + ty); };
+        QVarLengthArray<QLineF, tile_line_batch> lines;
+        const SegmentBin &bin = tiles[r][c];
+        for (SegmentBin::const_iterator it = bin.begin(); it != bin.end(); ++it)
+        {
+            lines.append(QLineF(map(*it), map(*it + 1)));
+            if (lines.size() == tile_line_batch)
+            {
+                painter.drawLines(lines.constData(), lines.size());
+                lines.clear();
+            }
+        }
+        if (!lines.isEmpty())
+            painter.drawLines(lines.constData(), lines.size());
+        painter.end();
+
+        if (m_progress)
+        {
+            const int progress = 100 * (m_tiles_done.fetchAndAddRelaxed(1) + 1) / m_tile_count;
+            const int last_progress = m_last_progress.load();
+            if (progress > last_progress
+                    && m_last_progress.testAndSetRelaxed(last_progress, progress))
+                m_progress(progress);
+        }
+    });
+}
+
+qreal TileRasterizer::padding() const
+{
+    return qMax<qreal>(1, m_pen.widthF()) / 2 + 1;
+}
@@ -0,0 +1,110 @@
+#ifndef TILERASTERIZER_H
+#define TILERASTERIZER_H
+
+#include <QImage>
+#include <QPen>
+#include <QTransform>
+#include <QAtomicInt>
+#include <functional>
+
+#include "SegmentBuffer.h"
+#include "TaskScheduler.h"
+
+/**
+ * @brief TileRasterizer draws segments into an image using a TaskScheduler.
+ *
+ * The image is split into square tiles. The segments are first binned by
+ * the rows of tiles they cross, then by tile within each row, and every tile
+ * is painted concurrently with its own QPainter, directly into its part of
+ * the image. Each tile only draws its own segments, in their original order.
+ *
+ * Images too big to be kept in memory (say 32k x 32k) can be streamed to a
+ * file, band of tile rows by band of tile rows (see render_to_file()).
+ *
+ * Any thread can use a TileRasterizer : no QPixmap nor widget is involved.
+ */
+class TileRasterizer
+{
+public:
+    static const int default_tile_size = 256; //!< in pixels
+    static const quint64 default_band_memory; //!< in bytes, see render_to_file()
+
+    /**
+     * @brief Constructor.
+     * @param scheduler The scheduler to run the tiles on.
+     */
+    explicit TileRasterizer(TaskScheduler &scheduler);
+
+    inline void set_tile_size(int size) { m_tile_size = qMax(1, size); }
+    inline int tile_size() const { return m_tile_size; }
+    inline void set_pen(const QPen &pen) { m_pen = pen; }
+    inline void set_background(const QColor &color) { m_background = color; }
+    inline void set_antialiasing(bool enabled) { m_antialiasing = enabled; }
+
+    /**
+     * @brief Set the maximal memory used by a band when streaming.
+     */
+    inline void set_band_memory(quint64 bytes) { m_band_memory = bytes; }
+
+    /**
+     * @brief Set the function called with the percentage of the tiles done,
+     * from any thread, whenever it increases.
+     */
+    inline void set_progress(std::function<void(uint)> progress) { m_progress = progress; }
+
+    /**
+     * @brief Draw segments, mapped with transform, into a new image.
+     *
+     * The transform must only be made of a scaling and a translation (see
+     * TurtleGeometry::fit()).
+     * @return The image, in QImage::Format_ARGB32_Premultiplied, or a null
+     * image if it could not be allocated.
+     */
+    QImage render(const SegmentBuffer &segments, const QTransform &transform,
+                  const QSize &size);
+
+    /**
+     * @brief Draw segments like render(), streaming the image into a binary
+     * PPM file : only a band of tile rows is kept in memory at once.
+     * @return False if the file could not be written.
+     */
+    bool render_to_file(const SegmentBuffer &segments, const QTransform &transform,
+                        const QSize &size, const QString &path);
+
+private:
+    /**
+     * @brief Indices of the first point of segments.
+     */
+    typedef std::vector<quint64> SegmentBin;
+
+    /**
+     * @brief Bin the segments by the rows of tiles they cross.
+     */
+    QVector<SegmentBin> bin_rows(const SegmentBuffer &segments, const QTransform &transform,
+                                 const QSize &size) const;
+
+    /**
+     * @brief Paint the rows [first, last) of tiles into band, whose first
+     * line is the top of the row first.
+     */
+    void render_band(const SegmentBuffer &segments, const QTransform &transform,
+                     const QSize &size, const QVector<SegmentBin> &rows,
+                     int first, int last, QImage &band);
+
+    /**
+     * @brief Half of the width of the pen, plus one pixel for antialiasing.
+     */
+    qreal padding() const;
+
+    TaskScheduler &m_scheduler;
+    int m_tile_size;
+    QPen m_pen;
+    QColor m_background;
+    bool m_antialiasing;
+    quint64 m_band_memory;
+    std::function<void(uint)> m_progress;
+    int m_tile_count; //!< of the image being rendered
+    QAtomicInt m_tiles_done, m_last_progress;
+};
+
+#endif /* TILERASTERIZER_H */
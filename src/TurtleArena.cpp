@@ -0,0 +1,131 @@
+#include "TurtleArena.h"
+
+#include "DerivationTree.h"
+
+#include <limits>
+
+const quint64 TurtleArena::default_budget = Q_UINT64_C(256) << 20;
+const int TurtleArena::max_reserved_depth = 1 << 16;
+
+namespace
+{
+    const quint64 saturated = std::numeric_limits<quint64>::max();
+    const qint64 depth_limit = std::numeric_limits<int>::max();
+
+    inline quint64 saturated_add(quint64 a, quint64 b)
+    {
+        return (a > saturated - b) ? saturated : a + b;
+    }
+
+    /**
+     * @brief Profile of a sequence of symbols, added up one symbol at a time.
+     */
+    struct SequenceProfile
+    {
+        SequenceProfile() : moves(0), closes(0), depth(0), peak(0) { }
+
+        inline void add(const SequenceProfile &symbol)
+        {
+            moves = saturated_add(moves, symbol.moves);
+            closes = saturated_add(closes, symbol.closes);
+            peak = qMax(peak, qBound(-depth_limit, depth + symbol.peak, depth_limit));
+            depth = qBound(-depth_limit, depth + symbol.depth, depth_limit);
+        }
+
+        quint64 moves;
+        quint64 closes; //!< number of ']'
+        qint64 depth; //!< of the brackets at the end of the sequence
+        qint64 peak; //!< deepest nesting reached
+    };
+}
+
+quint64 TurtleProfile::points() const
+{
+    return saturated_add(moves, runs);
+}
+
+TurtleArena::TurtleArena(quint64 budget) :
+    geometry(), stack(), turtle_stack(), chunks(), m_budget(budget)
+{
+
+}
+
+TurtleProfile TurtleArena::profile(const DerivationTree &derivation)
+{
+    const ProductionTable &productions = derivation.productions();
+    const uint depth = derivation.depth();
+
+    // profile of every symbol once rewritten g times, [g * 256 + symbol]
+    QVector<SequenceProfile> symbols((depth + 1) * 256);
+    symbols['F'].moves = 1;
+    symbols['['].depth = symbols['['].peak = 1;
+    symbols[']'].depth = -1;
+    symbols[']'].closes = 1;
+    for (uint g = 1; g <= depth; ++g)
+    {
+        for (int c = 0; c < 256; ++c)
+        {
+            const char symbol = static_cast<char>(c);
+            if (productions.is_constant(symbol))
+            {
+                symbols[g * 256 + c] = symbols[(g - 1) * 256 + c];
+                continue;
+            }
+            const char *p = productions.production(symbol);
+            const char *end = p + productions.production_length(symbol);
+            SequenceProfile sequence;
+            for (; p != end; ++p)
+                sequence.add(symbols[(g - 1) * 256 + static_cast<uchar>(*p)]);
+            symbols[g * 256 + c] = sequence;
+        }
+    }
+
+    SequenceProfile state;
+    for (quint64 i = 0; i < derivation.base_length(); ++i)
+        state.add(symbols[depth * 256 + static_cast<uchar>(derivation.base_symbol(i))]);
+
+    TurtleProfile profile;
+    profile.max_depth = static_cast<int>(qMax(Q_INT64_C(0), state.peak));
+    profile.moves = state.moves;
+    profile.runs = saturated_add(state.closes, 1); // a new run after every ']'
+    return profile;
+}
+
+void TurtleArena::reset()
+{
+    // std::vector keeps its storage when cleared ; QVector only when
+    // resized, clear() releasing it before Qt 5.7
+    geometry.clear();
+    stack.resize(0);
+    turtle_stack.resize(0);
+    for (int i = 0; i < chunks.size(); ++i)
+        chunks[i].clear();
+}
+
+void TurtleArena::prepare(const DerivationTree &derivation, bool segments)
+{
+    const TurtleProfile needed = profile(derivation);
+    if (segments)
+    {
+        // half of the budget for the points (2 floats), half for the runs
+        const quint64 max_points = m_budget / 2 / (2 * sizeof(float));
+        const quint64 max_runs = m_budget / 2 / sizeof(quint64);
+        geometry.clear();
+        geometry.segments.reserve(qMin(needed.points(), max_points),
+                                  qMin(needed.runs, max_runs));
+    }
+    stack.resize(0);
+    turtle_stack.resize(0);
+    const int depth = qMin(needed.max_depth, max_reserved_depth);
+    stack.reserve(depth);
+    turtle_stack.reserve(depth);
+}
+
+quint64 TurtleArena::memory_usage() const
+{
+    quint64 usage = geometry.segments.memory_usage();
+    for (int i = 0; i < chunks.size(); ++i)
+        usage += chunks[i].segments.memory_usage();
+    return usage + stack.capacity() * sizeof(TurtleInterpreter::SteppedState)
+            + turtle_stack.capacity() * sizeof(TurtleState);
+}
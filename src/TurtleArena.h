@@ -0,0 +1,109 @@
+#ifndef TURTLEARENA_H
+#define TURTLEARENA_H
+
+#include <QStack>
+
+#include "VirtualTurtle.h"
+#include "TurtleInterpreter.h"
+
+class DerivationTree;
+
+/**
+ * @brief What the interpretation of a state needs, computed from the grammar
+ * only (see TurtleArena::profile()).
+ */
+struct TurtleProfile
+{
+    int max_depth; //!< deepest nesting of brackets
+    quint64 moves; //!< number of forward moves, i.e. of segments (saturated)
+    quint64 runs; //!< bound of the number of polyline runs (saturated)
+
+    /**
+     * @brief Bound of the number of points of the drawing.
+     */
+    quint64 points() const;
+};
+
+/**
+ * @brief TurtleArena owns the storage of a job interpreting states : the
+ * geometry, the stacks of the turtle, and the geometries of the chunks of a
+ * ParallelTurtleInterpreter.
+ *
+ * The storage is sized once from the grammar (see prepare()), and kept
+ * between the jobs : reset() only empties it. The interpretation then never
+ * allocates, instead of growing its buffers as the state is walked. What is
+ * reserved beforehand is bounded by the memory budget of the arena, the
+ * bound given by the grammar being far above the actual drawing for some
+ * grammars : beyond it, the geometry grows as it is drawn.
+ *
+ * A TurtleInterpreter draws into an arena when constructed from it.
+ */
+class TurtleArena
+{
+public:
+    /**
+     * @brief Default memory budget of an arena, in bytes.
+     */
+    static const quint64 default_budget;
+
+    /**
+     * @brief Upper bound of the depth reserved by prepare().
+     */
+    static const int max_reserved_depth;
+
+    /**
+     * @brief Constructor.
+     * @param budget Upper bound of the storage of the geometry reserved by
+     * prepare(), in bytes.
+     */
+    explicit TurtleArena(quint64 budget = default_budget);
+
+    /**
+     * @brief Set the upper bound of the storage of the geometry reserved by
+     * prepare(), in bytes ; the storage already reserved is kept.
+     */
+    inline void set_budget(quint64 budget) { m_budget = budget; }
+
+    /**
+     * @brief Upper bound of the storage of the geometry reserved by
+     * prepare(), in bytes.
+     */
+    inline quint64 budget() const { return m_budget; }
+
+    /**
+     * @brief Measure the interpretation of the state derived by derivation,
+     * without walking it : O(rules x depth + base length), so a derivation
+     * from the axiom (see LSystem::axiom_derivation()) is measured in no time.
+     *
+     * With unbalanced brackets, the depth is only that of the pushes.
+     */
+    static TurtleProfile profile(const DerivationTree &derivation);
+
+    /**
+     * @brief Empty the arena, keeping its storage.
+     */
+    void reset();
+
+    /**
+     * @brief Empty the arena, and make room for the interpretation of the
+     * state derived by derivation (see profile()).
+     * @param segments If false, only the stacks are emptied and reserved,
+     * the geometry being left as is : the turtle does not record its drawing.
+     */
+    void prepare(const DerivationTree &derivation, bool segments = true);
+
+    /**
+     * @brief Memory held by the arena, in bytes.
+     */
+    quint64 memory_usage() const;
+
+    TurtleGeometry geometry;
+    QStack<TurtleInterpreter::SteppedState> stack; //!< for a TurtleInterpreter
+    QStack<TurtleState> turtle_stack; //!< for a VirtualTurtle
+    QVector<TurtleGeometry> chunks; //!< for a ParallelTurtleInterpreter
+
+private:
+    quint64 m_budget;
+};
+
+#endif /* TURTLEARENA_H */
@@ -0,0 +1,141 @@
+#include "TurtleExtents.h"
+
+#include "DerivationTree.h"
+
+#include <QVarLengthArray>
+#include <limits>
+
+namespace
+{
+    /**
+     * @brief Bounds of a sequence of symbols, added up one symbol at a time.
+     */
+    struct SequenceBounds
+    {
+        SequenceBounds() : extent(0), reach(0), stack(), balanced(true) { }
+
+        /**
+         * @brief Add a symbol of the given extent and displacement.
+         */
+        inline void add(qreal symbol_extent, qreal symbol_displacement)
+        {
+            extent = qMax(extent, reach + symbol_extent);
+            reach += symbol_displacement;
+        }
+
+        inline void push() { stack.append(reach); }
+
+        inline void pop()
+        {
+            if (stack.isEmpty())
+                balanced = false;
+            else
+                reach = stack.last(), stack.removeLast();
+        }
+
+        qreal extent; //!< of the symbols added so far
+        qreal reach; //!< bound of the distance of the current state to the start
+        QVarLengthArray<qreal, 16> stack;
+        bool balanced; //!< false if a ']' popped a state pushed before the sequence
+    };
+}
+
+TurtleExtents::TurtleExtents(const ProductionTable &productions, uint depth) :
+    m_extents((depth + 1) * 256, 0), m_displacements((depth + 1) * 256, 0),
+    m_bounded(true)
+{
+    // not rewritten : only 'F' moves, by one unit
+    m_extents['F'] = m_displacements['F'] = 1;
+
+    // the brackets themselves are constants
+    for (int c = 0; c < 256 && m_bounded; ++c)
+    {
+        if (productions.is_constant(static_cast<char>(c)))
+            continue;
+        const char *p = productions.production(static_cast<char>(c));
+        const char *end = p + productions.production_length(static_cast<char>(c));
+        SequenceBounds bounds;
+        for (; p != end; ++p)
+        {
+            if (*p == '[')
+                bounds.push();
+            else if (*p == ']')
+                bounds.pop();
+        }
+        m_bounded = bounds.balanced && bounds.stack.isEmpty();
+    }
+    if (!m_bounded)
+    {
+        m_extents.fill(std::numeric_limits<qreal>::infinity());
+        m_displacements.fill(std::numeric_limits<qreal>::infinity());
+        return;
+    }
+
+    for (uint g = 1; g <= depth; ++g)
+    {
+        for (int c = 0; c < 256; ++c)
+        {
+            if (productions.is_constant(static_cast<char>(c)))
+            {
+                m_extents[g * 256 + c] = m_extents[(g - 1) * 256 + c];
+                m_displacements[g * 256 + c] = m_displacements[(g - 1) * 256 + c];
+                continue;
+            }
+            const char *p = productions.production(static_cast<char>(c));
+            const char *end = p + productions.production_length(static_cast<char>(c));
+            SequenceBounds bounds;
+            for (; p != end; ++p)
+            {
+                if (*p == '[')
+                    bounds.push();
+                else if (*p == ']')
+                    bounds.pop();
+                else
+                    bounds.add(extent(*p, g - 1), displacement(*p, g - 1));
+            }
+            m_extents[g * 256 + c] = bounds.extent;
+            m_displacements[g * 256 + c] = bounds.reach;
+        }
+    }
+}
+
+qreal TurtleExtents::branch_extent(const char *open, const char *end, uint generations,
+                                   const char *&close) const
+{
+    SequenceBounds bounds;
+    for (const char *p = open + 1; p != end; ++p)
+    {
+        if (*p == '[')
+            bounds.push();
+        else if (*p == ']')
+        {
+            if (bounds.stack.isEmpty())
+            {
+                close = p;
+                return bounds.extent;
+            }
+            bounds.pop();
+        }
+        else
+            bounds.add(extent(*p, generations), displacement(*p, generations));
+    }
+    close = nullptr;
+    return std::numeric_limits<qreal>::infinity();
+}
+
+qreal TurtleExtents::state_extent(const DerivationTree &derivation) const
+{
+    SequenceBounds bounds;
+    const uint generations = derivation.depth();
+    for (quint64 i = 0; i < derivation.base_length(); ++i)
+    {
+        const char symbol = derivation.base_symbol(i);
+        if (symbol == '[')
+            bounds.push();
+        else if (symbol == ']')
+            bounds.pop();
+        else
+            bounds.add(extent(symbol, generations), displacement(symbol, generations));
+    }
+    return bounds.balanced ? bounds.extent : std::numeric_limits<qreal>::infinity();
+}
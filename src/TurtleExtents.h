@@ -0,0 +1,69 @@
+#ifndef TURTLEEXTENTS_H
+#define TURTLEEXTENTS_H
+
+#include <QVector>
+
+#include "ProductionTable.h"
+
+class DerivationTree;
+
+/**
+ * @brief TurtleExtents bounds the drawing of every symbol once rewritten a
+ * number of times, computed from the grammar only : O(rules x generations).
+ *
+ * For a symbol expanded g times and interpreted by a TurtleInterpreter from
+ * any state, whatever the angle :
+ * - extent(symbol, g) bounds the distance of the turtle to its start,
+ * - displacement(symbol, g) bounds the distance of its end to its start.
+ * Distances do not depend on the heading, so along a production the bounds
+ * simply add up, '[' and ']' saving and restoring the distance reached.
+ *
+ * If a production has unbalanced brackets, a symbol can pop a state pushed
+ * by another one : nothing is then bounded (see is_bounded()).
+ */
+class TurtleExtents
+{
+public:
+    /**
+     * @brief Compute the bounds for up to depth rewritings.
+     */
+    TurtleExtents(const ProductionTable &productions, uint depth);
+
+    /**
+     * @brief Whether the bounds are finite.
+     */
+    inline bool is_bounded() const { return m_bounded; }
+
+    inline qreal extent(char symbol, uint generations) const
+    {
+        return m_extents[generations * 256 + static_cast<uchar>(symbol)];
+    }
+
+    inline qreal displacement(char symbol, uint generations) const
+    {
+        return m_displacements[generations * 256 + static_cast<uchar>(symbol)];
+    }
+
+    /**
+     * @brief Bound the drawing of the branch opened by the '[' at open, in a
+     * production ending at end whose symbols are expanded generations times.
+     * @param close Set to the matching ']', or to nullptr if there is none
+     * in [open, end) : the branch is then not bounded.
+     * @return The extent of the branch, from the state at open.
+     */
+    qreal branch_extent(const char *open, const char *end, uint generations,
+                        const char *&close) const;
+
+    /**
+     * @brief Extent of the whole state derived by derivation, whose depth
+     * must not exceed the one of the bounds.
+     */
+    qreal state_extent(const DerivationTree &derivation) const;
+
+private:
+    QVector<qreal> m_extents; //!< [generations * 256 + symbol]
+    QVector<qreal> m_displacements; //!< [generations * 256 + symbol]
+    bool m_bounded;
+};
+
+#endif /* TURTLEEXTENTS_H */
@@ -0,0 +1,73 @@
+#include "TurtleInterpreter.h"
+
+#include "TurtleArena.h"
+
+void TurtleGeometry::clear()
+{
+    segments.clear();
+    bounds = QRectF();
+}
+
+qreal TurtleGeometry::fit_scale(const QSizeF &size) const
+{
+    // scale to the most constraining axis ; a flat drawing is only
+    // constrained by its other axis
+    qreal scale = 0;
+    if (bounds.width() > 0)
+        scale = size.width() / bounds.width();
+    if (bounds.height() > 0)
+    {
+        const qreal s = size.height() / bounds.height();
+        scale = (scale > 0) ? qMin(scale, s) : s;
+    }
+    if (scale <= 0)
+        scale = 1;
+    return scale;
+}
+
+QTransform TurtleGeometry::fit(const QSizeF &size) const
+{
+    const qreal scale = fit_scale(size);
+
+    // center the drawing, and flip the Y-axis
+    const qreal dx = (size.width() - bounds.width() * scale) / 2,
+            dy = (size.height() - bounds.height() * scale) / 2;
+    QTransform transform;
+    transform.translate(dx, size.height() - dy);
+    transform.scale(scale, -scale);
+    transform.translate(-bounds.left(), -bounds.top());
+    return transform;
+}
+
+
+TurtleInterpreter::TurtleInterpreter(float angle, TurtleGeometry &geometry) :
+    m_pos(0.f, 0.f), m_steps(0), m_own_stack(), m_stack(m_own_stack),
+    m_rotations(angle, 90.f), // default heading = north (logo-style)
+    m_geometry(geometry), m_new_run(true), m_min_length(0), m_last(), m_pending(false),
+    m_minX(0), m_minY(0), m_maxX(0), m_maxY(0)
+{
+
+}
+
+TurtleInterpreter::TurtleInterpreter(float angle, TurtleArena &arena) :
+    m_pos(0.f, 0.f), m_steps(0), m_own_stack(), m_stack(arena.stack),
+    m_rotations(angle, 90.f),
+    m_geometry(arena.geometry), m_new_run(true), m_min_length(0), m_last(), m_pending(false),
+    m_minX(0), m_minY(0), m_maxX(0), m_maxY(0)
+{
+    m_stack.clear();
+}
+
+void TurtleInterpreter::start_from(const SteppedState &state,
+                                   const QStack<SteppedState> &stack)
+{
+    m_pos = state.first, m_steps = state.second;
+    m_stack = stack;
+    m_new_run = true;
+}
+
+void TurtleInterpreter::finish()
+{
+    flush();
+    m_geometry.bounds = QRectF(QPointF(m_minX, m_minY), QPointF(m_maxX, m_maxY));
+}
@@ -0,0 +1,202 @@
+#ifndef TURTLEINTERPRETER_H
+#define TURTLEINTERPRETER_H
+
+#include <QRectF>
+#include <QSizeF>
+#include <QStack>
+#include <QTransform>
+
+#include "VirtualTurtle.h"
+#include "SegmentBuffer.h"
+
+class TurtleArena;
+
+/**
+ * @brief The drawing of a state by the turtle : one segment per forward move
+ * of unit length, and their bounding box.
+ *
+ * The segments are stored as polyline runs, a new run being started after
+ * each ']'.
+ *
+ * The geometry does not depend on the size of its target : it is only fitted
+ * to it at draw time (see fit()), so that it can be built once and drawn
+ * many times.
+ */
+struct TurtleGeometry
+{
+    SegmentBuffer segments;
+    QRectF bounds; //!< bounding box of the segments and of the origin
+
+    /**
+     * @brief Remove all the segments.
+     */
+    void clear();
+
+    /**
+     * @brief The transform fitting the bounding box into a target of the
+     * given size, centered and keeping its aspect ratio.
+     *
+     * The Y-axis of the geometry is pointing upwards (cartesian system),
+     * unlike the one of the target. The transform is only made of a scaling
+     * and a translation.
+     */
+    QTransform fit(const QSizeF &size) const;
+
+    /**
+     * @brief The scaling of fit(size), i.e. the number of pixels per unit.
+     */
+    qreal fit_scale(const QSizeF &size) const;
+};
+
+/**
+ * @brief TurtleInterpreter interprets the symbols of a state as commands for
+ * a VirtualTurtle, recording what it draws into a TurtleGeometry.
+ *
+ * The commands are :
+ * - 'F' : go forward by one unit, drawing a segment
+ * - '+' / '-' : rotate left / right by the angle
+ * - '[' / ']' : push / pop the state of the turtle
+ * Other symbols are ignored.
+ *
+ * The bounding box is tracked while drawing, so a single pass is enough.
+ * The heading is tracked as a number of rotation steps, whose directions
+ * are read from a RotationTable.
+ */
+class TurtleInterpreter
+{
+public:
+    /**
+     * @brief A state of the turtle : position and heading, in rotation steps.
+     */
+    typedef QPair<QPointF, int> SteppedState;
+
+    /**
+     * @brief Constructor. The turtle starts at the origin, heading north.
+     * @param angle The rotation angle, in degrees.
+     * @param geometry Where to record the drawing.
+     */
+    TurtleInterpreter(float angle, TurtleGeometry &geometry);
+
+    /**
+     * @brief Constructor drawing into the geometry of arena, with its stack :
+     * nothing is allocated if the arena was prepared for the state.
+     */
+    TurtleInterpreter(float angle, TurtleArena &arena);
+
+    /**
+     * @brief Start from the given state and stack of the turtle, instead of
+     * the origin and an empty stack.
+     */
+    void start_from(const SteppedState &state, const QStack<SteppedState> &stack);
+
+    /**
+     * @brief Collapse the moves smaller than length : consecutive forward
+     * moves are then recorded as a single segment, until they span length
+     * (in units, 0 by default : every move is recorded).
+     *
+     * The bounding box stays exact, and the drawing is off by less than
+     * length : used for levels of detail, where length is about a pixel.
+     */
+    inline void set_min_length(float length) { m_min_length = length; }
+
+    /**
+     * @brief Interpret the next symbol of the state.
+     * @return False if it cannot be interpreted, i.e. for a ']' popping
+     * an empty stack.
+     */
+    inline bool interpret(char symbol)
+    {
+        switch (symbol)
+        {
+            case 'F':
+                forward();
+                break;
+            case '+':
+                m_steps = m_rotations.turned(m_steps, -1);
+                break;
+            case '-':
+                m_steps = m_rotations.turned(m_steps, 1);
+                break;
+            case '[':
+                m_stack.push(SteppedState(m_pos, m_steps));
+                break;
+            case ']':
+            {
+                if (m_stack.isEmpty())
+                    return false;
+                flush();
+                const SteppedState state = m_stack.pop();
+                m_pos = state.first, m_steps = state.second;
+                m_new_run = true;
+                break;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Store the bounding box of the drawing in the geometry.
+     * To be called once all the symbols were interpreted.
+     */
+    void finish();
+
+private:
+    /**
+     * @brief Draw a unit segment forward, tracking the extrema.
+     */
+    inline void forward()
+    {
+        if (m_new_run)
+        {
+            m_geometry.segments.move_to(m_pos.x(), m_pos.y());
+            m_last = m_pos;
+            m_new_run = false;
+        }
+        m_pos += m_rotations.direction(m_steps);
+        if (m_min_length > 0 && (m_pos - m_last).manhattanLength() < m_min_length)
+            m_pending = true;
+        else
+        {
+            m_geometry.segments.line_to(m_pos.x(), m_pos.y());
+            m_last = m_pos;
+            m_pending = false;
+        }
+
+        // both extrema are checked independently
+        const qreal x = m_pos.x(), y = m_pos.y();
+        if (x < m_minX)
+            m_minX = x;
+        if (x > m_maxX)
+            m_maxX = x;
+        if (y < m_minY)
+            m_minY = y;
+        if (y > m_maxY)
+            m_maxY = y;
+    }
+
+    /**
+     * @brief Record the moves collapsed so far, if any.
+     */
+    inline void flush()
+    {
+        if (!m_pending)
+            return;
+        m_geometry.segments.line_to(m_pos.x(), m_pos.y());
+        m_last = m_pos;
+        m_pending = false;
+    }
+
+    QPointF m_pos;
+    int m_steps; //!< heading, in rotation steps from north, within a period
+    QStack<SteppedState> m_own_stack; //!< unless drawing into an arena
+    QStack<SteppedState> &m_stack;
+    RotationTable m_rotations;
+    TurtleGeometry &m_geometry;
+    bool m_new_run; //!< whether the turtle jumped since the last segment
+    float m_min_length; //!< see set_min_length()
+    QPointF m_last; //!< last point recorded
+    bool m_pending; //!< whether moves were collapsed since m_last
+    qreal m_minX, m_minY, m_maxX, m_maxY;
+};
+
+#endif /* TURTLEINTERPRETER_H */
@@ -4,6 +4,9 @@
 #include <QPointF>
 #include <QtMath>
 #include <QPair>
+#include <QVector>
+#include <cmath>
+#include <limits>
 
 /**
  * @brief Typedef for the container of a state of the turtle (position+heading).
@@ -44,4 +47,145 @@ struct VirtualTurtle
     float heading;  //!< Turtle's heading (its angle with the origin)
 };
 
+/**
+ * @brief RotationTable gives the direction of a turtle which only rotates by
+ * a fixed angle, its heading being tracked as a number of rotation steps.
+ *
+ * When the angle divides a whole number of turns (e.g. 20, 22.5 or 25
+ * degrees), the directions of a full period are precomputed and no trig is
+ * needed anymore. Otherwise each direction is computed from the number of
+ * steps, so that no rounding error accumulates in the heading either.
+ *
+ * However long the state, the number of steps is kept within a period of
+ * the directions (see turned()), so that it never overflows.
+ */
+class RotationTable
+{
+public:
+    /**
+     * @brief Maximal number of directions in a period.
+     */
+    static const int max_period = 4096;
+
+    /**
+     * @brief Constructor.
+     * @param angle The rotation angle, in degrees.
+     * @param heading The heading at 0 steps, in degrees.
+     */
+    RotationTable(float angle, float heading) : m_angle(angle), m_heading(heading),
+        m_directions(), m_wrap(exact_period(angle))
+    {
+        // smallest number of steps making whole turns, if any
+        for (int n = 1; n <= max_period; ++n)
+        {
+            const double turns = n * static_cast<double>(angle) / 360.;
+            if (std::fabs(turns - std::floor(turns + .5)) * 360. < 1e-4)
+            {
+                m_directions.resize(n);
+                for (int i = 0; i < n; ++i)
+                    m_directions[i] = exact_direction(i);
+                m_wrap = n;
+                break;
+            }
+        }
+    }
+
+    /**
+     * @brief Whether the directions are precomputed.
+     */
+    inline bool periodic() const { return !m_directions.isEmpty(); }
+
+    /**
+     * @brief Number of steps after which the directions repeat (0 if they never do).
+     */
+    inline int period() const { return m_directions.size(); }
+
+    /**
+     * @brief Unit vector of the heading after the given number of steps
+     * (clockwise if positive, following logo's convention).
+     */
+    inline QPointF direction(int steps) const
+    {
+        if (m_directions.isEmpty())
+            return exact_direction(steps);
+        const int period = m_directions.size();
+        int i = steps % period;
+        if (i < 0)
+            i += period;
+        return m_directions[i];
+    }
+
+    /**
+     * @brief The number of steps after turning by delta steps from steps,
+     * reduced within a period of the directions.
+     */
+    inline int turned(int steps, int delta) const
+    {
+        if (m_wrap == 0)
+        {
+            // no period fitting in an int (angles of less than 2 degrees) :
+            // wraps around rather than overflowing
+            return static_cast<int>(static_cast<uint>(steps) + static_cast<uint>(delta));
+        }
+        qint64 i = (static_cast<qint64>(steps) + delta) % m_wrap;
+        if (i < 0)
+            i += m_wrap;
+        return static_cast<int>(i);
+    }
+
+    /**
+     * @brief Rotate the vector v by the given number of steps.
+     */
+    inline QPointF rotated(const QPointF &v, int steps) const
+    {
+        // the rotation between the headings at 0 and at steps
+        const QPointF d0 = direction(0), d = direction(steps);
+        const qreal c = d0.x() * d.x() + d0.y() * d.y(),
+                s = d0.x() * d.y() - d0.y() * d.x();
+        return QPointF(c * v.x() - s * v.y(), s * v.x() + c * v.y());
+    }
+
+private:
+    inline QPointF exact_direction(int steps) const
+    {
+        const double angle = qDegreesToRadians(m_heading + steps * static_cast<double>(m_angle));
+        return QPointF(qCos(angle), qSin(angle));
+    }
+
+    /**
+     * @brief Smallest number of steps by angle, as a float, making whole
+     * turns exactly, or 0 if it does not fit in an int.
+     */
+    static int exact_period(float angle)
+    {
+        // angle = m * 2^e exactly, m being odd
+        int e;
+        const double mantissa = std::frexp(std::fabs(static_cast<double>(angle)), &e);
+        quint64 m = static_cast<quint64>(std::ldexp(mantissa, 24));
+        e -= 24;
+        if (m == 0)
+            return 1;
+        for (; (m & 1) == 0; m >>= 1)
+            ++e;
+
+        // the smallest n such that n * m * 2^e is a multiple of 360
+        if (e < -32 || e > 32)
+            return 0;
+        const quint64 turn = Q_UINT64_C(360) << (e < 0 ? -e : 0);
+        quint64 a = turn, b = m << (e > 0 ? e : 0);
+        while (b != 0)
+        {
+            const quint64 r = a % b;
+            a = b, b = r;
+        }
+        const quint64 n = turn / a;
+        return n <= static_cast<quint64>(std::numeric_limits<int>::max()) ? static_cast<int>(n) : 0;
+    }
+
+    float m_angle;
+    float m_heading;
+    QVector<QPointF> m_directions; //!< one period, if any
+    int m_wrap; //!< period of the steps, see turned(), or 0
+};
+
 #endif /* VIRTUALTURTLE_H */
@@ -16,8 +16,49 @@ TEMPLATE = app
 
 
 SOURCES += tst_lsystemunittest.cpp \
-    ../src/LSystem.cpp
+    ../src/LSystem.cpp \
+    ../src/ProductionTable.cpp \
+    ../src/DerivationTree.cpp \
+    ../src/PackedState.cpp \
+    ../src/MappedState.cpp \
+    ../src/GenerationCache.cpp \
+    ../src/GenerationStore.cpp \
+    ../src/TurtleInterpreter.cpp \
+    ../src/SegmentBuffer.cpp \
+    ../src/ParallelTurtleInterpreter.cpp \
+    ../src/GeometryPainter.cpp \
+    ../src/TileRasterizer.cpp \
+    ../src/SegmentGrid.cpp \
+    ../src/TurtleExtents.cpp \
+    ../src/LodTurtleInterpreter.cpp \
+    ../src/GeometryMemo.cpp \
+    ../src/GrowthMatrix.cpp \
+    ../src/RewriteKernel.cpp \
+    ../src/TurtleArena.cpp \
+    ../src/RenderJob.cpp \
+    ../src/TaskScheduler.cpp
 
 HEADERS += \
     ../src/LSystem.h \
-    ../src/VirtualTurtle.h
+    ../src/VirtualTurtle.h \
+    ../src/ProductionTable.h \
+    ../src/Parallel.h \
+    ../src/DerivationTree.h \
+    ../src/PackedState.h \
+    ../src/MappedState.h \
+    ../src/GenerationCache.h \
+    ../src/GenerationStore.h \
+    ../src/TurtleInterpreter.h \
+    ../src/SegmentBuffer.h \
+    ../src/ParallelTurtleInterpreter.h \
+    ../src/GeometryPainter.h \
+    ../src/TileRasterizer.h \
+    ../src/SegmentGrid.h \
+    ../src/TurtleExtents.h \
+    ../src/LodTurtleInterpreter.h \
+    ../src/GeometryMemo.h \
+    ../src/GrowthMatrix.h \
+    ../src/RewriteKernel.h \
+    ../src/TurtleArena.h \
+    ../src/RenderJob.h \
+    ../src/TaskScheduler.h
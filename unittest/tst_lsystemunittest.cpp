@@ -2,7 +2,20 @@
 #include <QtTest>
 
 #include "../src/LSystem.h"
+#include "../src/PackedState.h"
 #include "../src/VirtualTurtle.h"
+#include "../src/TurtleInterpreter.h"
+#include "../src/TurtleArena.h"
+#include "../src/ParallelTurtleInterpreter.h"
+#include "../src/TileRasterizer.h"
+#include "../src/SegmentGrid.h"
+#include "../src/LodTurtleInterpreter.h"
+#include "../src/TurtleExtents.h"
+#include "../src/GeometryMemo.h"
+#include "../src/RenderJob.h"
+#include "../src/TaskScheduler.h"
+#include "../src/Parallel.h"
+#include "../src/GenerationStore.h"
 
 class LSystemUnitTest : public QObject
 {
@@ -14,7 +27,29 @@ public:
 private Q_SLOTS:
     void iterationTest_data();
     void iterationTest();
+    void productionTableTest();
+    void rewriteKernelTest();
+    void parallelIterationTest();
+    void taskSchedulerTest();
+    void lazyIterationTest();
+    void derivedIterationTest();
+    void growthPredictionTest();
+    void packedStateTest();
+    void outOfCoreTest();
+    void cancelIterationTest();
+    void generationCacheTest();
     void virtualTurtleTest();
+    void rotationTableTest();
+    void turtleInterpreterTest();
+    void turtleArenaTest();
+    void parallelInterpretationTest();
+    void tileRasterizerTest();
+    void segmentGridTest();
+    void levelOfDetailTest();
+    void geometryMemoTest();
+    void renderJobTest();
+    void progressiveRenderTest();
+    void generationStoreTest();
 };
 
 LSystemUnitTest::LSystemUnitTest()
@@ -50,19 +85,523 @@ void LSystemUnitTest::iterationTest()
     LSystem lsystem(LSystem::string_to_state(axiom), rules, 0);
 
     QFETCH(QString, state_0);
-    QCOMPARE(lsystem.state(), state_0.toStdString());
+    QCOMPARE(*lsystem.state(), state_0.toStdString());
 
     QFETCH(QString, state_1);
     lsystem.iterate();
-    QCOMPARE(lsystem.state(), state_1.toStdString());
+    QCOMPARE(*lsystem.state(), state_1.toStdString());
 
     QFETCH(QString, state_2);
     lsystem.iterate();
-    QCOMPARE(lsystem.state(), state_2.toStdString());
+    QCOMPARE(*lsystem.state(), state_2.toStdString());
 
     QFETCH(QString, state_3);
     lsystem.iterate();
-    QCOMPARE(lsystem.state(), state_3.toStdString());
+    QCOMPARE(*lsystem.state(), state_3.toStdString());
+}
+
+void LSystemUnitTest::productionTableTest()
+{
+    RulesDict rules;
+    rules['F'] = "G-F-G", rules['G'] = "F+G+F";
+    ProductionTable table(rules);
+
+    QCOMPARE(table.production_length('F'), State::size_type(5));
+    QCOMPARE(State(table.production('G'), 5), State("F+G+F"));
+    // constants produce themselves
+    QCOMPARE(table.production_length('-'), State::size_type(1));
+    QCOMPARE(*table.production('-'), '-');
+
+    const State state = "F-G";
+    QCOMPARE(table.expanded_length(state.data(), state.data() + state.length()),
+             State::size_type(11));
+    QCOMPARE(table.apply(state), State("G-F-G-F+G+F"));
+    QCOMPARE(table.apply(State()), State());
+}
+
+void LSystemUnitTest::rewriteKernelTest()
+{
+    const RewriteKernel::InstructionSet supported = RewriteKernel::supported_instruction_set();
+    QList<RulesDict> grammars;
+    RulesDict rules;
+    rules['A'] = "AB", rules['B'] = "A";
+    grammars << rules;
+    rules.clear();
+    rules['F'] = "G-F-G", rules['G'] = "F+G+F", rules['X'] = "";
+    grammars << rules;
+    rules.clear();
+    rules['F'] = "F[+F]F[-F][F]";
+    grammars << rules;
+
+    for (int g = 0; g < grammars.size(); ++g)
+    {
+        ProductionTable table(grammars[g]);
+        QCOMPARE(table.instruction_set(), supported);
+
+        // every length of block and of tail
+        State state;
+        for (int i = 0; i < 200; ++i)
+        {
+            state += "ABFGX+-[]"[(i * 7) % 9];
+            table.set_instruction_set(RewriteKernel::Scalar);
+            const State expected = table.apply(state);
+            table.set_instruction_set(supported);
+            QCOMPARE(table.apply(state), expected);
+        }
+    }
+
+    // too many variables, or too long productions : scalar
+    rules.clear();
+    for (char c = 'A'; c <= 'I'; ++c)
+        rules[c] = "AB";
+    QCOMPARE(ProductionTable(rules).instruction_set(), RewriteKernel::Scalar);
+    rules.clear();
+    rules['F'] = "F[+F]F[-F][F]F[+F]F[-F][F]";
+    QCOMPARE(ProductionTable(rules).instruction_set(), RewriteKernel::Scalar);
+}
+
+void LSystemUnitTest::parallelIterationTest()
+{
+    RulesDict rules;
+    rules['F'] = "F[+F]F[-F][F]";
+    LSystem serial("F", rules), parallel("F", rules);
+    serial.set_thread_count(1);
+    parallel.set_thread_count(4);
+    QCOMPARE(parallel.thread_count(), 4);
+
+    // go well past the threshold for the parallel rewriting
+    while (serial.state()->length() < 4 * LSystem::parallel_threshold)
+    {
+        serial.iterate();
+        parallel.iterate();
+        QCOMPARE(*parallel.state(), *serial.state());
+    }
+}
+
+void LSystemUnitTest::taskSchedulerTest()
+{
+    TaskScheduler scheduler(4);
+    QCOMPARE(scheduler.thread_count(), 4);
+
+    // nested loops : the tasks wait for the tasks they submit
+    QVector<quint64> sums(64);
+    parallel_for(scheduler, sums.size(), [&](int i) {
+        QAtomicInteger<quint64> sum(0);
+        parallel_for(scheduler, 100, [&](int j) { sum.fetchAndAddRelaxed(i * j); });
+        sums[i] = sum.load();
+    });
+    for (int i = 0; i < sums.size(); ++i)
+        QCOMPARE(sums[i], quint64(i * 4950));
+
+    // a tree of tasks, deeper than there are workers
+    QAtomicInt leaves(0);
+    std::function<void(int)> split = [&](int depth)
+    {
+        if (depth == 0)
+        {
+            leaves.fetchAndAddRelaxed(1);
+            return;
+        }
+        TaskGroup group(scheduler);
+        group.run([&split, depth]() { split(depth - 1); });
+        group.run([&split, depth]() { split(depth - 1); });
+        group.wait();
+    };
+    TaskGroup group(scheduler);
+    group.run([&split]() { split(10); });
+    group.wait();
+    QVERIFY(group.is_done());
+    QCOMPARE(leaves.load(), 1 << 10);
+
+    // a single worker
+    TaskScheduler single(1);
+    int count = 0;
+    parallel_for(single, 1000, [&](int) { ++count; });
+    QCOMPARE(count, 1000);
+
+    // waiting for a group runs its tasks, not those submitted meanwhile ;
+    // the work of the workers goes before the tasks submitted from outside
+    QSemaphore started, resumed;
+    QAtomicInt first(0), finished(0);
+    single.submit([&]() {
+        started.release();
+        resumed.acquire();
+        single.submit([&]() { first.testAndSetOrdered(0, 1); finished.ref(); });
+    });
+    started.acquire();
+    single.submit([&]() { first.testAndSetOrdered(0, 2); finished.ref(); });
+    bool ran = false;
+    TaskGroup own(single);
+    own.run([&ran]() { ran = true; });
+    own.wait(); // the worker is busy : run on this thread
+    QVERIFY(ran);
+    QCOMPARE(finished.load(), 0);
+    resumed.release();
+    while (finished.load() < 2)
+        QThread::yieldCurrentThread();
+    QCOMPARE(first.load(), 1);
+}
+
+void LSystemUnitTest::lazyIterationTest()
+{
+    RulesDict rules;
+    rules['F'] = "G-F-G", rules['G'] = "F+G+F";
+    rules['X'] = ""; // erased variables produce nothing
+    LSystem materialized("XFX", rules), lazy("XFX", rules);
+    lazy.set_lazy(true);
+
+    for (int n = 1; n <= 4; ++n)
+    {
+        materialized.iterate();
+        lazy.iterate();
+        QCOMPARE(*lazy.state(), State("XFX")); // nothing materialized
+
+        const DerivationTree derivation = lazy.derivation();
+        QCOMPARE(derivation.depth(), uint(n));
+        QCOMPARE(derivation.length(), quint64(materialized.state()->length()));
+        QCOMPARE(lazy.length(), derivation.length());
+
+        // streaming
+        State streamed;
+        DerivationTree::const_iterator it = derivation.begin();
+        for (; it != derivation.end(); ++it)
+            streamed += *it;
+        QCOMPARE(streamed, *materialized.state());
+
+        // depth-first walk, stopped halfway
+        State walked;
+        auto visitor = [&](char symbol) -> bool {
+            walked += symbol;
+            return walked.length() < derivation.length() / 2;
+        };
+        QVERIFY(!derivation.walk(visitor));
+        QCOMPARE(quint64(walked.length()), derivation.length() / 2);
+        QCOMPARE(walked, materialized.state()->substr(0, walked.length()));
+
+        // random access
+        for (quint64 i = 0; i < derivation.length(); ++i)
+            QCOMPARE(derivation.at(i), (*materialized.state())[i]);
+    }
+
+    // leaving the lazy mode materializes the pending generations
+    lazy.set_lazy(false);
+    lazy.iterate();
+    materialized.iterate();
+    QCOMPARE(*lazy.state(), *materialized.state());
+    QCOMPARE(lazy.derivation().depth(), uint(0));
+}
+
+void LSystemUnitTest::derivedIterationTest()
+{
+    RulesDict rules;
+    rules['F'] = "F[+F]F[-F][F]";
+    LSystem lsystem("F", rules);
+
+    // the next generation can be walked before it is materialized
+    GenerationSnapshotPtr derived;
+    QObject::connect(&lsystem, &LSystem::iteration_derived, [&]() {
+        derived = lsystem.latest_snapshot();
+    });
+    for (uint n = 1; n <= 5; ++n)
+    {
+        derived.clear();
+        lsystem.iterate();
+        QVERIFY(!derived.isNull());
+        QCOMPARE(derived->generation, n);
+        QCOMPARE(derived->derivation.depth(), 1u);
+        QVERIFY(derived != lsystem.snapshot());
+        QCOMPARE(lsystem.latest_snapshot(), lsystem.snapshot());
+
+        State walked;
+        auto visitor = [&](char symbol) { walked += symbol; return true; };
+        QVERIFY(derived->derivation.walk(visitor));
+        QCOMPARE(walked, *lsystem.state());
+    }
+}
+
+void LSystemUnitTest::growthPredictionTest()
+{
+    RulesDict rules;
+    rules['F'] = "G-F-G", rules['G'] = "F+G+F";
+    rules['X'] = "";
+    LSystem lsystem("XFX", rules);
+    for (uint n = 0; n <= 6; ++n)
+    {
+        if (n > 0)
+            lsystem.iterate();
+
+        // the counts of every symbol, without iterating
+        const SymbolCounts counts = lsystem.predicted_counts(n);
+        SymbolCounts actual(256, 0);
+        const State state = *lsystem.state();
+        for (State::size_type i = 0; i < state.length(); ++i)
+            ++actual[static_cast<uchar>(state[i])];
+        QCOMPARE(counts, actual);
+        QCOMPARE(lsystem.predicted_length(n), quint64(state.length()));
+        QCOMPARE(lsystem.predicted_memory(n), quint64(state.length()));
+    }
+
+    // exponential growth : saturated
+    QCOMPARE(lsystem.predicted_length(100), std::numeric_limits<quint64>::max());
+    lsystem.set_packed(true);
+    QCOMPARE(lsystem.predicted_memory(6), (lsystem.predicted_length(6) + 15) / 16 * 8);
+
+    // the generations over the memory budget, even packed, and over the
+    // disk budget, are derived lazily : here from the 8th, the 7th being
+    // packed
+    RulesDict doubling;
+    doubling['F'] = "FF";
+    LSystem budgeted("F", doubling);
+    budgeted.set_memory_budget(100);
+    budgeted.set_disk_budget(0);
+    for (int n = 1; n <= 9; ++n)
+    {
+        budgeted.iterate();
+        QCOMPARE(budgeted.length(), quint64(1) << n);
+        QCOMPARE(budgeted.derivation().depth(), uint(n <= 7 ? 0 : n - 7));
+    }
+    QVERIFY(!budgeted.lazy());
+    QCOMPARE(budgeted.predicted_storage(7), LSystem::Packed);
+    QVERIFY(budgeted.state().isNull()); // 128 symbols, over the budget
+    budgeted.set_memory_budget(128);
+    QCOMPARE(*budgeted.state(), State(128, 'F'));
+}
+
+void LSystemUnitTest::packedStateTest()
+{
+    RulesDict rules;
+    rules['F'] = "F[+F]F[-F][F]";
+    const ProductionTable table(rules);
+
+    // 5 symbols : 4 bits per symbol
+    State state = "F";
+    PackedState packed(state, table);
+    QCOMPARE(packed.alphabet_size(), 5);
+    QCOMPARE(packed.bits_per_symbol(), 4);
+
+    for (int n = 1; n <= 6; ++n)
+    {
+        PackedRewriter rewriter(packed, table);
+        // rewrite in uneven ranges to cross the word boundaries
+        for (quint64 i = 0; i < packed.length(); i += 7)
+            rewriter.rewrite(i, qMin<quint64>(i + 7, packed.length()));
+        packed = rewriter.result();
+        state = table.apply(state);
+
+        QCOMPARE(packed.length(), quint64(state.length()));
+        QCOMPARE(packed.unpacked(), state);
+        QVERIFY(packed.memory_usage() <= state.length() / 2 + sizeof(quint64));
+    }
+
+    // more than 16 symbols : 8 bits per symbol
+    rules['A'] = "BCDEFGHIJKLMNOPQRSTUVWXYZ";
+    const PackedState wide("AF", ProductionTable(rules));
+    QCOMPARE(wide.bits_per_symbol(), 8);
+    QCOMPARE(wide.unpacked(), State("AF"));
+
+    // packed L-System, walked without unpacking
+    rules.clear();
+    rules['F'] = "G-F-G", rules['G'] = "F+G+F";
+    LSystem plain("F", rules), compact("F", rules);
+    compact.set_packed(true);
+    QVERIFY(compact.packed());
+    for (int n = 1; n <= 4; ++n)
+    {
+        plain.iterate();
+        compact.iterate();
+
+        State walked;
+        auto visitor = [&](char symbol) -> bool { walked += symbol; return true; };
+        QVERIFY(compact.derivation().walk(visitor));
+        QCOMPARE(walked, *plain.state());
+    }
+    QCOMPARE(*compact.state(), *plain.state());
+}
+
+void LSystemUnitTest::outOfCoreTest()
+{
+    RulesDict rules;
+    rules['X'] = "F+[[X]-X]-F[-FX]+X";
+    rules['F'] = "FF";
+    LSystem plain("X", rules), mapped("X", rules);
+    mapped.set_memory_budget(1000);
+    mapped.set_thread_count(4);
+
+    // the generations over the memory budget are packed if they then fit
+    // in it, here the 4th, and materialized out of core otherwise,
+    // rewritten from file to file (in parallel from the 8th), and streamed
+    QCOMPARE(mapped.predicted_storage(4), LSystem::Packed);
+    QCOMPARE(mapped.predicted_memory(4), quint64(776));
+    for (uint n = 1; n <= 8; ++n)
+    {
+        const LSystem::Storage storage = mapped.predicted_length(n) <= 1000 ? LSystem::InMemory
+                : mapped.predicted_memory(n) <= 1000 ? LSystem::Packed : LSystem::OnDisk;
+        QCOMPARE(mapped.predicted_storage(n), storage);
+        plain.iterate();
+        mapped.iterate();
+        const GenerationSnapshotPtr snapshot = mapped.snapshot();
+        QCOMPARE(snapshot->mapped.isNull(), storage != LSystem::OnDisk);
+        QCOMPARE(snapshot->packed.isNull(), storage != LSystem::Packed);
+        QCOMPARE(snapshot->derivation.depth(), uint(0));
+
+        State walked;
+        auto append = [&](char symbol) { walked += symbol; return true; };
+        QVERIFY(snapshot->derivation.walk(append));
+        QCOMPARE(walked, *plain.state());
+        QCOMPARE(snapshot->derivation.at(walked.length() / 2), walked[walked.length() / 2]);
+    }
+
+    // copied into memory on demand, within the memory budget only : the
+    // snapshot is left as is
+    const GenerationSnapshotPtr on_disk = mapped.snapshot();
+    QVERIFY(mapped.state().isNull());
+    mapped.set_memory_budget(LSystem::default_memory_budget);
+    QCOMPARE(*mapped.state(), *plain.state());
+    QCOMPARE(mapped.snapshot(), on_disk);
+    QVERIFY(on_disk->state.isNull());
+
+    // over the disk budget too : derived lazily, here over the 4th
+    // generation, packed
+    LSystem derived("X", rules);
+    derived.set_memory_budget(1000);
+    derived.set_disk_budget(5000);
+    QCOMPARE(derived.predicted_storage(5), LSystem::Derived);
+    derived.jump_to(5);
+    QVERIFY(!derived.snapshot()->packed.isNull());
+    QCOMPARE(derived.derivation().depth(), uint(1));
+    QCOMPARE(derived.length(), quint64(plain.predicted_length(5)));
+
+    // packed once it fits in memory
+    mapped.set_packed(true);
+    mapped.set_memory_budget(LSystem::default_memory_budget);
+    mapped.iterate();
+    plain.iterate();
+    QVERIFY(mapped.snapshot()->mapped.isNull());
+    QVERIFY(!mapped.snapshot()->packed.isNull());
+    QCOMPARE(*mapped.state(), *plain.state());
+
+    // unpacked out of core when it no longer fits in memory
+    mapped.set_packed(false);
+    mapped.set_memory_budget(1000);
+    mapped.iterate();
+    plain.iterate();
+    QVERIFY(!mapped.snapshot()->mapped.isNull());
+    QVERIFY(mapped.snapshot()->packed.isNull());
+    const QSharedPointer<const MappedState> unpacked = mapped.snapshot()->mapped;
+    QCOMPARE(State(unpacked->data(), unpacked->length()), *plain.state());
+
+    // and kept packed when it fits nowhere unpacked
+    LSystem packed("X", rules);
+    packed.set_packed(true);
+    packed.jump_to(6);
+    packed.set_packed(false);
+    packed.set_memory_budget(1000);
+    packed.set_disk_budget(1000);
+    packed.iterate();
+    QVERIFY(!packed.snapshot()->packed.isNull());
+    QCOMPARE(packed.derivation().depth(), uint(1));
+    QCOMPARE(packed.length(), quint64(plain.predicted_length(7)));
+}
+
+void LSystemUnitTest::cancelIterationTest()
+{
+    RulesDict rules;
+    rules['F'] = "F[+F]F[-F][F]";
+    LSystem lsystem("F", rules);
+    QSignalSpy finished(&lsystem, SIGNAL(iteration_finished()));
+    QSignalSpy cancelled(&lsystem, SIGNAL(iteration_cancelled()));
+
+    lsystem.iterate();
+    QCOMPARE(finished.count(), 1);
+
+    // a cancellation requested while idle is dropped
+    lsystem.cancel();
+    lsystem.iterate();
+    QCOMPARE(finished.count(), 2);
+    QCOMPARE(lsystem.generation(), uint(2));
+
+    // one requested while iterating stops the iteration, which leaves the
+    // system unchanged
+    const QMetaObject::Connection connection = QObject::connect(
+                &lsystem, &LSystem::iteration_derived, [&]() { lsystem.cancel(); });
+    lsystem.iterate();
+    QObject::disconnect(connection);
+    QCOMPARE(cancelled.count(), 1);
+    QCOMPARE(finished.count(), 2);
+    QCOMPARE(lsystem.generation(), uint(2));
+    QCOMPARE(lsystem.length(), quint64(lsystem.state()->length()));
+
+    // the request is consumed
+    lsystem.iterate();
+    QCOMPARE(finished.count(), 3);
+    QCOMPARE(lsystem.generation(), uint(3));
+}
+
+void LSystemUnitTest::generationCacheTest()
+{
+    RulesDict rules;
+    rules['A'] = "AB", rules['B'] = "A";
+    LSystem lsystem("A", rules);
+    for (int i = 0; i < 4; ++i)
+        lsystem.iterate();
+    QCOMPARE(*lsystem.state(), State("ABAABABA"));
+
+    // a snapshot is left untouched by the next iterations
+    const GenerationSnapshotPtr snapshot = lsystem.snapshot();
+    lsystem.iterate();
+    QCOMPARE(snapshot->generation, uint(4));
+    QCOMPARE(*snapshot->state, State("ABAABABA"));
+
+    // going back to a cached generation shares its snapshot
+    QVERIFY(lsystem.is_cached(2));
+    lsystem.jump_to(2);
+    QCOMPARE(lsystem.generation(), uint(2));
+    QCOMPARE(*lsystem.state(), State("ABA"));
+    lsystem.jump_to(4);
+    QCOMPARE(lsystem.snapshot(), snapshot);
+    // and so does stepping back then forth : nothing is rewritten
+    int derived = 0;
+    const QMetaObject::Connection counter = QObject::connect(
+                &lsystem, &LSystem::iteration_derived, [&]() { ++derived; });
+    lsystem.jump_to(3);
+    lsystem.iterate();
+    QObject::disconnect(counter);
+    QCOMPARE(lsystem.snapshot(), snapshot);
+    QCOMPARE(derived, 0);
+
+    // evicted generations are derived again from the closest cached one
+    lsystem.set_cache_budget(8);
+    QVERIFY(!lsystem.is_cached(3));
+    QVERIFY(lsystem.is_cached(0));
+    lsystem.jump_to(3);
+    QCOMPARE(*lsystem.state(), State("ABAAB"));
+    // only the requested generation is published : the ones on the way
+    // are never current, nor walked while produced
+    QVector<uint> published;
+    const QMetaObject::Connection connection = QObject::connect(
+                &lsystem, &LSystem::iteration_derived, [&]() {
+        published << lsystem.generation() << lsystem.latest_snapshot()->generation;
+    });
+    lsystem.jump_to(6);
+    QObject::disconnect(connection);
+    QCOMPARE(published, QVector<uint>() << 3 << 6);
+    QCOMPARE(lsystem.length(), quint64(21));
+
+    // LRU eviction within the budget
+    GenerationCache cache(2 * State(16, 'F').capacity());
+    for (uint g = 0; g < 3; ++g)
+    {
+        QSharedPointer<GenerationSnapshot> entry(new GenerationSnapshot());
+        entry->generation = g;
+        entry->state = QSharedPointer<const State>(new State(16, 'F'));
+        cache.insert(entry);
+        if (g == 1)
+            QVERIFY(!cache.find(0).isNull()); // 0 becomes the most recently used
+    }
+    QCOMPARE(cache.count(), 2);
+    QVERIFY(cache.contains(0));
+    QVERIFY(!cache.contains(1));
+    QCOMPARE(cache.closest(1)->generation, uint(0));
 }
 
 namespace QTest {
@@ -95,6 +634,817 @@ void LSystemUnitTest::virtualTurtleTest()
     COMPARE_QPOINTF(turtle.pos, QPointF(-5.f, 6.3f));
 }
 
+void LSystemUnitTest::rotationTableTest()
+{
+    // 25 degrees : 72 steps make 5 whole turns
+    const RotationTable table(25.f, 90.f);
+    QVERIFY(table.periodic());
+    QCOMPARE(table.period(), 72);
+    COMPARE_QPOINTF(table.direction(0), QPointF(0, 1));
+    COMPARE_QPOINTF(table.direction(-1), table.direction(71));
+    COMPARE_QPOINTF(table.direction(1000), table.direction(1000 % 72));
+
+    // the table matches the turtle, which rotates clockwise
+    VirtualTurtle turtle(QPointF(0, 0));
+    turtle.heading = 90;
+    turtle.right(25.f), turtle.right(25.f);
+    turtle.forward(1.f);
+    COMPARE_QPOINTF(table.direction(2), turtle.pos);
+
+    // no whole turn : exact trig, computed from the number of steps
+    const RotationTable irregular(25.7f, 90.f);
+    QVERIFY(!irregular.periodic());
+    const qreal angle = qDegreesToRadians(90. + 1000 * static_cast<double>(25.7f));
+    COMPARE_QPOINTF(irregular.direction(1000), QPointF(qCos(angle), qSin(angle)));
+
+    // the turns are kept within a period, whatever their number
+    QCOMPARE(table.turned(71, 1), 0);
+    QCOMPARE(table.turned(0, -1), 71);
+    int steps = 0;
+    for (int i = 0; i < 1000; ++i)
+        steps = irregular.turned(steps, -1);
+    QVERIFY(steps >= 0);
+    COMPARE_QPOINTF(irregular.direction(steps), irregular.direction(-1000));
+}
+
+void LSystemUnitTest::turtleInterpreterTest()
+{
+    // a drawing extending the bounding box in every direction
+    const DerivationTree derivation(QSharedPointer<const State>(new State("F[+F][-F][--FF]")),
+                                    ProductionTable(RulesDict()), 0);
+    TurtleGeometry geometry;
+    TurtleInterpreter interpreter(90.f, geometry);
+    auto interpret = [&](char symbol) { return interpreter.interpret(symbol); };
+    QVERIFY(derivation.walk(interpret));
+    interpreter.finish();
+
+    // one run per jump of the turtle : "F[+F]", "F" and "FF"
+    const SegmentBuffer &segments = geometry.segments;
+    QCOMPARE(segments.segment_count(), quint64(5));
+    QCOMPARE(segments.run_count(), quint64(3));
+    QCOMPARE(segments.run_end(0) - segments.run_begin(0), quint64(3));
+    QCOMPARE(segments.run_end(2), segments.point_count());
+    const quint64 last = segments.point_count() - 1;
+    QVERIFY(qAbs(segments.x()[last]) < 1e-5 && qAbs(segments.y()[last] + 1) < 1e-5);
+    QVERIFY(qAbs(geometry.bounds.left() + 1) < 1e-5);
+    QVERIFY(qAbs(geometry.bounds.right() - 1) < 1e-5);
+    QVERIFY(qAbs(geometry.bounds.top() + 1) < 1e-5);
+    QVERIFY(qAbs(geometry.bounds.bottom() - 1) < 1e-5);
+
+    // both extrema of both axes are found, whatever the order of the moves
+    TurtleGeometry diagonal;
+    TurtleInterpreter diagonalInterpreter(45.f, diagonal);
+    const char *path = "-F++F++F++F";
+    for (const char *c = path; *c != '\0'; ++c)
+        QVERIFY(diagonalInterpreter.interpret(*c));
+    diagonalInterpreter.finish();
+    QVERIFY(diagonal.bounds.width() > 1.4 && diagonal.bounds.height() > 1.4);
+
+    // fitted into 100x50 : centered, with the Y-axis flipped
+    const QTransform transform = geometry.fit(QSizeF(100, 50));
+    const QPointF bottomLeft = transform.map(QPointF(-1, -1)),
+            topRight = transform.map(QPointF(1, 1));
+    QVERIFY(qAbs(bottomLeft.x() - 25) < 1e-5 && qAbs(bottomLeft.y() - 50) < 1e-5);
+    QVERIFY(qAbs(topRight.x() - 75) < 1e-5 && qAbs(topRight.y()) < 1e-5);
+
+    // popping an empty stack is an error
+    TurtleGeometry invalid;
+    QVERIFY(!TurtleInterpreter(90.f, invalid).interpret(']'));
+}
+
+/**
+ * @brief The segments of buffer, as lines.
+ */
+static QVector<QLineF> segment_lines(const SegmentBuffer &buffer)
+{
+    QVector<QLineF> lines;
+    for (quint64 run = 0; run < buffer.run_count(); ++run)
+        for (quint64 i = buffer.run_begin(run) + 1; i < buffer.run_end(run); ++i)
+            lines.append(QLineF(buffer.x()[i - 1], buffer.y()[i - 1], buffer.x()[i], buffer.y()[i]));
+    return lines;
+}
+
+void LSystemUnitTest::turtleArenaTest()
+{
+    RulesDict rules;
+    rules['X'] = "F+[[X]-X]-F[-FX]+X", rules['F'] = "FF";
+    LSystem lsystem("X", rules);
+    for (int i = 0; i < 5; ++i)
+        lsystem.iterate();
+    const DerivationTree derivation = lsystem.derivation();
+
+    // the profile is that of the walked state
+    int depth = 0, max_depth = 0;
+    quint64 moves = 0, closes = 0;
+    auto measure = [&](char symbol) -> bool
+    {
+        if (symbol == 'F')
+            ++moves;
+        else if (symbol == '[')
+            max_depth = qMax(max_depth, ++depth);
+        else if (symbol == ']')
+            --depth, ++closes;
+        return true;
+    };
+    QVERIFY(derivation.walk(measure));
+    const TurtleProfile profile = TurtleArena::profile(derivation);
+    QCOMPARE(profile.max_depth, max_depth);
+    QCOMPARE(profile.moves, moves);
+    QCOMPARE(profile.runs, closes + 1);
+    const TurtleProfile axiom_profile = TurtleArena::profile(lsystem.axiom_derivation(5));
+    QCOMPARE(axiom_profile.max_depth, profile.max_depth);
+    QCOMPARE(axiom_profile.moves, profile.moves);
+    QCOMPARE(axiom_profile.runs, profile.runs);
+
+    // an arena draws like a geometry, within the room it was prepared for
+    TurtleGeometry expected;
+    TurtleInterpreter interpreter(25.f, expected);
+    auto interpret = [&](char symbol) { return interpreter.interpret(symbol); };
+    QVERIFY(derivation.walk(interpret));
+    interpreter.finish();
+
+    TurtleArena arena;
+    arena.prepare(lsystem.axiom_derivation(5));
+    const quint64 reserved = arena.memory_usage();
+    for (int render = 0; render < 2; ++render)
+    {
+        arena.prepare(derivation);
+        TurtleInterpreter arenaInterpreter(25.f, arena);
+        auto interpretArena = [&](char symbol) { return arenaInterpreter.interpret(symbol); };
+        QVERIFY(derivation.walk(interpretArena));
+        arenaInterpreter.finish();
+        QCOMPARE(arena.memory_usage(), reserved);
+    }
+    QVERIFY(arena.geometry.segments.point_count() <= profile.points());
+    QCOMPARE(arena.geometry.segments.point_count(), expected.segments.point_count());
+    QCOMPARE(arena.geometry.segments.run_count(), expected.segments.run_count());
+    QCOMPARE(arena.geometry.bounds, expected.bounds);
+
+    // reset() empties the arena, but keeps its storage
+    arena.reset();
+    QVERIFY(arena.geometry.segments.is_empty());
+    QCOMPARE(arena.memory_usage(), reserved);
+
+    // the reservation stays within the budget, the geometry growing beyond
+    TurtleArena small(1024);
+    small.prepare(derivation);
+    QVERIFY(small.geometry.segments.memory_usage() <= 1024);
+    TurtleInterpreter smallInterpreter(25.f, small);
+    auto interpretSmall = [&](char symbol) { return smallInterpreter.interpret(symbol); };
+    QVERIFY(derivation.walk(interpretSmall));
+    smallInterpreter.finish();
+    QCOMPARE(small.geometry.segments.point_count(), expected.segments.point_count());
+
+    // the chunks of a parallel interpretation are drawn into the arena, and
+    // kept for the next one
+    TaskScheduler scheduler(4);
+    ParallelTurtleInterpreter parallel(25.f, scheduler);
+    parallel.set_chunk_count(8);
+    arena.prepare(derivation);
+    QVERIFY(parallel.interpret(derivation, arena));
+    QCOMPARE(arena.chunks.size(), 8);
+    const int segments = segment_lines(expected.segments).size();
+    QCOMPARE(segment_lines(arena.geometry.segments).size(), segments);
+    const quint64 pooled = arena.memory_usage();
+    arena.prepare(derivation);
+    QVERIFY(parallel.interpret(derivation, arena));
+    QCOMPARE(arena.memory_usage(), pooled);
+    QCOMPARE(segment_lines(arena.geometry.segments).size(), segments);
+}
+
+void LSystemUnitTest::parallelInterpretationTest()
+{
+    RulesDict rules;
+    rules['F'] = "F[+F]F[-F][F]";
+    LSystem lsystem("F", rules);
+    lsystem.set_lazy(true);
+    for (int i = 0; i < 4; ++i)
+        lsystem.iterate();
+    const DerivationTree derivation = lsystem.derivation();
+
+    TurtleGeometry serial;
+    TurtleInterpreter interpreter(20.f, serial);
+    auto interpret = [&](char symbol) { return interpreter.interpret(symbol); };
+    QVERIFY(derivation.walk(interpret));
+    interpreter.finish();
+
+    // chunks cut the state inside brackets, even nested ones
+    TaskScheduler scheduler(4);
+    ParallelTurtleInterpreter parallel(20.f, scheduler);
+    parallel.set_chunk_count(37);
+    TurtleGeometry geometry;
+    QVERIFY(parallel.interpret(derivation, geometry));
+
+    const QVector<QLineF> expected = segment_lines(serial.segments),
+            lines = segment_lines(geometry.segments);
+    QCOMPARE(lines.size(), expected.size());
+    for (int i = 0; i < lines.size(); ++i)
+    {
+        COMPARE_QPOINTF(lines[i].p1(), expected[i].p1());
+        COMPARE_QPOINTF(lines[i].p2(), expected[i].p2());
+    }
+    COMPARE_QPOINTF(geometry.bounds.topLeft(), serial.bounds.topLeft());
+    COMPARE_QPOINTF(geometry.bounds.bottomRight(), serial.bounds.bottomRight());
+
+    // popping an empty stack is detected across chunks
+    const DerivationTree invalid(QSharedPointer<const State>(new State("[F]F]F")),
+                                 ProductionTable(RulesDict()), 0);
+    parallel.set_chunk_count(3);
+    QVERIFY(!parallel.interpret(invalid, geometry));
+}
+
+void LSystemUnitTest::tileRasterizerTest()
+{
+    RulesDict rules;
+    rules['F'] = "F[+F]F[-F][F]";
+    LSystem lsystem("F", rules);
+    for (int i = 0; i < 4; ++i)
+        lsystem.iterate();
+    TurtleGeometry geometry;
+    TurtleInterpreter interpreter(20.f, geometry);
+    auto interpret = [&](char symbol) { return interpreter.interpret(symbol); };
+    QVERIFY(lsystem.derivation().walk(interpret));
+    interpreter.finish();
+    const QSize size(301, 203); // not a multiple of the tile size
+    const QTransform transform = geometry.fit(size);
+
+    // a single tile : the reference
+    TaskScheduler scheduler(4);
+    TileRasterizer rasterizer(scheduler);
+    rasterizer.set_tile_size(512);
+    const QImage reference = rasterizer.render(geometry.segments, transform, size);
+    QCOMPARE(reference.size(), size);
+
+    // segments crossing tiles are drawn in all of them
+    uint last_progress = 0;
+    rasterizer.set_progress([&](uint progress) { last_progress = progress; });
+    rasterizer.set_tile_size(16);
+    const QImage image = rasterizer.render(geometry.segments, transform, size);
+    QCOMPARE(last_progress, 100u);
+    int drawn = 0, different = 0;
+    for (int y = 0; y < size.height(); ++y)
+        for (int x = 0; x < size.width(); ++x)
+        {
+            if (reference.pixel(x, y) != qRgb(255, 255, 255))
+                ++drawn;
+            if (qAbs(qGray(image.pixel(x, y)) - qGray(reference.pixel(x, y))) > 8)
+                ++different;
+        }
+    QVERIFY(drawn > 1000);
+    QVERIFY(different <= drawn / 100);
+
+    // streamed by bands of 3 rows of tiles : the same image
+    QTemporaryDir directory;
+    const QString path = directory.path() + "/tiles.ppm";
+    rasterizer.set_band_memory(size.width() * 16 * 4 * 3);
+    QVERIFY(rasterizer.render_to_file(geometry.segments, transform, size, path));
+    const QImage streamed(path);
+    QCOMPARE(streamed.size(), size);
+    QCOMPARE(streamed.convertToFormat(QImage::Format_RGB32),
+             image.convertToFormat(QImage::Format_RGB32));
+}
+
+void LSystemUnitTest::segmentGridTest()
+{
+    RulesDict rules;
+    rules['F'] = "F[+F]F[-F][F]";
+    LSystem lsystem("F", rules);
+    for (int i = 0; i < 5; ++i)
+        lsystem.iterate();
+    TurtleGeometry geometry;
+    TurtleInterpreter interpreter(20.f, geometry);
+    auto interpret = [&](char symbol) { return interpreter.interpret(symbol); };
+    QVERIFY(lsystem.derivation().walk(interpret));
+    interpreter.finish();
+    const SegmentBuffer &segments = geometry.segments;
+
+    TaskScheduler scheduler(4);
+    SegmentGrid grid;
+    grid.build(segments, geometry.bounds, scheduler);
+    QVERIFY(grid.columns() > 1 && grid.rows() > 1);
+    QVERIFY(qAbs(grid.extent() - 1) < 1e-5); // unit segments
+
+    // every segment intersecting an area is visited, once
+    const QRectF bounds = geometry.bounds;
+    const QRectF areas[] = { bounds,
+                             QRectF(bounds.center(), QSizeF(3, 2)),
+                             QRectF(bounds.topLeft(), bounds.size() / 3),
+                             QRectF(bounds.right() + 2, bounds.top(), 5, 5) };
+    for (int a = 0; a < 4; ++a)
+    {
+        const QRectF &area = areas[a];
+        QSet<quint64> visited;
+        bool twice = false;
+        grid.visit(area, [&](quint64 i) {
+            twice = twice || visited.contains(i);
+            visited.insert(i);
+        });
+        QVERIFY(!twice);
+        int missed = 0;
+        const float *xs = segments.x(), *ys = segments.y();
+        segments.for_each_segment(0, segments.point_count(), [&](quint64 i) {
+            const QRectF box = QRectF(QPointF(xs[i], ys[i]),
+                                      QPointF(xs[i + 1], ys[i + 1])).normalized();
+            if (box.intersects(area) && !visited.contains(i))
+                ++missed;
+        });
+        QCOMPARE(missed, 0);
+    }
+    QSet<quint64> all;
+    grid.visit(bounds, [&](quint64 i) { all.insert(i); });
+    QCOMPARE(quint64(all.size()), segments.segment_count());
+
+    // far outside, e.g. a view zoomed a lot : nothing, nor any overflow
+    quint64 far = 0;
+    grid.visit(QRectF(1e12, -1e12, 10, 10), [&](quint64) { ++far; });
+    QCOMPARE(far, quint64(0));
+    all.clear();
+    grid.visit(QRectF(-1e12, -1e12, 2e12, 2e12), [&](quint64 i) { all.insert(i); });
+    QCOMPARE(quint64(all.size()), segments.segment_count());
+}
+
+void LSystemUnitTest::levelOfDetailTest()
+{
+    RulesDict rules;
+    rules['X'] = "F+[[X]-X]-F[-FX]+X";
+    rules['F'] = "FF";
+    LSystem lsystem("X", rules);
+    lsystem.set_lazy(true);
+    for (int i = 0; i < 6; ++i)
+        lsystem.iterate();
+    const DerivationTree derivation = lsystem.derivation();
+    TurtleGeometry exact;
+    TurtleInterpreter interpreter(25.f, exact);
+    auto interpret = [&](char symbol) { return interpreter.interpret(symbol); };
+    QVERIFY(derivation.walk(interpret));
+    interpreter.finish();
+
+    // the extent computed from the grammar bounds the actual drawing
+    const TurtleExtents extents(derivation.productions(), derivation.depth());
+    QVERIFY(extents.is_bounded());
+    QCOMPARE(extents.extent('F', 3), qreal(8));
+    const qreal radius = extents.state_extent(derivation);
+    const SegmentBuffer &segments = exact.segments;
+    for (quint64 i = 0; i < segments.point_count(); ++i)
+        QVERIFY(QLineF(QPointF(0, 0), QPointF(segments.x()[i], segments.y()[i])).length()
+                <= radius + 1e-3);
+
+    // small target : far fewer segments, about the same bounding box
+    LodTurtleInterpreter lod(25.f);
+    TurtleGeometry coarse;
+    const QSizeF target(64, 64);
+    QVERIFY(lod.interpret(derivation, target, coarse));
+    QVERIFY(coarse.segments.segment_count() * 2 < segments.segment_count());
+    const qreal pixel = 1 / exact.fit_scale(target);
+    QVERIFY(qAbs(coarse.bounds.left() - exact.bounds.left()) <= 2 * pixel);
+    QVERIFY(qAbs(coarse.bounds.right() - exact.bounds.right()) <= 2 * pixel);
+    QVERIFY(qAbs(coarse.bounds.bottom() - exact.bounds.bottom()) <= 2 * pixel);
+
+    // large target : every segment is kept
+    TurtleGeometry fine;
+    QVERIFY(lod.interpret(derivation, QSizeF(1 << 14, 1 << 14), fine));
+    QCOMPARE(fine.segments.segment_count(), segments.segment_count());
+
+    // unbalanced productions are never pruned
+    RulesDict unbalanced;
+    unbalanced['F'] = "F]F[";
+    QVERIFY(!TurtleExtents(ProductionTable(unbalanced), 2).is_bounded());
+}
+
+void LSystemUnitTest::geometryMemoTest()
+{
+    RulesDict rules;
+    rules['X'] = "F+[[X]-X]-F[-FX]+X";
+    rules['F'] = "FF";
+    LSystem lsystem("X", rules);
+    lsystem.set_lazy(true);
+    for (int i = 0; i < 7; ++i)
+        lsystem.iterate();
+    const DerivationTree derivation = lsystem.derivation();
+    TurtleGeometry exact;
+    TurtleInterpreter interpreter(25.f, exact);
+    auto interpret = [&](char symbol) { return interpreter.interpret(symbol); };
+    QVERIFY(derivation.walk(interpret));
+    interpreter.finish();
+
+    // the bounding box, from the grammar only
+    const GeometryMemo memo(derivation.productions(), 25.f, derivation.depth());
+    QVERIFY(memo.is_valid());
+    QCOMPARE(memo.moves('F', 3), quint64(8));
+    QCOMPARE(memo.moves('X', 7), exact.segments.segment_count());
+    QRectF bounds;
+    QVERIFY(memo.state_bounds(derivation, bounds));
+    QVERIFY(qAbs(bounds.left() - exact.bounds.left()) < 1e-3);
+    QVERIFY(qAbs(bounds.top() - exact.bounds.top()) < 1e-3);
+    QVERIFY(qAbs(bounds.right() - exact.bounds.right()) < 1e-3);
+    QVERIFY(qAbs(bounds.bottom() - exact.bounds.bottom()) < 1e-3);
+
+    // the copies of the prototypes draw the same segments, in the same order
+    InstancedGeometry instanced;
+    QVERIFY(memo.instantiate(derivation, instanced));
+    QVERIFY(instanced.instances.size() > 1);
+    QCOMPARE(instanced.segment_count(), exact.segments.segment_count());
+    SegmentBuffer expanded;
+    instanced.expand(RotationTable(25.f, 90.f), expanded);
+    QVector<QLineF> expected, actual;
+    exact.segments.for_each_segment(0, exact.segments.point_count(), [&](quint64 i)
+    {
+        expected.append(QLineF(exact.segments.x()[i], exact.segments.y()[i],
+                               exact.segments.x()[i + 1], exact.segments.y()[i + 1]));
+    });
+    expanded.for_each_segment(0, expanded.point_count(), [&](quint64 i)
+    {
+        actual.append(QLineF(expanded.x()[i], expanded.y()[i],
+                             expanded.x()[i + 1], expanded.y()[i + 1]));
+    });
+    QCOMPARE(actual.size(), expected.size());
+    for (int i = 0; i < actual.size(); ++i)
+    {
+        QVERIFY((actual[i].p1() - expected[i].p1()).manhattanLength() < 1e-3);
+        QVERIFY((actual[i].p2() - expected[i].p2()).manhattanLength() < 1e-3);
+    }
+
+    // aperiodic angles and unbalanced productions are not memoized
+    QVERIFY(!GeometryMemo(derivation.productions(), 33.3f, 2).is_valid());
+    RulesDict unbalanced;
+    unbalanced['F'] = "F]F[";
+    QVERIFY(!GeometryMemo(ProductionTable(unbalanced), 25.f, 2).is_valid());
+}
+
+void LSystemUnitTest::renderJobTest()
+{
+    RulesDict plant, koch;
+    plant['X'] = "F+[[X]-X]-F[-FX]+X";
+    plant['F'] = "FF";
+    koch['F'] = "F+F--F+F";
+    LSystem plant_lsystem("X", plant), koch_lsystem("F--F--F", koch);
+    plant_lsystem.jump_to(5);
+    koch_lsystem.jump_to(4);
+    LSystem *lsystems[] = { &plant_lsystem, &koch_lsystem };
+    const float angles[] = { 25.f, 60.f };
+
+    // headless : the geometry only
+    RenderInput input(plant_lsystem);
+    input.angle = angles[0];
+    RenderJob headless(input);
+    headless.run();
+    QVERIFY(headless.output().valid);
+    QVERIFY(headless.output().image.isNull());
+    const TurtleGeometry &geometry = *headless.output().geometry;
+
+    TurtleGeometry serial;
+    TurtleInterpreter interpreter(angles[0], serial);
+    auto interpret = [&](char symbol) { return interpreter.interpret(symbol); };
+    QVERIFY(plant_lsystem.derivation().walk(interpret));
+    interpreter.finish();
+    const QVector<QLineF> expected = segment_lines(serial.segments),
+            lines = segment_lines(geometry.segments);
+    QCOMPARE(lines.size(), expected.size());
+    for (int i = 0; i < lines.size(); ++i)
+    {
+        COMPARE_QPOINTF(lines[i].p1(), expected[i].p1());
+        COMPARE_QPOINTF(lines[i].p2(), expected[i].p2());
+    }
+
+    // the arena of the caller keeps its storage from a job to the next one,
+    // the output being a copy of its geometry
+    TurtleArena arena;
+    quint64 reserved = 0;
+    for (int i = 0; i < 2; ++i)
+    {
+        RenderJob pooled(input);
+        pooled.set_arena(&arena);
+        pooled.run();
+        QVERIFY(pooled.output().valid);
+        QCOMPARE(segment_lines(pooled.output().geometry->segments), lines);
+        QVERIFY(arena.geometry.segments.is_empty());
+        if (i == 0)
+            reserved = arena.memory_usage();
+        QCOMPARE(arena.memory_usage(), reserved);
+    }
+    QVERIFY(reserved > 0);
+
+    // jobs share nothing : several grammars and viewports at once
+    TaskScheduler scheduler(4);
+    QVector<QSharedPointer<RenderJob> > jobs;
+    for (int i = 0; i < 4; ++i)
+    {
+        RenderInput input(*lsystems[i % 2]);
+        input.angle = angles[i % 2];
+        input.size = QSize(200, 150);
+        if (i >= 2)
+            input.view = QTransform::fromScale(2, 2);
+        jobs.append(QSharedPointer<RenderJob>(new RenderJob(input)));
+    }
+    for (int i = 0; i < jobs.size(); ++i)
+        jobs[i]->start(scheduler);
+    for (int i = 0; i < jobs.size(); ++i)
+    {
+        jobs[i]->wait();
+        const RenderOutput &output = jobs[i]->output();
+        QVERIFY(output.valid);
+        QCOMPARE(output.image.size(), QSize(200, 150));
+        QCOMPARE(output.grid.isNull(), i < 2);
+        int drawn = 0;
+        for (int y = 0; y < 150; ++y)
+            for (int x = 0; x < 200; ++x)
+                if (output.image.pixel(x, y) != qRgb(255, 255, 255))
+                    ++drawn;
+        QVERIFY(drawn > 100);
+    }
+    QCOMPARE(jobs[0]->output().geometry->segments.segment_count(),
+             serial.segments.segment_count());
+
+    // the geometry of a previous job is not interpreted again
+    RenderInput again(koch_lsystem);
+    again.angle = angles[1];
+    again.size = QSize(200, 150);
+    again.view = jobs[3]->input().view;
+    again.geometry = jobs[3]->output().geometry;
+    again.grid = jobs[3]->output().grid;
+    RenderJob reused(again);
+    reused.run();
+    QVERIFY(reused.output().valid);
+    QCOMPARE(reused.output().geometry, jobs[3]->output().geometry);
+    QCOMPARE(reused.output().image, jobs[3]->output().image);
+
+    // a long state is drawn by copies of the drawings of its subtrees : the
+    // same segments
+    plant_lsystem.jump_to(7);
+    RenderInput instanced_input(plant_lsystem);
+    instanced_input.angle = angles[0];
+    RenderJob instanced(instanced_input);
+    instanced.run();
+    QVERIFY(instanced.output().valid);
+    TurtleGeometry long_serial;
+    TurtleInterpreter long_interpreter(angles[0], long_serial);
+    auto long_interpret = [&](char symbol) { return long_interpreter.interpret(symbol); };
+    QVERIFY(plant_lsystem.derivation().walk(long_interpret));
+    long_interpreter.finish();
+    const TurtleGeometry &instanced_geometry = *instanced.output().geometry;
+    QCOMPARE(instanced_geometry.segments.segment_count(), long_serial.segments.segment_count());
+    COMPARE_QPOINTF(instanced_geometry.bounds.topLeft(), long_serial.bounds.topLeft());
+    COMPARE_QPOINTF(instanced_geometry.bounds.bottomRight(), long_serial.bounds.bottomRight());
+
+    // popping an empty stack
+    LSystem invalid("[F]F]F", RulesDict());
+    RenderJob failed((RenderInput(invalid)));
+    failed.run();
+    QVERIFY(!failed.output().valid);
+    QVERIFY(!failed.output().error.isEmpty());
+}
+
+void LSystemUnitTest::progressiveRenderTest()
+{
+    RulesDict koch;
+    koch['F'] = "F+F--F+F";
+    LSystem lsystem("F--F--F", koch);
+    lsystem.jump_to(8); // interpreted by a single turtle
+
+    RenderInput input(lsystem);
+    input.angle = 60.f;
+    input.size = QSize(200, 150);
+    RenderJob direct(input);
+    direct.run();
+    QVERIFY(direct.output().valid);
+
+    // the partial images grow, and the job renders the same in the end
+    input.frame_interval = 1;
+    RenderJob progressive(input);
+    QVector<QImage> frames;
+    QObject::connect(&progressive, &RenderJob::frame_ready,
+                     [&](const QImage &image) { frames.append(image); });
+    progressive.run();
+    QVERIFY(progressive.output().valid);
+    QVERIFY(!frames.isEmpty());
+    int last_drawn = 0;
+    for (int i = 0; i < frames.size(); ++i)
+    {
+        QCOMPARE(frames[i].size(), QSize(200, 150));
+        int drawn = 0;
+        for (int y = 0; y < 150; ++y)
+            for (int x = 0; x < 200; ++x)
+                if (frames[i].pixel(x, y) != qRgb(255, 255, 255))
+                    ++drawn;
+        QVERIFY(drawn > 0 && drawn >= last_drawn);
+        last_drawn = drawn;
+    }
+    QCOMPARE(progressive.output().geometry->segments.segment_count(),
+             direct.output().geometry->segments.segment_count());
+    const QRectF &bounds = progressive.output().geometry->bounds;
+    COMPARE_QPOINTF(bounds.topLeft(), direct.output().geometry->bounds.topLeft());
+    COMPARE_QPOINTF(bounds.bottomRight(), direct.output().geometry->bounds.bottomRight());
+    const QImage &image = progressive.output().image, &reference = direct.output().image;
+    QCOMPARE(image.size(), reference.size());
+    int different = 0;
+    for (int y = 0; y < 150; ++y)
+        for (int x = 0; x < 200; ++x)
+            if (qAbs(qGray(image.pixel(x, y)) - qGray(reference.pixel(x, y))) > 8)
+                ++different;
+    QVERIFY(different < last_drawn / 10);
+
+    // the partial images are fitted to the final drawing (periodic angle) :
+    // what they show is in the final image
+    const QImage &last = frames.last(), &final = direct.output().image;
+    int outside = 0;
+    for (int y = 0; y < 150; ++y)
+        for (int x = 0; x < 200; ++x)
+            if (last.pixel(x, y) != qRgb(255, 255, 255) && final.pixel(x, y) == qRgb(255, 255, 255))
+                ++outside;
+    QVERIFY(outside < last_drawn / 10);
+
+    // an instanced geometry has no partial images
+    lsystem.iterate();
+    RenderInput instanced(lsystem);
+    instanced.angle = 60.f;
+    instanced.size = QSize(200, 150);
+    instanced.frame_interval = 1;
+    RenderJob instancing(instanced);
+    frames.clear();
+    QObject::connect(&instancing, &RenderJob::frame_ready,
+                     [&](const QImage &image) { frames.append(image); });
+    instancing.run();
+    QVERIFY(instancing.output().valid);
+    QVERIFY(frames.isEmpty());
+
+    // the chunks of a parallel interpretation (angle not periodic : no
+    // instancing) are drawn in order
+    TaskScheduler scheduler(4);
+    RenderInput parallel(lsystem);
+    parallel.angle = 23.456f;
+    parallel.size = QSize(200, 150);
+    RenderJob reference_job(parallel);
+    reference_job.start(scheduler);
+    reference_job.wait();
+    QVERIFY(reference_job.output().valid);
+    parallel.frame_interval = 1;
+    RenderJob chunked(parallel);
+    frames.clear();
+    QObject::connect(&chunked, &RenderJob::frame_ready,
+                     [&](const QImage &image) { frames.append(image); });
+    chunked.start(scheduler);
+    chunked.wait();
+    QVERIFY(chunked.output().valid);
+    QVERIFY(!frames.isEmpty());
+    last_drawn = 0;
+    for (int i = 0; i < frames.size(); ++i)
+    {
+        int drawn = 0;
+        for (int y = 0; y < 150; ++y)
+            for (int x = 0; x < 200; ++x)
+                if (frames[i].pixel(x, y) != qRgb(255, 255, 255))
+                    ++drawn;
+        QVERIFY(drawn > 0 && drawn >= last_drawn);
+        last_drawn = drawn;
+    }
+    QCOMPARE(chunked.output().geometry->segments.segment_count(),
+             reference_job.output().geometry->segments.segment_count());
+    QCOMPARE(chunked.output().image, reference_job.output().image);
+}
+
+void LSystemUnitTest::generationStoreTest()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const GenerationStorePtr store(new GenerationStore(directory.path()));
+
+    RulesDict rules;
+    rules['X'] = "F+[[X]-X]-F[-FX]+X";
+    rules['F'] = "FF";
+    LSystem lsystem("X", rules);
+    lsystem.jump_to(5);
+    TurtleGeometry geometry;
+    TurtleInterpreter interpreter(25.f, geometry);
+    auto interpret = [&](char symbol) { return interpreter.interpret(symbol); };
+    QVERIFY(lsystem.derivation().walk(interpret));
+    interpreter.finish();
+
+    // the state and the geometry, read back as written
+    const QByteArray &grammar = lsystem.grammar();
+    QVERIFY(!store->contains(grammar, 5));
+    QVERIFY(store->save(grammar, 5, lsystem.derivation()));
+    QVERIFY(store->save_geometry(grammar, 5, 25.f, geometry));
+    QVERIFY(store->contains(grammar, 5));
+    QVERIFY(!store->contains(grammar, 4));
+    QVERIFY(!store->contains(LSystem("F", rules).grammar(), 5));
+    const QSharedPointer<const MappedState> state = store->load_state(grammar, 5);
+    QVERIFY(!state.isNull());
+    QCOMPARE(State(state->data(), state->length()), *lsystem.state());
+    TurtleGeometry loaded;
+    QVERIFY(!store->load_geometry(grammar, 5, 60.f, loaded));
+    QVERIFY(store->load_geometry(grammar, 5, 25.f, loaded));
+    QCOMPARE(loaded.bounds, geometry.bounds);
+    QCOMPARE(loaded.segments.run_count(), geometry.segments.run_count());
+    QCOMPARE(segment_lines(loaded.segments), segment_lines(geometry.segments));
+
+    // another L-System of the same grammar maps the file rather than
+    // iterating, and derives the next generations from it
+    LSystem reopened("X", rules);
+    reopened.set_store(store);
+    reopened.jump_to(5);
+    QVERIFY(!reopened.snapshot()->mapped.isNull());
+    QCOMPARE(reopened.derivation().depth(), uint(0));
+    QCOMPARE(*reopened.state(), *lsystem.state());
+    reopened.iterate();
+    lsystem.iterate();
+    QCOMPARE(*reopened.state(), *lsystem.state());
+
+    // a job loads the geometry rather than interpreting : here a fake one,
+    // stored for another angle besides the first one
+    TurtleGeometry fake;
+    TurtleInterpreter line(60.f, fake);
+    QVERIFY(line.interpret('F'));
+    line.finish();
+    QVERIFY(store->save_geometry(grammar, 5, 60.f, fake));
+    QVERIFY(store->load_geometry(grammar, 5, 25.f, loaded));
+    QCOMPARE(loaded.segments.run_count(), geometry.segments.run_count());
+    reopened.jump_to(5);
+    RenderInput input(reopened);
+    input.angle = 60.f;
+    RenderJob job(input);
+    job.run();
+    QVERIFY(job.output().valid);
+    QCOMPARE(job.output().geometry->segments.segment_count(), quint64(1));
+
+    // a corrupted file is ignored : patch a field of the header (at its
+    // offset in the format version 1), or of a section
+    auto field = [](const QString &path, qint64 offset) -> quint64
+    {
+        quint64 value = 0;
+        QFile file(path);
+        file.open(QIODevice::ReadOnly);
+        file.seek(offset);
+        file.read(reinterpret_cast<char *>(&value), sizeof(value));
+        return value;
+    };
+    auto patch = [](const QString &path, qint64 offset, quint64 value)
+    {
+        QFile file(path);
+        file.open(QIODevice::ReadWrite);
+        file.seek(offset);
+        file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    };
+    const QString state_path = store->path(grammar, 5),
+            geometry_path = store->geometry_path(grammar, 5, 60.f);
+    const qint64 state_length_field = 64, runs_offset_field = 96;
+    const quint64 state_length = field(state_path, state_length_field);
+    patch(state_path, state_length_field, Q_UINT64_C(1) << 40);
+    QVERIFY(!store->contains(grammar, 5)); // the state would end past the file
+    patch(state_path, state_length_field, state_length - 1);
+    QVERIFY(store->contains(grammar, 5));
+    LSystem corrupted("X", rules); // of another length than predicted
+    corrupted.set_store(store);
+    corrupted.jump_to(5);
+    QVERIFY(corrupted.snapshot()->mapped.isNull());
+    QCOMPARE(*corrupted.state(), *reopened.state());
+    patch(state_path, state_length_field, state_length);
+    const qint64 first_run = static_cast<qint64>(field(geometry_path, runs_offset_field));
+    patch(geometry_path, first_run, 1000); // past the points
+    QVERIFY(!store->load_geometry(grammar, 5, 60.f, loaded));
+    patch(geometry_path, first_run, 0);
+    QVERIFY(store->load_geometry(grammar, 5, 60.f, loaded));
+
+    // over the budget : not stored
+    GenerationStore small(directory.path(), 1000);
+    QVERIFY(!small.save(grammar, 6, lsystem.derivation()));
+    QVERIFY(!small.contains(grammar, 6));
+
+    // over the total budget : the least recently used files are removed
+    QTemporaryDir bounded_directory;
+    QVERIFY(bounded_directory.isValid());
+    LSystem generations("X", rules);
+    quint64 sizes[4] = { 0, 0, 0, 0 };
+    for (uint n = 1; n <= 3; ++n)
+    {
+        generations.iterate();
+        QVERIFY(store->save(grammar, n, generations.derivation()));
+        sizes[n] = static_cast<quint64>(QFileInfo(store->path(grammar, n)).size());
+    }
+    const GenerationStore bounded(bounded_directory.path(), GenerationStore::default_budget,
+                                  sizes[1] + sizes[2] + sizes[3] - 1);
+    generations.jump_to(0);
+    for (uint n = 1; n <= 2; ++n)
+    {
+        generations.iterate();
+        QVERIFY(bounded.save(grammar, n, generations.derivation()));
+        QTest::qSleep(20); // apart in time, whatever the resolution of the file system
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    QVERIFY(!bounded.load_state(grammar, 1).isNull()); // now more recent than the 2nd
+    QTest::qSleep(20);
+    generations.iterate();
+    QVERIFY(bounded.save(grammar, 3, generations.derivation()));
+    QVERIFY(bounded.contains(grammar, 1));
+    QVERIFY(!bounded.contains(grammar, 2));
+#else
+    generations.iterate();
+    QVERIFY(bounded.save(grammar, 3, generations.derivation()));
+    QVERIFY(!bounded.contains(grammar, 1));
+    QVERIFY(bounded.contains(grammar, 2));
+#endif
+    QVERIFY(bounded.contains(grammar, 3));
+}
+
 QTEST_APPLESS_MAIN(LSystemUnitTest)
 
 #include "tst_lsystemunittest.moc"